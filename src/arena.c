@@ -0,0 +1,106 @@
+#include "arena.h"
+#include "exception.h"
+#include "memory.h"
+#include <stdbool.h>
+
+struct arena_chunk {
+    struct arena_chunk  *next;
+    max_align_t         data[];
+};
+
+#define ARENA_ALIGN     _Alignof(max_align_t)
+
+void arena_init(arena_t *arena) {
+    arena->chunks = NULL;
+    arena->p = NULL;
+    arena->end = NULL;
+}
+
+// Returns NULL if out of memory. Requests larger than a chunk get a chunk of
+// their own, which leaves the current one in place.
+void *arena_alloc(arena_t *arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    if(size <= (size_t)(arena->end - arena->p)) {
+        void *p = arena->p;
+        arena->p += size;
+        return p;
+    }
+
+    bool large = size > ARENA_CHUNK_SIZE / 4;
+    size_t chunk_size = large ? size : ARENA_CHUNK_SIZE;
+    struct arena_chunk *chunk = malloc(sizeof(struct arena_chunk) + chunk_size);
+    if(!chunk)
+        return NULL;
+
+    uint8_t *p = (uint8_t *)chunk->data;
+    if(large && arena->chunks) {
+        chunk->next = arena->chunks->next;
+        arena->chunks->next = chunk;
+        return p;
+    }
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    arena->p = p + size;
+    arena->end = p + chunk_size;
+    return p;
+}
+
+void arena_release(arena_t *arena) {
+    struct arena_chunk *chunk = arena->chunks;
+    while(chunk) {
+        struct arena_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena_init(arena);
+}
+
+// Move the chunks of src to dst, which frees them with its own. The free
+// space left in src is given up; dst keeps bumping its current chunk.
+void arena_merge(arena_t *dst, arena_t *src) {
+    struct arena_chunk *chunk = src->chunks;
+    while(chunk) {
+        struct arena_chunk *next = chunk->next;
+        if(dst->chunks) {
+            chunk->next = dst->chunks->next;
+            dst->chunks->next = chunk;
+        }
+        else {
+            chunk->next = NULL;
+            dst->chunks = chunk;
+        }
+        chunk = next;
+    }
+    arena_init(src);
+}
+
+error_t arena_vector_new(arena_t *arena, vector_t *vec, size_t ent_size, size_t len, size_t cap) {
+    __try {
+        vec->elem = NULL;
+        if(cap) {
+            vec->elem = arena_alloc(arena, ent_size * cap);
+            __throwif(ERR_FAILED, !vec->elem);
+        }
+        vec->cap = cap;
+        vec->len = len;
+        vec->ent_size = ent_size;
+    }
+    __catch:
+        return err;
+}
+
+error_t arena_vector_move(arena_t *arena, vector_t *vec) {
+    __try {
+        void *elem = NULL;
+        if(vec->len) {
+            elem = arena_alloc(arena, vec->ent_size * vec->len);
+            __throwif(ERR_FAILED, !elem);
+            memcpy(elem, vec->elem, vec->ent_size * vec->len);
+        }
+        free(vec->elem);
+        vec->elem = elem;
+        vec->cap = vec->len;
+    }
+    __catch:
+        return err;
+}
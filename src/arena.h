@@ -0,0 +1,35 @@
+#pragma once
+
+// arena.h defines the bump allocator backing a decoded module.
+// Allocations are carved out of chunks and never freed on their own;
+// arena_release frees every chunk at once. An arena is not thread-safe:
+// threads allocate from arenas of their own and merge them afterwards.
+
+#include "vector.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARENA_CHUNK_SIZE    (64 * 1024)
+
+struct arena_chunk;
+
+typedef struct {
+    struct arena_chunk  *chunks;
+    uint8_t             *p;
+    uint8_t             *end;
+} arena_t;
+
+// vectors allocated from an arena must not grow
+#define VECTOR_NEW_IN(arena, vec, l, c)                                                 \
+    arena_vector_new(arena, (vector_t *)vec, sizeof(__typeof__(*(vec)->elem)), l, c)
+
+// move a vector grown with malloc into the arena, trimmed to its length
+#define VECTOR_MOVE_IN(arena, vec)                                                      \
+    arena_vector_move(arena, (vector_t *)vec)
+
+void arena_init(arena_t *arena);
+void *arena_alloc(arena_t *arena, size_t size);
+void arena_release(arena_t *arena);
+void arena_merge(arena_t *dst, arena_t *src);
+error_t arena_vector_new(arena_t *arena, vector_t *vec, size_t ent_size, size_t len, size_t cap);
+error_t arena_vector_move(arena_t *arena, vector_t *vec);
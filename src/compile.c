@@ -0,0 +1,910 @@
+#include "compile.h"
+#include "print.h"
+#include "exception.h"
+#include "memory.h"
+#include "numeric.h"
+
+// label of an enclosing block while compiling
+typedef struct {
+    list_elem_t     link;
+    bool            resolved;
+    // position of the branch target once it is resolved
+    uint32_t        target;
+    // target cells waiting for the label to be resolved, chained through the cells
+    // themselves (position + 1, 0 terminates the chain)
+    uint32_t        fixups;
+} ctrl_t;
+
+typedef struct {
+    module_t        *mod;
+    func_t          *func;
+    code_t          *code;
+    list_t          labels;
+    // next side table entry
+    uint32_t        branch;
+    // memory 0 is a 64-bit memory
+    bool            mem64;
+
+    // register code only
+    uint32_t        num_locals;
+    // operand height and the slot holding each operand
+    uint32_t        height;
+    VECTOR(uint32_t) slots;
+    // the stack index is set to height
+    bool            synced;
+    // the rest of the instruction sequence is unreachable
+    bool            unreachable;
+    // destination cell of the last instruction if it computed the top operand, 0 otherwise
+    size_t          dst_cell;
+} compiler_t;
+
+static inline void emit(code_t *code, uint32_t cell) {
+    VECTOR_APPEND(code, cell);
+}
+
+static inline void emit_u64(code_t *code, uint64_t v) {
+    emit(code, v & 0xffffffff);
+    emit(code, v >> 32);
+}
+
+static inline void push_ctrl(compiler_t *c, ctrl_t *l) {
+    *l = (ctrl_t){.resolved = false, .fixups = 0};
+    list_push_back(&c->labels, &l->link);
+}
+
+// resolve the label to the current position and patch the waiting target cells
+static void resolve_ctrl(compiler_t *c, ctrl_t *l) {
+    code_t *code = c->code;
+
+    l->resolved = true;
+    l->target = code->len;
+
+    for(uint32_t p = l->fixups; p; ) {
+        uint32_t cell = p - 1;
+        p = code->elem[cell];
+        code->elem[cell] = l->target - cell;
+    }
+    l->fixups = 0;
+}
+
+// emit "target height arity" for a branch to the label labelidx,
+// taking height and arity from the next side table entry
+static error_t emit_branch(compiler_t *c, labelidx_t labelidx) {
+    __try {
+        code_t *code = c->code;
+
+        ctrl_t *l = LIST_GET_ELEM(&c->labels, ctrl_t, link, labelidx);
+        branch_t *b = VECTOR_ELEM(&c->func->sidetable, c->branch++);
+        __throwif(ERR_FAILED, !l || !b);
+
+        if(l->resolved) {
+            emit(code, l->target - code->len);
+        }
+        else {
+            uint32_t cell = code->len;
+            emit(code, l->fixups);
+            l->fixups = cell + 1;
+        }
+        emit(code, b->height);
+        emit(code, b->arity);
+    }
+    __catch:
+        return err;
+}
+
+static error_t compile_instrs(compiler_t *c, instr_t *ip);
+
+// memory 0 with 32-bit addresses is accessed by the plain memory instructions
+static inline bool plain_mem(compiler_t *c, memidx_t x) {
+    return x == 0 && !c->mem64;
+}
+
+// prefix an instruction on memory x with OP_MEMX unless it is plain (or force)
+static bool emit_memx(compiler_t *c, memidx_t x, bool force) {
+    if(plain_mem(c, x) && !force)
+        return false;
+    emit(c->code, OP_MEMX);
+    emit(c->code, x);
+    return true;
+}
+
+static error_t compile_instr(compiler_t *c, instr_t *ip) {
+    __try {
+        code_t *code = c->code;
+        ctrl_t l;
+
+        switch(ip->op1) {
+            // blocks need no code: a branch carries its target and the stack height to unwind to
+            case OP_BLOCK:
+                push_ctrl(c, &l);
+                __throwiferr(compile_instrs(c, ip->in1));
+                resolve_ctrl(c, &l);
+                list_pop_tail(&c->labels);
+                break;
+
+            case OP_LOOP:
+                push_ctrl(c, &l);
+                resolve_ctrl(c, &l);
+                __throwiferr(compile_instrs(c, ip->in1));
+                list_pop_tail(&c->labels);
+                break;
+
+            case OP_IF: {
+                emit(code, OP_IF);
+                size_t else_cell = code->len;
+                emit(code, 0);
+
+                push_ctrl(c, &l);
+                __throwiferr(compile_instrs(c, ip->in1));
+
+                // in1 is terminated by "else end" if there is an else arm
+                size_t end_cell = code->len - 1;
+                code->elem[else_cell] = code->len - else_cell;
+                if(ip->in2) {
+                    __throwiferr(compile_instrs(c, ip->in2));
+                    code->elem[end_cell] = code->len - end_cell;
+                }
+                resolve_ctrl(c, &l);
+                list_pop_tail(&c->labels);
+                break;
+            }
+
+            case OP_ELSE:
+                // patched by the enclosing if
+                emit(code, OP_ELSE);
+                emit(code, 0);
+                break;
+
+            case OP_END:
+                break;
+
+            case OP_BR:
+            case OP_BR_IF:
+                emit(code, ip->op1);
+                __throwiferr(emit_branch(c, ip->labelidx));
+                break;
+
+            case OP_BR_TABLE:
+                emit(code, OP_BR_TABLE);
+                emit(code, ip->labels.len);
+                VECTOR_FOR_EACH(i, &ip->labels) {
+                    __throwiferr(emit_branch(c, *i));
+                }
+                __throwiferr(emit_branch(c, ip->default_label));
+                break;
+
+            case OP_CALL:
+                emit(code, OP_CALL);
+                emit(code, ip->funcidx);
+                break;
+
+            case OP_CALL_INDIRECT:
+                emit(code, OP_CALL_INDIRECT);
+                emit(code, ip->y);
+                emit(code, ip->x);
+                break;
+
+            case OP_LOCAL_GET:
+            case OP_LOCAL_SET:
+            case OP_LOCAL_TEE:
+                emit(code, ip->op1);
+                emit(code, ip->localidx);
+                break;
+
+            case OP_GLOBAL_GET:
+            case OP_GLOBAL_SET:
+                emit(code, ip->op1);
+                emit(code, ip->globalidx);
+                break;
+
+            case OP_TABLE_GET:
+            case OP_TABLE_SET:
+                emit(code, ip->op1);
+                emit(code, ip->x);
+                break;
+
+            case OP_I32_LOAD ... OP_I64_STORE32:
+                if(emit_memx(c, ip->m.memidx, false)) {
+                    emit(code, ip->op1);
+                    emit_u64(code, ip->m.offset);
+                    break;
+                }
+                emit(code, ip->op1);
+                emit(code, ip->m.offset);
+                break;
+
+            case OP_MEMORY_SIZE:
+            case OP_MEMORY_GROW:
+                emit_memx(c, ip->x, false);
+                emit(code, ip->op1);
+                break;
+
+            case OP_I32_CONST:
+            case OP_F32_CONST:
+                emit(code, ip->op1);
+                emit(code, ip->c.i32);
+                break;
+
+            case OP_I64_CONST:
+            case OP_F64_CONST:
+                emit(code, ip->op1);
+                emit_u64(code, ip->c.i64);
+                break;
+
+            case OP_REF_FUNC:
+                emit(code, OP_REF_FUNC);
+                emit(code, ip->x);
+                break;
+
+            case OP_0XFC: {
+                bool memx = false;
+                switch(OP_FC(ip->op2)) {
+                    case OP_MEMORY_INIT:
+                        memx = emit_memx(c, ip->y, false);
+                        break;
+                    case OP_MEMORY_FILL:
+                        memx = emit_memx(c, ip->x, false);
+                        break;
+                    // plain only if both memories are
+                    case OP_MEMORY_COPY:
+                        memx = emit_memx(c, ip->x, !plain_mem(c, ip->y));
+                        break;
+                }
+                emit(code, OP_FC(ip->op2));
+                switch(OP_FC(ip->op2)) {
+                    case OP_MEMORY_COPY:
+                        if(memx)
+                            emit(code, ip->y);
+                        break;
+
+                    case OP_MEMORY_INIT:
+                    case OP_DATA_DROP:
+                    case OP_ELEM_DROP:
+                    case OP_TABLE_GROW:
+                    case OP_TABLE_SIZE:
+                    case OP_TABLE_FILL:
+                        emit(code, ip->x);
+                        break;
+
+                    case OP_TABLE_INIT:
+                    case OP_TABLE_COPY:
+                        emit(code, ip->x);
+                        emit(code, ip->y);
+                        break;
+                }
+                break;
+            }
+
+            // instructions without immediates
+            default:
+                emit(code, ip->op1);
+                break;
+        }
+    }
+    __catch:
+        return err;
+}
+
+// Fuse the sequence starting at ip into a superinstruction if it is one of the
+// common ones. *last is set to its last instruction, or NULL if none matches.
+// A sequence never spans a block boundary, so no branch can target its middle.
+static error_t fuse_instrs(compiler_t *c, instr_t *ip, instr_t **last) {
+    __try {
+        code_t *code = c->code;
+        instr_t *i1 = ip->next;
+        instr_t *i2 = i1 ? i1->next : NULL;
+
+        *last = NULL;
+        if(!i1)
+            __throw(ERR_SUCCESS);
+
+        switch(ip->op1) {
+            case OP_LOCAL_GET:
+                // local.get local.get i32.add
+                if(i1->op1 == OP_LOCAL_GET && i2 && i2->op1 == OP_I32_ADD) {
+                    emit(code, OP_S_LOCAL_LOCAL_I32_ADD);
+                    emit(code, ip->localidx);
+                    emit(code, i1->localidx);
+                    *last = i2;
+                }
+                // local.get i32.const i32.add
+                else if(i1->op1 == OP_I32_CONST && i2 && i2->op1 == OP_I32_ADD) {
+                    emit(code, OP_S_LOCAL_CONST_I32_ADD);
+                    emit(code, ip->localidx);
+                    emit(code, i1->c.i32);
+                    *last = i2;
+                }
+                // local.get i32.load
+                else if(i1->op1 == OP_I32_LOAD && plain_mem(c, i1->m.memidx)) {
+                    emit(code, OP_S_LOCAL_I32_LOAD);
+                    emit(code, ip->localidx);
+                    emit(code, i1->m.offset);
+                    *last = i1;
+                }
+                break;
+
+            // i32.eqz br_if, i32.lt_s br_if
+            case OP_I32_EQZ:
+            case OP_I32_LT_S:
+                if(i1->op1 == OP_BR_IF) {
+                    emit(code, ip->op1 == OP_I32_EQZ ? OP_S_I32_EQZ_BR_IF : OP_S_I32_LT_S_BR_IF);
+                    __throwiferr(emit_branch(c, i1->labelidx));
+                    *last = i1;
+                }
+                break;
+        }
+    }
+    __catch:
+        return err;
+}
+
+static error_t compile_instrs(compiler_t *c, instr_t *ip) {
+    __try {
+        for(; ip; ip = ip->next) {
+            instr_t *last;
+            __throwiferr(fuse_instrs(c, ip, &last));
+            if(last) {
+                ip = last;
+                continue;
+            }
+            __throwiferr(compile_instr(c, ip));
+        }
+    }
+    __catch:
+        return err;
+}
+
+// lower a validated function body into flat code
+error_t compile_func(module_t *mod, func_t *func) {
+    __try {
+        __throwiferr(VECTOR_NEW(&func->code, 0, 64));
+        // register code and native code are compiled on demand
+        VECTOR_INIT(&func->regcode);
+        func->jitcode = NULL;
+        func->no_jit = false;
+
+        memtype_t *mt = mem_type(mod, 0);
+        compiler_t c = {.mod = mod, .func = func, .code = &func->code, .branch = 0, .mem64 = mt && mt->is64};
+        LIST_INIT(&c.labels);
+
+        // label of the function body
+        ctrl_t l;
+        push_ctrl(&c, &l);
+
+        for(instr_t *ip = func->body; ip; ip = ip->next) {
+            // the end of the body returns from the function
+            if(!ip->next) {
+                resolve_ctrl(&c, &l);
+                emit(&func->code, OP_RETURN);
+                break;
+            }
+
+            instr_t *last;
+            __throwiferr(fuse_instrs(&c, ip, &last));
+            if(last) {
+                ip = last;
+                continue;
+            }
+            __throwiferr(compile_instr(&c, ip));
+        }
+        __throwiferr(VECTOR_MOVE_IN(&mod->arena, &func->code));
+    }
+    __catch:
+        return err;
+}
+
+// register code
+// The operand stack is tracked at compile time: each operand lives in a frame
+// slot, which is its own slot (num_locals + height) once stored, or the slot
+// of a local read by local.get until then. Numeric instructions read their
+// operands from wherever they live and write their own slot, so local.get
+// emits no code and "local.get local.get i32.add local.set" is one instruction.
+// ref: https://github.com/wasm3/wasm3/blob/main/docs/Interpreter.md
+// ref: https://github.com/bytecodealliance/wasmtime/tree/main/pulley
+
+#define CASE(op, ...)   case op:
+
+void expand_blocktype(module_t *mod, blocktype_t bt, uint32_t *nparams, uint32_t *arity) {
+    switch(bt.valtype) {
+        case 0x40:
+            *nparams = 0;
+            *arity = 0;
+            break;
+
+        case TYPE_NUM_I32:
+        case TYPE_NUM_I64:
+        case TYPE_NUM_F32:
+        case TYPE_NUM_F64:
+        case TYPE_EXTENREF:
+        case TYPE_FUNCREF:
+            *nparams = 0;
+            *arity = 1;
+            break;
+
+        default: {
+            // treat as typeidx
+            functype_t *type = VECTOR_ELEM(&mod->types, bt.typeidx);
+            *nparams = type->rt1.len;
+            *arity = type->rt2.len;
+            break;
+        }
+    }
+}
+
+functype_t *func_type(module_t *mod, funcidx_t funcidx) {
+    if(funcidx >= mod->num_func_imports) {
+        func_t *func = VECTOR_ELEM(&mod->funcs, funcidx - mod->num_func_imports);
+        return VECTOR_ELEM(&mod->types, func->type);
+    }
+
+    VECTOR_FOR_EACH(import, &mod->imports) {
+        if(import->d.kind == FUNC_IMPORTDESC && funcidx-- == 0)
+            return VECTOR_ELEM(&mod->types, import->d.func);
+    }
+    return NULL;
+}
+
+memtype_t *mem_type(module_t *mod, memidx_t memidx) {
+    VECTOR_FOR_EACH(import, &mod->imports) {
+        if(import->d.kind == MEM_IMPORTDESC && memidx-- == 0)
+            return &import->d.mem;
+    }
+
+    mem_t *mem = VECTOR_ELEM(&mod->mems, memidx);
+    return mem ? &mem->type : NULL;
+}
+
+// number of operands popped and pushed by an instruction without a register form
+static void stack_effect(module_t *mod, instr_t *ip, uint32_t *pops, uint32_t *pushes) {
+    functype_t *ft;
+    *pops = 0;
+    *pushes = 0;
+
+    switch(ip->op1) {
+        case OP_CALL:
+            ft = func_type(mod, ip->funcidx);
+            *pops = ft->rt1.len;
+            *pushes = ft->rt2.len;
+            break;
+
+        case OP_CALL_INDIRECT:
+            ft = VECTOR_ELEM(&mod->types, ip->y);
+            *pops = ft->rt1.len + 1;
+            *pushes = ft->rt2.len;
+            break;
+
+        case OP_DROP:
+        case OP_GLOBAL_SET:
+            *pops = 1;
+            break;
+
+        case OP_SELECT:
+        case OP_SELECT_T:
+            *pops = 3;
+            *pushes = 1;
+            break;
+
+        case OP_GLOBAL_GET:
+        case OP_MEMORY_SIZE:
+        case OP_REF_NULL:
+        case OP_REF_FUNC:
+            *pushes = 1;
+            break;
+
+        case OP_TABLE_GET:
+        case OP_I32_LOAD ... OP_I64_LOAD32_U:
+        case OP_MEMORY_GROW:
+        case OP_REF_IS_NULL:
+            *pops = 1;
+            *pushes = 1;
+            break;
+
+        case OP_TABLE_SET:
+        case OP_I32_STORE ... OP_I64_STORE32:
+            *pops = 2;
+            break;
+
+        case OP_0XFC:
+            switch(OP_FC(ip->op2)) {
+                case OP_MEMORY_INIT:
+                case OP_MEMORY_COPY:
+                case OP_MEMORY_FILL:
+                case OP_TABLE_INIT:
+                case OP_TABLE_COPY:
+                case OP_TABLE_FILL:
+                    *pops = 3;
+                    break;
+
+                case OP_TABLE_GROW:
+                    *pops = 2;
+                    *pushes = 1;
+                    break;
+
+                case OP_TABLE_SIZE:
+                    *pushes = 1;
+                    break;
+            }
+            break;
+    }
+}
+
+static inline uint32_t own_slot(compiler_t *c, uint32_t height) {
+    return c->num_locals + height;
+}
+
+static void push_operand(compiler_t *c, uint32_t slot) {
+    if(c->height < c->slots.len)
+        c->slots.elem[c->height] = slot;
+    else
+        VECTOR_APPEND(&c->slots, slot);
+    c->height++;
+
+    if(own_slot(c, c->height) > c->func->max_slots)
+        c->func->max_slots = own_slot(c, c->height);
+}
+
+static inline uint32_t pop_operand(compiler_t *c) {
+    return c->slots.elem[--c->height];
+}
+
+// store the operand at height h to its own slot
+static void store_operand(compiler_t *c, uint32_t h) {
+    uint32_t slot = own_slot(c, h);
+
+    if(c->slots.elem[h] != slot) {
+        emit(c->code, OP_R_COPY);
+        emit(c->code, slot);
+        emit(c->code, c->slots.elem[h]);
+        c->slots.elem[h] = slot;
+        c->dst_cell = 0;
+    }
+}
+
+static void store_operands(compiler_t *c) {
+    for(uint32_t h = 0; h < c->height; h++) {
+        store_operand(c, h);
+    }
+}
+
+// store the operands and set the stack index before a stack instruction
+static void sync_stack(compiler_t *c) {
+    store_operands(c);
+
+    if(!c->synced) {
+        emit(c->code, OP_R_SP);
+        emit(c->code, own_slot(c, c->height));
+        c->synced = true;
+        c->dst_cell = 0;
+    }
+}
+
+// local.set and local.tee
+static void set_local(compiler_t *c, localidx_t x) {
+    uint32_t src = pop_operand(c);
+    size_t dst_cell = c->dst_cell;
+
+    // operands still reading the old value of x are stored first
+    for(uint32_t h = 0; h < c->height; h++) {
+        if(c->slots.elem[h] == x)
+            store_operand(c, h);
+    }
+
+    if(dst_cell && c->dst_cell == dst_cell && src == own_slot(c, c->height)) {
+        // the operand was just computed: compute it into x instead
+        c->code->elem[dst_cell] = x;
+    }
+    else if(src != x) {
+        emit(c->code, OP_R_COPY);
+        emit(c->code, x);
+        emit(c->code, src);
+    }
+    c->dst_cell = 0;
+}
+
+// skip the side table entries of an unreachable instruction
+static void skip_branches(compiler_t *c, instr_t *ip) {
+    switch(ip->op1) {
+        case OP_BLOCK:
+        case OP_LOOP:
+        case OP_IF:
+            for(instr_t *i = ip->in1; i; i = i->next) {
+                skip_branches(c, i);
+            }
+            for(instr_t *i = ip->in2; i; i = i->next) {
+                skip_branches(c, i);
+            }
+            break;
+
+        case OP_BR:
+        case OP_BR_IF:
+            c->branch++;
+            break;
+
+        case OP_BR_TABLE:
+            c->branch += ip->labels.len + 1;
+            break;
+    }
+}
+
+static error_t compile_instrs_reg(compiler_t *c, instr_t *ip);
+
+static error_t compile_block_reg(compiler_t *c, instr_t *ip) {
+    __try {
+        code_t *code = c->code;
+        uint32_t nparams, arity;
+        expand_blocktype(c->mod, ip->bt, &nparams, &arity);
+
+        // the operands are in their own slots where control flow joins
+        if(ip->op1 == OP_IF) {
+            uint32_t cond = pop_operand(c);
+            store_operands(c);
+            emit(code, OP_R_IF);
+            emit(code, cond);
+        }
+        else {
+            store_operands(c);
+        }
+
+        uint32_t height = c->height - nparams;
+        size_t else_cell = code->len;
+        if(ip->op1 == OP_IF)
+            emit(code, 0);
+
+        ctrl_t l;
+        push_ctrl(c, &l);
+        if(ip->op1 == OP_LOOP) {
+            resolve_ctrl(c, &l);
+            c->synced = false;
+        }
+        c->dst_cell = 0;
+
+        __throwiferr(compile_instrs_reg(c, ip->in1));
+
+        if(ip->op1 == OP_IF && ip->in2) {
+            // in1 is terminated by "else end", the else arm starts with the params again
+            size_t end_cell = code->len - 1;
+            code->elem[else_cell] = code->len - else_cell;
+
+            c->height = height;
+            for(uint32_t i = 0; i < nparams; i++) {
+                push_operand(c, own_slot(c, c->height));
+            }
+            c->synced = false;
+            c->unreachable = false;
+            __throwiferr(compile_instrs_reg(c, ip->in2));
+            code->elem[end_cell] = code->len - end_cell;
+        }
+        else if(ip->op1 == OP_IF) {
+            code->elem[else_cell] = code->len - else_cell;
+        }
+
+        // the end of a block or an if may be reached by a branch or the false
+        // condition, while a loop falls through only from its body
+        if(ip->op1 != OP_LOOP) {
+            resolve_ctrl(c, &l);
+            c->synced = false;
+            c->unreachable = false;
+        }
+        list_pop_tail(&c->labels);
+
+        c->height = height;
+        for(uint32_t i = 0; i < arity; i++) {
+            push_operand(c, own_slot(c, c->height));
+        }
+        c->dst_cell = 0;
+    }
+    __catch:
+        return err;
+}
+
+static error_t compile_instr_reg(compiler_t *c, instr_t *ip) {
+    __try {
+        code_t *code = c->code;
+        uint32_t op = ip->op1 == OP_0XFC ? OP_FC(ip->op2) : ip->op1;
+        uint32_t lhs, rhs, pops, pushes;
+
+        switch(op) {
+            case OP_BLOCK:
+            case OP_LOOP:
+            case OP_IF:
+                __throwiferr(compile_block_reg(c, ip));
+                break;
+
+            case OP_ELSE:
+                // end of the then arm
+                if(!c->unreachable)
+                    store_operands(c);
+                emit(code, OP_ELSE);
+                emit(code, 0);
+                break;
+
+            case OP_END:
+                store_operands(c);
+                break;
+
+            case OP_UNREACHABLE:
+                emit(code, OP_UNREACHABLE);
+                c->unreachable = true;
+                break;
+
+            case OP_NOP:
+                break;
+
+            case OP_BR_IF: {
+                branch_t *b = VECTOR_ELEM(&c->func->sidetable, c->branch);
+                __throwif(ERR_FAILED, !b);
+
+                if(b->arity == 0) {
+                    // no values to move, so the stack index is not needed
+                    uint32_t cond = pop_operand(c);
+                    store_operands(c);
+                    emit(code, OP_R_BR_IF);
+                    emit(code, cond);
+                    __throwiferr(emit_branch(c, ip->labelidx));
+                    c->synced = false;
+                }
+                else {
+                    sync_stack(c);
+                    __throwiferr(compile_instr(c, ip));
+                    pop_operand(c);
+                }
+                c->dst_cell = 0;
+                break;
+            }
+
+            // the values are moved on the operand stack
+            case OP_BR:
+            case OP_BR_TABLE:
+            case OP_RETURN:
+                sync_stack(c);
+                __throwiferr(compile_instr(c, ip));
+                c->unreachable = true;
+                break;
+
+            case OP_DROP:
+                pop_operand(c);
+                c->synced = false;
+                c->dst_cell = 0;
+                break;
+
+            case OP_LOCAL_GET:
+                push_operand(c, ip->localidx);
+                c->synced = false;
+                c->dst_cell = 0;
+                break;
+
+            case OP_LOCAL_SET:
+                set_local(c, ip->localidx);
+                c->synced = false;
+                break;
+
+            case OP_LOCAL_TEE:
+                set_local(c, ip->localidx);
+                push_operand(c, ip->localidx);
+                c->synced = false;
+                break;
+
+            case OP_I32_CONST:
+            case OP_F32_CONST:
+                emit(code, OP_R_CONST32);
+                c->dst_cell = code->len;
+                emit(code, own_slot(c, c->height));
+                emit(code, ip->c.i32);
+                push_operand(c, own_slot(c, c->height));
+                c->synced = false;
+                break;
+
+            case OP_I64_CONST:
+            case OP_F64_CONST:
+                emit(code, OP_R_CONST64);
+                c->dst_cell = code->len;
+                emit(code, own_slot(c, c->height));
+                emit_u64(code, ip->c.i64);
+                push_operand(c, own_slot(c, c->height));
+                c->synced = false;
+                break;
+
+            FOREACH_UNOP(CASE)
+                lhs = pop_operand(c);
+                emit(code, OP_R(op));
+                c->dst_cell = code->len;
+                emit(code, own_slot(c, c->height));
+                emit(code, lhs);
+                push_operand(c, own_slot(c, c->height));
+                c->synced = false;
+                break;
+
+            FOREACH_BINOP(CASE)
+                rhs = pop_operand(c);
+                lhs = pop_operand(c);
+                emit(code, OP_R(op));
+                c->dst_cell = code->len;
+                emit(code, own_slot(c, c->height));
+                emit(code, lhs);
+                emit(code, rhs);
+                push_operand(c, own_slot(c, c->height));
+                c->synced = false;
+                break;
+
+            // instructions without a register form use the operand stack
+            default:
+                sync_stack(c);
+                __throwiferr(compile_instr(c, ip));
+                stack_effect(c->mod, ip, &pops, &pushes);
+                c->height -= pops;
+                for(uint32_t i = 0; i < pushes; i++) {
+                    push_operand(c, own_slot(c, c->height));
+                }
+                c->dst_cell = 0;
+                break;
+        }
+    }
+    __catch:
+        return err;
+}
+
+static error_t compile_instrs_reg(compiler_t *c, instr_t *ip) {
+    __try {
+        for(; ip; ip = ip->next) {
+            // skip unreachable code, but keep the end of a then arm
+            if(c->unreachable && ip->op1 != OP_ELSE) {
+                skip_branches(c, ip);
+                continue;
+            }
+            __throwiferr(compile_instr_reg(c, ip));
+        }
+    }
+    __catch:
+        return err;
+}
+
+// lower a validated function body into register code
+error_t compile_func_reg(module_t *mod, func_t *func) {
+    __try {
+        functype_t *type = VECTOR_ELEM(&mod->types, func->type);
+        __throwif(ERR_FAILED, !type);
+
+        memtype_t *mt = mem_type(mod, 0);
+        compiler_t c = {
+            .mod        = mod,
+            .func       = func,
+            .code       = &func->regcode,
+            .branch     = 0,
+            .mem64      = mt && mt->is64,
+            .num_locals = type->rt1.len + func->locals.len,
+            .height     = 0,
+            .synced     = false,
+            .unreachable = false,
+            .dst_cell   = 0
+        };
+        LIST_INIT(&c.labels);
+        __throwiferr(VECTOR_NEW(&c.slots, 0, 16));
+        __throwiferr(VECTOR_NEW(c.code, 0, 64));
+        func->max_slots = c.num_locals;
+
+        // label of the function body
+        ctrl_t l;
+        push_ctrl(&c, &l);
+
+        for(instr_t *ip = func->body; ip; ip = ip->next) {
+            // the end of the body returns the results on top of the operand stack
+            if(!ip->next) {
+                if(!c.unreachable)
+                    sync_stack(&c);
+                resolve_ctrl(&c, &l);
+                emit(c.code, OP_RETURN);
+                break;
+            }
+
+            if(c.unreachable) {
+                skip_branches(&c, ip);
+                continue;
+            }
+            __throwiferr(compile_instr_reg(&c, ip));
+        }
+        free(c.slots.elem);
+        __throwiferr(VECTOR_MOVE_IN(&mod->arena, c.code));
+    }
+    __catch:
+        return err;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+// compile.h defines the flat code executed by the interpreter.
+// A validated func_t.body (a tree of instr_t) is lowered into func_t.code,
+// a contiguous array of 32bit cells. Each instruction is an opcode cell
+// followed by its immediates. Branch targets are signed offsets relative to
+// the cell holding them.
+//
+// Blocks, loops and ends emit no code. Each branch instead carries its target
+// and the values to keep, taken from the side table built by the validator:
+//
+//  if              op else                    (else: start of the else arm, or past the end)
+//  else            op end                     (end: past the end of the if)
+//  br, br_if       op target height arity     (keep arity values at height, then jump)
+//  br_table        op n (target height arity)*n (target height arity)(default)
+//  call            op funcidx
+//  call_indirect   op typeidx tableidx
+//  local.*         op localidx
+//  global.*        op globalidx
+//  table.*         op tableidx
+//  load, store     op offset
+//  i32.const       op value
+//  i64.const       op low high
+//  f32.const       op bits
+//  f64.const       op low high
+//  ref.func        op funcidx
+//  other memories  OP_MEMX memidx op [offset_low offset_high | dataidx | memidx(src)]
+//
+// Memory instructions on memory 0 are emitted as above if it has 32-bit
+// addresses. Others are prefixed with OP_MEMX and the memidx, carry a 64-bit
+// offset and bounds check 64-bit addresses, keeping the common accesses free
+// of the extra work.
+//
+// Heights count operands above the frame. The final end of a function body is
+// emitted as return, which is also the target of branches to the function label.
+//
+// Common sequences of stack code are fused into superinstructions (OP_S_*),
+// which only exist in flat code.
+//
+// Register code (func_t.regcode) names frame slots instead of using the
+// operand stack: slot i is local i below the number of locals, and the operand
+// at height h after them. Instructions without a register form are emitted as
+// above, after pending operands are stored to their slots and the stack index
+// is set with OP_R_SP.
+
+#include "module.h"
+#include "error.h"
+
+// 0xFC prefixed instructions are flattened into opcodes above 0xFF
+#define OP_FC(n)    (0x100 + (n))
+
+enum {
+    OP_I32_TRUNC_SAT_F32_S  = OP_FC(0x00),
+    OP_I32_TRUNC_SAT_F32_U  = OP_FC(0x01),
+    OP_I32_TRUNC_SAT_F64_S  = OP_FC(0x02),
+    OP_I32_TRUNC_SAT_F64_U  = OP_FC(0x03),
+    OP_I64_TRUNC_SAT_F32_S  = OP_FC(0x04),
+    OP_I64_TRUNC_SAT_F32_U  = OP_FC(0x05),
+    OP_I64_TRUNC_SAT_F64_S  = OP_FC(0x06),
+    OP_I64_TRUNC_SAT_F64_U  = OP_FC(0x07),
+    OP_MEMORY_INIT          = OP_FC(0x08),  // op dataidx
+    OP_DATA_DROP            = OP_FC(0x09),  // op dataidx
+    OP_MEMORY_COPY          = OP_FC(0x0A),
+    OP_MEMORY_FILL          = OP_FC(0x0B),
+    OP_TABLE_INIT           = OP_FC(0x0C),  // op tableidx elemidx
+    OP_ELEM_DROP            = OP_FC(0x0D),  // op elemidx
+    OP_TABLE_COPY           = OP_FC(0x0E),  // op tableidx(dst) tableidx(src)
+    OP_TABLE_GROW           = OP_FC(0x0F),  // op tableidx
+    OP_TABLE_SIZE           = OP_FC(0x10),  // op tableidx
+    OP_TABLE_FILL           = OP_FC(0x11),  // op tableidx
+
+    // memory instructions on other memories than a 32-bit memory 0
+    OP_MEMX,                                // op memidx memop [immediates]
+
+    // register code only (see compile_func_reg)
+    OP_R_COPY,                              // op dst src
+    OP_R_CONST32,                           // op dst value
+    OP_R_CONST64,                           // op dst low high
+    OP_R_SP,                                // op slots
+    OP_R_IF,                                // op cond else
+    OP_R_BR_IF,                             // op cond target height arity
+
+    // superinstructions fused from common sequences by compile_func
+    OP_S_LOCAL_LOCAL_I32_ADD,               // op localidx localidx
+    OP_S_LOCAL_CONST_I32_ADD,               // op localidx value
+    OP_S_I32_EQZ_BR_IF,                     // op target height arity
+    OP_S_I32_LT_S_BR_IF,                    // op target height arity
+    OP_S_LOCAL_I32_LOAD,                    // op localidx offset
+    // register forms of the numeric instructions, see OP_R
+    OP_R_BASE,
+    NUM_OPS = OP_R_BASE + OP_I64_TRUNC_SAT_F64_U + 1
+};
+
+// register form of a numeric instruction: op dst lhs [rhs]
+#define OP_R(op)    (OP_R_BASE + (op))
+
+#define OP_S_FIRST          OP_S_LOCAL_LOCAL_I32_ADD
+#define NUM_SUPERINSTRS     (OP_S_LOCAL_I32_LOAD - OP_S_FIRST + 1)
+
+void expand_blocktype(module_t *mod, blocktype_t bt, uint32_t *nparams, uint32_t *arity);
+functype_t *func_type(module_t *mod, funcidx_t funcidx);
+memtype_t *mem_type(module_t *mod, memidx_t memidx);
+error_t compile_func(module_t *mod, func_t *func);
+error_t compile_func_reg(module_t *mod, func_t *func);
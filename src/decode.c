@@ -2,30 +2,25 @@
 #include "memory.h"
 #include "print.h"
 #include "exception.h"
+#include "pool.h"
+#include <sys/mman.h>
+#include <unistd.h>
 
 static inline bool eof(buffer_t *buf) {
     return buf->p == buf->end;
 }
 
-error_t new_buffer(buffer_t **d, uint8_t *head, size_t size) {
-    __try {
-        buffer_t *buf = malloc(sizeof(buffer_t));
-        __throwif(ERR_FAILED, !buf);
-
-        *buf = (buffer_t) {
-            .p   = head,
-            .end = head + size
-        };
-        *d = buf;
-    }
-    __catch:
-        return err;
+void new_buffer(buffer_t *d, uint8_t *head, size_t size) {
+    *d = (buffer_t) {
+        .p   = head,
+        .end = head + size
+    };
 }
 
-error_t read_buffer(buffer_t **d, size_t size, buffer_t *buf) {
+error_t read_buffer(buffer_t *d, size_t size, buffer_t *buf) {
     __try {
         __throwif(ERR_LENGTH_OUT_OF_BOUNDS, buf->p + size > buf->end);
-        __throwiferr(new_buffer(d, buf->p, size));
+        new_buffer(d, buf->p, size);
         buf->p += size;
     }
     __catch:
@@ -41,18 +36,18 @@ error_t read_byte(uint8_t *d, buffer_t *buf) {
         return err;
 }
 
-// read vec(byte)
-error_t read_bytes(uint8_t **d, buffer_t *buf) {
+// read vec(byte) into arena, terminated by a NUL
+error_t read_bytes(uint8_t **d, arena_t *arena, buffer_t *buf) {
     __try {
         uint32_t n;
         __throwiferr(read_u32_leb128(&n, buf));
+        __throwif(ERR_UNEXPECTED_END, n > buf->end - buf->p);
         
-        uint8_t *str = malloc(sizeof(uint8_t) * (n + 1));
+        uint8_t *str = arena_alloc(arena, sizeof(uint8_t) * (n + 1));
         __throwif(ERR_FAILED, !str);
 
-        for(uint32_t i = 0; i < n; i++) {
-            __throwiferr(read_byte(&str[i], buf));
-        }
+        memcpy(str, buf->p, n);
+        buf->p += n;
         str[n] = '\0';
         *d = str;
     }
@@ -164,6 +159,10 @@ error_t read_u32_leb128(uint32_t *d, buffer_t *buf) {
         return err;
 }
 
+error_t read_u64_leb128(uint64_t *d, buffer_t *buf) {
+    return read_leb128_unsigned(d, 64, buf);
+}
+
 error_t read_i32_leb128(int32_t *d, buffer_t *buf) {
     __try {
         int64_t val;
@@ -198,6 +197,7 @@ error_t read_f64(double *d, buffer_t *buf) {
 // todo: support s33
 error_t read_bt(blocktype_t *bt, buffer_t *buf) {
     __try {
+        __throwif(ERR_UNEXPECTED_END, eof(buf));
         switch(buf->p[0]) {
             case 0x40:
             case TYPE_NUM_I32:
@@ -219,9 +219,9 @@ error_t read_bt(blocktype_t *bt, buffer_t *buf) {
 }
 
 // useful macros
-typedef error_t (*decoder_t) (module_t *mod, buffer_t *buf);
+typedef error_t (*section_decoder_t) (module_t *mod, buffer_t *buf);
 
-static decoder_t decoders[13] = {
+static section_decoder_t decoders[13] = {
     [0]     = decode_customsec,
     [1]     = decode_typesec,
     [2]     = decode_importsec,
@@ -242,7 +242,7 @@ error_t decode_customsec(module_t *mod, buffer_t *buf) {
     __try {
         // check that name exists
         uint8_t *n;
-        __throwiferr(read_bytes(&n, buf));
+        __throwiferr(read_bytes(&n, &mod->arena, buf));
         // ignore contents for now
     }
     __catch:
@@ -254,7 +254,7 @@ error_t decode_typesec(module_t *mod, buffer_t *buf) {
         uint32_t n1;
         __throwiferr(read_u32_leb128(&n1, buf));
 
-        VECTOR_NEW(&mod->types, n1, n1);
+        VECTOR_NEW_IN(&mod->arena, &mod->types, n1, n1);
 
         VECTOR_FOR_EACH(functype, &mod->types) {
             // expected to be 0x60
@@ -265,14 +265,14 @@ error_t decode_typesec(module_t *mod, buffer_t *buf) {
             // decode parameter types
             uint32_t n2;
             __throwiferr(read_u32_leb128(&n2, buf));
-            VECTOR_NEW(&functype->rt1, n2, n2);
+            VECTOR_NEW_IN(&mod->arena, &functype->rt1, n2, n2);
             VECTOR_FOR_EACH(valtype, &functype->rt1) {
                 __throwiferr(read_byte(valtype, buf));
             }
 
             // decode return types
             __throwiferr(read_u32_leb128(&n2, buf));
-            VECTOR_NEW(&functype->rt2, n2, n2);
+            VECTOR_NEW_IN(&mod->arena, &functype->rt2, n2, n2);
             VECTOR_FOR_EACH(valtype, &functype->rt2) {
                 __throwiferr(read_byte(valtype, buf));
             }
@@ -284,16 +284,28 @@ error_t decode_typesec(module_t *mod, buffer_t *buf) {
         return err;
 }
 
-static error_t decode_limits(limits_t *limits, buffer_t *buf) {
+// flags 0x04 and 0x05 mark the 64-bit limits of memory64, which only memories have
+// ref: https://github.com/WebAssembly/memory64/blob/main/proposals/memory64/Overview.md#binary-format
+static error_t decode_limits(limits_t *limits, bool allow64, buffer_t *buf) {
     __try {
-        __throwiferr(read_u7_leb128(&limits->has_max, buf));
-        __throwif(ERR_INTEGER_TOO_LARGE, limits->has_max != 0 && limits->has_max != 1);
-        __throwiferr(read_u32_leb128(&limits->min, buf));
-        if(limits->has_max) {
-            __throwiferr(read_u32_leb128(&limits->max, buf));
+        uint8_t flags;
+        __throwiferr(read_u7_leb128(&flags, buf));
+        limits->is64 = allow64 && (flags & 0x04);
+        limits->has_max = flags & ~0x04;
+        __throwif(ERR_INTEGER_TOO_LARGE, (flags & ~0x04) > 1 || (!allow64 && (flags & 0x04)));
+        if(limits->is64) {
+            __throwiferr(read_u64_leb128(&limits->min, buf));
+            if(limits->has_max)
+                __throwiferr(read_u64_leb128(&limits->max, buf));
         }
         else {
-            limits->has_max = false;
+            uint32_t n;
+            __throwiferr(read_u32_leb128(&n, buf));
+            limits->min = n;
+            if(limits->has_max) {
+                __throwiferr(read_u32_leb128(&n, buf));
+                limits->max = n;
+            }
         }
     }
     __catch:
@@ -303,7 +315,7 @@ static error_t decode_limits(limits_t *limits, buffer_t *buf) {
 static error_t decode_tabletype(tabletype_t *tt, buffer_t *buf) {
     __try {
         __throwiferr(read_u7_leb128(&tt->reftype, buf));
-        __throwiferr(decode_limits(&tt->limits, buf));
+        __throwiferr(decode_limits(&tt->limits, false, buf));
     }
     __catch:
         return err;
@@ -324,12 +336,12 @@ error_t decode_importsec(module_t *mod, buffer_t*buf) {
         uint32_t n;
         __throwiferr(read_u32_leb128(&n, buf));
         
-        VECTOR_NEW(&mod->imports, n, n);
+        VECTOR_NEW_IN(&mod->arena, &mod->imports, n, n);
 
         VECTOR_FOR_EACH(import, &mod->imports) {
              // todo: decode utf8
-            __throwiferr(read_bytes(&import->module, buf));
-            __throwiferr(read_bytes(&import->name, buf));
+            __throwiferr(read_bytes(&import->module, &mod->arena, buf));
+            __throwiferr(read_bytes(&import->name, &mod->arena, buf));
             
             // decode importdesc
             __throwiferr(read_byte(&import->d.kind, buf));
@@ -343,7 +355,7 @@ error_t decode_importsec(module_t *mod, buffer_t*buf) {
                     mod->num_table_imports++;
                     break;
                 case MEM_IMPORTDESC:
-                    __throwiferr(decode_limits(&import->d.mem, buf));
+                    __throwiferr(decode_limits(&import->d.mem, true, buf));
                     mod->num_mem_imports++;
                     break;
                 case GLOBAL_IMPORTDESC:
@@ -366,10 +378,12 @@ error_t decode_funcsec(module_t *mod, buffer_t *buf) {
         uint32_t n;
         __throwiferr(read_u32_leb128(&n, buf));
 
-        VECTOR_NEW(&mod->funcs, n, n);
+        VECTOR_NEW_IN(&mod->arena, &mod->funcs, n, n);
 
         VECTOR_FOR_EACH(func, &mod->funcs) {
             __throwiferr(read_u32_leb128(&func->type, buf));
+            // filled in by the code section, validate_module and the tiers
+            *func = (func_t){.type = func->type};
         }
 
         __throwif(ERR_SECTION_SIZE_MISMATCH, !eof(buf));
@@ -383,7 +397,7 @@ error_t decode_tablesec(module_t *mod, buffer_t *buf) {
         uint32_t n;
         __throwiferr(read_u32_leb128(&n, buf));
 
-        VECTOR_NEW(&mod->tables, n, n);
+        VECTOR_NEW_IN(&mod->arena, &mod->tables, n, n);
         
         VECTOR_FOR_EACH(table, &mod->tables) {
             __throwiferr(decode_tabletype(&table->type, buf));
@@ -399,10 +413,10 @@ error_t decode_memsec(module_t *mod, buffer_t *buf) {
     __try {
         uint32_t n;
         __throwiferr(read_u32_leb128(&n, buf));
-        VECTOR_NEW(&mod->mems, n, n);
+        VECTOR_NEW_IN(&mod->arena, &mod->mems, n, n);
         
         VECTOR_FOR_EACH(mem, &mod->mems) {
-            __throwiferr(decode_limits(&mem->type, buf));
+            __throwiferr(decode_limits(&mem->type, true, buf));
         }
 
         __throwif(ERR_SECTION_SIZE_MISMATCH, !eof(buf));
@@ -415,10 +429,10 @@ error_t decode_exportsec(module_t *mod, buffer_t *buf) {
     __try {
         uint32_t n;
         __throwiferr(read_u32_leb128(&n, buf));
-        VECTOR_NEW(&mod->exports, n, n);
+        VECTOR_NEW_IN(&mod->arena, &mod->exports, n, n);
 
         VECTOR_FOR_EACH(export, &mod->exports) {
-            __throwiferr(read_bytes(&export->name, buf));
+            __throwiferr(read_bytes(&export->name, &mod->arena, buf));
             __throwiferr(read_byte(&export->exportdesc.kind, buf));
             __throwiferr(read_u32_leb128(&export->exportdesc.idx, buf));
         }
@@ -439,10 +453,21 @@ error_t decode_startsec(module_t *mod, buffer_t *buf) {
         return err;
 }
 
+// imported memories come first in the memory index space
+static bool mem_is64(module_t *mod, memidx_t memidx) {
+    VECTOR_FOR_EACH(import, &mod->imports) {
+        if(import->d.kind == MEM_IMPORTDESC && memidx-- == 0)
+            return import->d.mem.is64;
+    }
+    mem_t *mem = VECTOR_ELEM(&mod->mems, memidx);
+    return mem && mem->type.is64;
+}
+
 // todo: delete this?
+
 error_t decode_instr(module_t *mod, buffer_t *buf, instr_t **instr) {
     __try {
-        instr_t *i = malloc(sizeof(instr_t));
+        instr_t *i = arena_alloc(&mod->arena, sizeof(instr_t));
         __throwif(ERR_FAILED, !i);
 
         i->next = NULL;
@@ -494,7 +519,7 @@ error_t decode_instr(module_t *mod, buffer_t *buf, instr_t **instr) {
             case OP_BR_TABLE: {
                 uint32_t n;
                 __throwiferr(read_u32_leb128(&n, buf));
-                VECTOR_NEW(&i->labels, n, n);
+                VECTOR_NEW_IN(&mod->arena, &i->labels, n, n);
                 VECTOR_FOR_EACH(l, &i->labels) {
                     __throwiferr(read_u32_leb128(l, buf));
                 }
@@ -521,7 +546,7 @@ error_t decode_instr(module_t *mod, buffer_t *buf, instr_t **instr) {
             case OP_SELECT_T: {
                 uint32_t n;
                 __throwiferr(read_u32_leb128(&n, buf));
-                VECTOR_NEW(&i->types, n, n);
+                VECTOR_NEW_IN(&mod->arena, &i->types, n, n);
                 VECTOR_FOR_EACH(t, &i->types) {
                     __throwiferr(read_byte(t, buf));
                 }
@@ -568,17 +593,29 @@ error_t decode_instr(module_t *mod, buffer_t *buf, instr_t **instr) {
             case OP_I64_STORE16:
             case OP_I64_STORE32:
                 __throwiferr(read_u32_leb128(&i->m.align, buf));
-                __throwiferr(read_u32_leb128(&i->m.offset, buf));
+                // bit 6 of the alignment flags an explicit memidx (multi-memory)
+                // ref: https://github.com/WebAssembly/multi-memory/blob/main/proposals/multi-memory/Overview.md
+                i->m.memidx = 0;
+                if(i->m.align & 0x40) {
+                    i->m.align &= ~0x40;
+                    __throwiferr(read_u32_leb128(&i->m.memidx, buf));
+                }
+                // offsets beyond 32 bits are only encodable for a 64-bit memory
+                if(mem_is64(mod, i->m.memidx)) {
+                    __throwiferr(read_u64_leb128(&i->m.offset, buf));
+                }
+                else {
+                    uint32_t offset;
+                    __throwiferr(read_u32_leb128(&offset, buf));
+                    i->m.offset = offset;
+                }
                 break;
             
+            // the reserved zero byte is a memidx with multi-memory
             case OP_MEMORY_SIZE:
-            case OP_MEMORY_GROW: {
-                uint8_t zero;
-                // memory.grow reserved byte should not be a "long" LEB128 zero
-                __throwif(ERR_ZERO_BYTE_EXPECTED, IS_ERROR(read_u7_leb128(&zero, buf)));
-                __throwif(ERR_ZERO_BYTE_EXPECTED, zero != 0);
+            case OP_MEMORY_GROW:
+                __throwiferr(read_u32_leb128(&i->x, buf));
                 break;
-            }
 
             case OP_I32_CONST:
                 __throwiferr(read_i32_leb128(&i->c.i32, buf));
@@ -761,26 +798,21 @@ error_t decode_instr(module_t *mod, buffer_t *buf, instr_t **instr) {
                         // check that datacountsec exists 
                         // ref: https://webassembly.github.io/spec/core/binary/modules.html#data-count-section
                         __throwif(ERR_DATA_COUNT_SECTION_REQUIRED,  !mod->datas.len);
-                        uint32_t zero;
                         __throwiferr(read_u32_leb128(&i->x, buf));
-                        __throwiferr(read_u32_leb128(&zero, buf));
+                        __throwiferr(read_u32_leb128(&i->y, buf));
                         break;
                     }
                     
-                    // memory.copy
-                    case 0xA: {
-                        uint32_t zero;
-                        __throwiferr(read_u32_leb128(&zero, buf));
-                        __throwiferr(read_u32_leb128(&zero, buf));
+                    // memory.copy (x: destination, y: source)
+                    case 0xA:
+                        __throwiferr(read_u32_leb128(&i->x, buf));
+                        __throwiferr(read_u32_leb128(&i->y, buf));
                         break;
-                    }
 
                     // memory.fill
-                    case 0x0B: {
-                        uint32_t zero;
-                        __throwiferr(read_u32_leb128(&zero, buf));
+                    case 0x0B:
+                        __throwiferr(read_u32_leb128(&i->x, buf));
                         break;
-                    }
 
                     // table.init
                     case 0xC:
@@ -848,7 +880,7 @@ error_t decode_globalsec(module_t *mod, buffer_t *buf) {
         uint32_t n;
         __throwiferr(read_u32_leb128(&n, buf));
 
-        VECTOR_NEW(&mod->globals, n, n);
+        VECTOR_NEW_IN(&mod->arena, &mod->globals, n, n);
         
         VECTOR_FOR_EACH(g, &mod->globals) {
             __throwiferr(decode_globaltype(&g->gt, buf));
@@ -866,7 +898,7 @@ error_t decode_elemsec(module_t *mod, buffer_t *buf) {
         uint32_t n;
         __throwiferr(read_u32_leb128(&n, buf));
 
-        VECTOR_NEW(&mod->elems, n, n);
+        VECTOR_NEW_IN(&mod->arena, &mod->elems, n, n);
 
         uint32_t kind;
         VECTOR_FOR_EACH(elem, &mod->elems) {
@@ -883,13 +915,14 @@ error_t decode_elemsec(module_t *mod, buffer_t *buf) {
                     __throwiferr(read_u32_leb128(&n, buf));
 
                     // create init exprs
-                    VECTOR_NEW(&elem->init, n, n);
+                    VECTOR_NEW_IN(&mod->arena, &elem->init, n, n);
                     static instr_t end = {.op1 = OP_END};
 
                     VECTOR_FOR_EACH(e, &elem->init) {
                         funcidx_t x;
                         __throwiferr(read_u32_leb128(&x, buf));
-                        expr_t init = malloc(sizeof(instr_t));
+                        expr_t init = arena_alloc(&mod->arena, sizeof(instr_t));
+                        __throwif(ERR_FAILED, !init);
                         *init = (instr_t) {
                             .op1        = OP_REF_FUNC,
                             .x          = x,
@@ -923,13 +956,14 @@ error_t decode_elemsec(module_t *mod, buffer_t *buf) {
                     __throwiferr(read_u32_leb128(&n, buf));
 
                     // create init exprs
-                    VECTOR_NEW(&elem->init, n, n);
+                    VECTOR_NEW_IN(&mod->arena, &elem->init, n, n);
                     static instr_t end = {.op1 = OP_END};
 
                     VECTOR_FOR_EACH(e, &elem->init) {
                         funcidx_t x;
                         __throwiferr(read_u32_leb128(&x, buf));
-                        expr_t init = malloc(sizeof(instr_t));
+                        expr_t init = arena_alloc(&mod->arena, sizeof(instr_t));
+                        __throwif(ERR_FAILED, !init);
                         *init = (instr_t) {
                             .op1        = OP_REF_FUNC,
                             .x          = x,
@@ -948,7 +982,7 @@ error_t decode_elemsec(module_t *mod, buffer_t *buf) {
                     __throwiferr(decode_expr(mod, buf, &elem->mode.offset));
                     uint32_t n;
                     __throwiferr(read_u32_leb128(&n, buf));
-                    VECTOR_NEW(&elem->init, n, n);
+                    VECTOR_NEW_IN(&mod->arena, &elem->init, n, n);
                     VECTOR_FOR_EACH(e, &elem->init) {
                         __throwiferr(decode_expr(mod, buf, e));
                     }
@@ -964,7 +998,7 @@ error_t decode_elemsec(module_t *mod, buffer_t *buf) {
                     );
                     uint32_t n;
                     __throwiferr(read_u32_leb128(&n, buf));
-                    VECTOR_NEW(&elem->init, n, n);
+                    VECTOR_NEW_IN(&mod->arena, &elem->init, n, n);
                     VECTOR_FOR_EACH(e, &elem->init) {
                         __throwiferr(decode_expr(mod, buf, e));
                     }
@@ -978,7 +1012,7 @@ error_t decode_elemsec(module_t *mod, buffer_t *buf) {
                     __throwiferr(read_byte(&elem->type, buf));
                     uint32_t n;
                     __throwiferr(read_u32_leb128(&n, buf));
-                    VECTOR_NEW(&elem->init, n, n);
+                    VECTOR_NEW_IN(&mod->arena, &elem->init, n, n);
                     VECTOR_FOR_EACH(e, &elem->init) {
                         __throwiferr(decode_expr(mod, buf, e));
                     }
@@ -990,7 +1024,7 @@ error_t decode_elemsec(module_t *mod, buffer_t *buf) {
                     __throwiferr(read_byte(&elem->type, buf));
                     uint32_t n;
                     __throwiferr(read_u32_leb128(&n, buf));
-                    VECTOR_NEW(&elem->init, n, n);
+                    VECTOR_NEW_IN(&mod->arena, &elem->init, n, n);
                     VECTOR_FOR_EACH(e, &elem->init) {
                         __throwiferr(decode_expr(mod, buf, e));
                     }
@@ -1008,6 +1042,42 @@ error_t decode_elemsec(module_t *mod, buffer_t *buf) {
         return err;
 }
 
+// decode the locals and the body of an entry of the code section
+static error_t decode_code(module_t *mod, func_t *func, buffer_t *code) {
+    __try {
+        VECTOR(locals_t) localses;
+        uint32_t n2;
+
+        // freed with the module, like everything else decoded
+        __throwiferr(read_u32_leb128(&n2, code));
+        __throwiferr(VECTOR_NEW_IN(&mod->arena, &localses, n2, n2));
+
+        // count local variables
+        uint64_t num_locals = 0;
+        VECTOR_FOR_EACH(locals, &localses) {
+            __throwiferr(read_u32_leb128(&locals->n, code));
+            __throwiferr(read_byte(&locals->type, code));
+            // No more than 2^32-1 locals
+            num_locals += locals->n;
+            __throwif(ERR_TOO_MANY_LOCALS, num_locals >= UINT32_MAX)
+        }
+
+        // create vec(valtype)
+        size_t i = 0;
+        __throwiferr(VECTOR_NEW_IN(&mod->arena, &func->locals, num_locals, num_locals));
+        VECTOR_FOR_EACH(locals, &localses) {
+            for(uint32_t j = 0; j < locals->n; j++) {
+                func->locals.elem[i++] = locals->type;
+            }
+        }
+
+        // decode body
+        __throwiferr(decode_expr(mod, code, &func->body));
+    }
+    __catch:
+        return err;
+}
+
 error_t decode_codesec(module_t *mod, buffer_t *buf) {
     __try {
         __throwiferr(read_u32_leb128(&mod->num_codes, buf));
@@ -1021,36 +1091,9 @@ error_t decode_codesec(module_t *mod, buffer_t *buf) {
             uint32_t size;
             __throwiferr(read_u32_leb128(&size, buf));
 
-            buffer_t *code;
+            buffer_t code;
             __throwiferr(read_buffer(&code, size, buf));
-
-            VECTOR(locals_t) localses;
-            uint32_t n2;
-
-            __throwiferr(read_u32_leb128(&n2, code));
-            VECTOR_NEW(&localses, n2, n2);
-
-            // count local variables
-            uint64_t num_locals = 0;
-            VECTOR_FOR_EACH(locals, &localses) {
-                __throwiferr(read_u32_leb128(&locals->n, code));
-                __throwiferr(read_byte(&locals->type, code));
-                // No more than 2^32-1 locals
-                num_locals += locals->n;
-                __throwif(ERR_TOO_MANY_LOCALS, num_locals >= UINT32_MAX)
-            }
-
-            // create vec(valtype)
-            size_t i = 0;
-            VECTOR_NEW(&func->locals, num_locals, num_locals);
-            VECTOR_FOR_EACH(locals, &localses) {
-                for(uint32_t j = 0; j < locals->n; j++) {
-                    func->locals.elem[i++] = locals->type;
-                }
-            }
-
-            // decode body
-            __throwiferr(decode_expr(mod, code, &func->body));
+            __throwiferr(decode_code(mod, func, &code));
         }
 
         __throwif(ERR_SECTION_SIZE_MISMATCH, !eof(buf));
@@ -1073,7 +1116,7 @@ error_t decode_datasec(module_t *mod, buffer_t *buf) {
         }
         // init vector
         else {
-            VECTOR_NEW(&mod->datas, n1, n1);
+            VECTOR_NEW_IN(&mod->arena, &mod->datas, n1, n1);
         }
 
         uint32_t kind;
@@ -1096,10 +1139,10 @@ error_t decode_datasec(module_t *mod, buffer_t *buf) {
             }
             uint32_t n2;
             __throwiferr(read_u32_leb128(&n2, buf));
-            VECTOR_NEW(&data->init, n2, n2);
-            VECTOR_FOR_EACH(byte, &data->init) {
-                __throwiferr(read_byte(byte, buf));
-            }
+            __throwif(ERR_UNEXPECTED_END, n2 > buf->end - buf->p);
+            VECTOR_NEW_IN(&mod->arena, &data->init, n2, n2);
+            memcpy(data->init.elem, buf->p, n2);
+            buf->p += n2;
         }
 
         __throwif(ERR_SECTION_SIZE_MISMATCH, !eof(buf));
@@ -1113,7 +1156,7 @@ error_t decode_datacountsec(module_t *mod, buffer_t *buf) {
         uint32_t num_datas;
         __throwiferr(read_u32_leb128(&num_datas, buf));
         // init data segment vector
-        VECTOR_NEW(&mod->datas, num_datas, num_datas);
+        VECTOR_NEW_IN(&mod->arena, &mod->datas, num_datas, num_datas);
 
         __throwif(ERR_SECTION_SIZE_MISMATCH, !eof(buf));
     }
@@ -1121,19 +1164,25 @@ error_t decode_datacountsec(module_t *mod, buffer_t *buf) {
         return err;
 }
 
-error_t decode_module(module_t **mod, uint8_t *image, size_t image_size) {
-    __try {    
-        buffer_t *buf;
-        __throwiferr(new_buffer(&buf, image, image_size));
-
-        uint32_t magic, version;
-        __throwiferr(read_u32(&magic, buf));
-        __throwif(ERR_MAGIC_HEADER_NOT_DETECTED, magic != 0x6d736100);
-        __throwiferr(read_u32(&version, buf));
-        __throwif(ERR_UNKNOWN_BINARY_VERSION, version != 0x00000001);
-
-        // init
-        module_t *m = *mod = malloc(sizeof(module_t));
+// FNV-1a over the bytes fed so far (see module_t.hash)
+#define MODULE_HASH_INIT    0xcbf29ce484222325
+
+static uint64_t hash_bytes(uint64_t h, const uint8_t *bytes, size_t len) {
+    for(size_t i = 0; i < len; i++)
+        h = (h ^ bytes[i]) * 0x100000001b3;
+    return h;
+}
+
+// Everything decoded is allocated from the arena of the module, which holds
+// the module itself too. Nothing points into the bytes fed afterwards.
+static error_t new_module(module_t **mod) {
+    __try {
+        arena_t arena;
+        arena_init(&arena);
+        module_t *m = arena_alloc(&arena, sizeof(module_t));
+        __throwif(ERR_FAILED, !m);
+
+        m->arena = arena;
         VECTOR_INIT(&m->types);
         VECTOR_INIT(&m->funcs);
         VECTOR_INIT(&m->tables);
@@ -1149,36 +1198,392 @@ error_t decode_module(module_t **mod, uint8_t *image, size_t image_size) {
         m->num_table_imports    = 0;
         m->num_mem_imports      = 0;
         m->num_global_imports   = 0;
+        m->memimage.state       = MEMIMAGE_UNBUILT;
+        m->num_threads          = 1;
+        m->hash                 = MODULE_HASH_INIT;
+        m->refs                 = 1;
+        *mod = m;
+    }
+    __catch:
+        return err;
+}
 
-        uint8_t section_order[] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 12, 10, 11};
-        uint8_t expected_id = 0;
-        
-        while(!eof(buf)) {
-            uint8_t id;
-            uint32_t size;
-            __throwiferr(read_byte(&id, buf));
-            __throwiferr(read_u32_leb128(&size, buf));
+// streaming decoder
+// The module is decoded one unit at a time: the header, the id and size of
+// a section, the contents of a section, and each entry of the code section.
+// A unit is decoded as soon as all of its bytes are there. Bytes of an
+// incomplete unit are kept in pending until the next decoder_feed.
+#define DECODER_HEADER      0
+#define DECODER_SECTION     1   // id and size of the next section
+#define DECODER_BODY        2   // contents of a section other than the code section
+#define DECODER_CODES       3   // number of entries of the code section
+#define DECODER_CODE        4   // an entry of the code section
+
+struct decoder {
+    module_t            *mod;
+    // the first error, returned by every call afterwards
+    error_t             err;
+    VECTOR(uint8_t)     pending;
+    uint8_t             state;
+    uint8_t             id;
+    uint8_t             expected_id;
+    // bytes of the current section not decoded yet
+    uint32_t            size;
+    // next entry of the code section
+    uint32_t            code;
+    // with more than one thread, entries of the code section wait here until
+    // the section is complete: their bytes back to back and where each ends
+    VECTOR(uint8_t)     bodies;
+    VECTOR(size_t)      ends;
+    // entries decoded so far
+    uint32_t            decoded;
+};
 
-            if(id > 12) {
-                __throw(ERR_MALFORMED_SECTION_ID);
+error_t new_decoder(decoder_t **d) {
+    __try {
+        decoder_t *dec = malloc(sizeof(decoder_t));
+        __throwif(ERR_FAILED, !dec);
+
+        *dec = (decoder_t) {
+            .err            = ERR_SUCCESS,
+            .state          = DECODER_HEADER,
+            .expected_id    = 0
+        };
+        VECTOR_INIT(&dec->pending);
+        VECTOR_INIT(&dec->bodies);
+        VECTOR_INIT(&dec->ends);
+        if(IS_ERROR(new_module(&dec->mod))) {
+            free(dec);
+            __throw(ERR_FAILED);
+        }
+        *d = dec;
+    }
+    __catch:
+        return err;
+}
+
+// append len bytes to vec, a VECTOR(uint8_t)
+static error_t append_bytes(vector_t *vec, const uint8_t *bytes, size_t len) {
+    __try {
+        size_t need = vec->len + len;
+        if(need > vec->cap)
+            __throwiferr(vector_grow(vec, need > 2 * vec->cap ? need - vec->cap : vec->cap));
+        memcpy((uint8_t *)vec->elem + vec->len, bytes, len);
+        vec->len = need;
+    }
+    __catch:
+        return err;
+}
+
+// parallel decoding of the entries of the code section
+// Each worker decodes through a copy of the module whose arena is its own,
+// merged into the arena of the module afterwards. The copy is only read
+// otherwise, and each entry writes its own func_t.
+typedef struct {
+    decoder_t   *d;
+    module_t    *workers;
+    error_t     *errs;
+} codes_t;
+
+static void decode_code_work(void *arg, uint32_t worker, uint32_t i) {
+    codes_t *c = arg;
+    decoder_t *d = c->d;
+    uint32_t x = d->decoded + i;
+
+    size_t start = x ? d->ends.elem[x - 1] : 0;
+    buffer_t code;
+    new_buffer(&code, d->bodies.elem + start, d->ends.elem[x] - start);
+    c->errs[i] = decode_code(&c->workers[worker], VECTOR_ELEM(&d->mod->funcs, x), &code);
+}
+
+// Decode the entries waiting in d. The error of the first entry that fails is
+// returned, as if they were decoded in order, and the entries from it on are
+// left waiting.
+static error_t decode_codes(decoder_t *d) {
+    module_t *mod = d->mod;
+    uint32_t n = d->ends.len - d->decoded;
+    uint32_t num_threads = mod->num_threads < MAX_THREADS ? mod->num_threads : MAX_THREADS;
+    module_t workers[MAX_THREADS];
+    error_t *errs = NULL;
+
+    __try {
+        if(n == 0)
+            __throw(ERR_SUCCESS);
+        errs = malloc(sizeof(error_t) * n);
+        __throwif(ERR_FAILED, !errs);
+
+        for(uint32_t w = 0; w < num_threads; w++) {
+            workers[w] = *mod;
+            arena_init(&workers[w].arena);
+        }
+
+        codes_t c = {.d = d, .workers = workers, .errs = errs};
+        parallel_for(num_threads, n, decode_code_work, &c);
+
+        for(uint32_t w = 0; w < num_threads; w++)
+            arena_merge(&mod->arena, &workers[w].arena);
+
+        // an entry that fails is decoded again if it is retried
+        for(uint32_t i = 0; i < n; i++, d->decoded++)
+            __throwiferr(errs[i]);
+    }
+    __catch:
+        free(errs);
+        return err;
+}
+
+// Decode and validate function bodies on num_threads threads. Entries of the
+// code section are then decoded together once the section is complete, and
+// validate_module validates them together. Errors are the same as with one.
+void decoder_set_threads(decoder_t *d, uint32_t num_threads) {
+    d->mod->num_threads = num_threads ? num_threads : 1;
+}
+
+// Until the last bytes were fed, running out of bytes means waiting for more.
+static inline bool incomplete(error_t err, bool final) {
+    return !final && (err == ERR_UNEXPECTED_END || err == ERR_LENGTH_OUT_OF_BOUNDS);
+}
+
+// Decode the units complete in buf, advancing buf past them. Once final is set
+// no more bytes are coming and decode_module's errors are returned for an
+// unfinished module.
+static error_t decoder_run(decoder_t *d, buffer_t *buf, bool final) {
+    static const uint8_t section_order[] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 12, 10, 11};
+    module_t *mod = d->mod;
+
+    __try {
+        while(true) {
+            // parse on a copy, taken over once the unit is decoded
+            buffer_t b = *buf;
+            size_t avail = b.end - b.p;
+
+            // the section ends past the last byte
+            if(d->state >= DECODER_BODY && final && avail < d->size) {
+                // an entry running out of bytes was waiting for the rest
+                error_t e = decode_codes(d);
+                __throwif(e, IS_ERROR(e) && !incomplete(e, false));
+                __throw(ERR_LENGTH_OUT_OF_BOUNDS);
             }
-            
-            if(id != 0) {
-                // Make sure that the section is in order and only appears once
-                while(section_order[expected_id++] != id) {
-                    __throwif(ERR_UNEXPECTED_CONTENT_AFTER_LAST_SECTION, expected_id >= 12);
+
+            switch(d->state) {
+                case DECODER_HEADER: {
+                    if(!final && avail < 8)
+                        __throw(ERR_SUCCESS);
+
+                    uint32_t magic, version;
+                    __throwiferr(read_u32(&magic, &b));
+                    __throwif(ERR_MAGIC_HEADER_NOT_DETECTED, magic != 0x6d736100);
+                    __throwiferr(read_u32(&version, &b));
+                    __throwif(ERR_UNKNOWN_BINARY_VERSION, version != 0x00000001);
+                    d->state = DECODER_SECTION;
+                    break;
+                }
+
+                case DECODER_SECTION: {
+                    // the module may end between sections
+                    if(avail == 0)
+                        __throw(ERR_SUCCESS);
+
+                    uint8_t id;
+                    uint32_t size;
+                    error_t e = read_byte(&id, &b);
+                    if(!IS_ERROR(e))
+                        e = read_u32_leb128(&size, &b);
+                    if(incomplete(e, final))
+                        __throw(ERR_SUCCESS);
+                    __throwiferr(e);
+
+                    if(id > 12) {
+                        __throw(ERR_MALFORMED_SECTION_ID);
+                    }
+
+                    if(id != 0) {
+                        // Make sure that the section is in order and only appears once
+                        while(section_order[d->expected_id++] != id) {
+                            __throwif(ERR_UNEXPECTED_CONTENT_AFTER_LAST_SECTION, d->expected_id >= 12);
+                        }
+                    }
+
+                    d->id = id;
+                    d->size = size;
+                    d->state = id == 10 ? DECODER_CODES : DECODER_BODY;
+                    break;
+                }
+
+                case DECODER_BODY: {
+                    if(avail < d->size)
+                        __throw(ERR_SUCCESS);
+
+                    buffer_t sec;
+                    __throwiferr(read_buffer(&sec, d->size, &b));
+                    __throwiferr(decoders[d->id](mod, &sec));
+                    d->state = DECODER_SECTION;
+                    break;
+                }
+
+                case DECODER_CODES:
+                case DECODER_CODE: {
+                    // the part of the section that is there
+                    buffer_t sec;
+                    new_buffer(&sec, b.p, avail < d->size ? avail : d->size);
+                    bool partial = sec.end - sec.p < d->size;
+
+                    if(d->state == DECODER_CODES) {
+                        error_t e = read_u32_leb128(&mod->num_codes, &sec);
+                        if(partial && incomplete(e, final))
+                            __throw(ERR_SUCCESS);
+                        __throwiferr(e);
+                        __throwif(
+                            ERR_FUNCTION_AND_CODE_SECTION_HAVE_INCOSISTENT_LENGTH, 
+                            mod->num_codes != mod->funcs.len
+                        );
+                        d->code = 0;
+                        d->state = DECODER_CODE;
+                    }
+                    else if(d->code == mod->funcs.len) {
+                        error_t e = decode_codes(d);
+                        if(partial && incomplete(e, final))
+                            __throw(ERR_SUCCESS);
+                        __throwiferr(e);
+                        __throwif(ERR_SECTION_SIZE_MISMATCH, d->size != 0);
+                        d->state = DECODER_SECTION;
+                    }
+                    else {
+                        // read code
+                        uint32_t size;
+                        error_t e = read_u32_leb128(&size, &sec);
+                        if(!IS_ERROR(e)) {
+                            e = size > b.p + d->size - sec.p ? ERR_LENGTH_OUT_OF_BOUNDS : ERR_SUCCESS;
+                        }
+                        if(!IS_ERROR(e)) {
+                            buffer_t code;
+                            e = read_buffer(&code, size, &sec);
+                            if(!IS_ERROR(e) && mod->num_threads > 1) {
+                                e = append_bytes((vector_t *)&d->bodies, code.p, size);
+                                if(!IS_ERROR(e) && d->ends.len == d->ends.cap)
+                                    e = VECTOR_GROW(&d->ends, d->ends.cap ? d->ends.cap : 16);
+                                if(!IS_ERROR(e))
+                                    d->ends.elem[d->ends.len++] = d->bodies.len;
+                            }
+                            else if(!IS_ERROR(e)) {
+                                e = decode_code(mod, VECTOR_ELEM(&mod->funcs, d->code), &code);
+                            }
+                        }
+                        if(partial && incomplete(e, final))
+                            __throw(ERR_SUCCESS);
+                        if(IS_ERROR(e)) {
+                            error_t c = decode_codes(d);
+                            if(partial && incomplete(c, final))
+                                __throw(ERR_SUCCESS);
+                            __throwiferr(c);
+                        }
+                        __throwiferr(e);
+                        d->code++;
+                    }
+
+                    d->size -= sec.p - b.p;
+                    b.p = sec.p;
+                    break;
                 }
             }
-            
-            buffer_t *sec;
-            __throwiferr(read_buffer(&sec, size, buf));
-            __throwiferr(decoders[id](m, sec));
+
+            *buf = b;
         }
+    }
+    __catch:
+        return err;
+}
+
+// Decode what bytes complete. Bytes are decoded in place when nothing is
+// pending, so a whole image fed at once is never copied.
+error_t decoder_feed(decoder_t *d, const uint8_t *bytes, size_t len) {
+    __try {
+        __throwiferr(d->err);
+        d->mod->hash = hash_bytes(d->mod->hash, bytes, len);
+
+        buffer_t buf;
+        bool pending = d->pending.len != 0;
+        if(pending) {
+            __throwiferr(append_bytes((vector_t *)&d->pending, bytes, len));
+            new_buffer(&buf, d->pending.elem, d->pending.len);
+        }
+        else {
+            new_buffer(&buf, (uint8_t *)bytes, len);
+        }
+
+        error_t e = decoder_run(d, &buf, false);
+
+        // keep the bytes of the incomplete unit
+        size_t left = buf.end - buf.p;
+        if(pending) {
+            memmove(d->pending.elem, buf.p, left);
+            d->pending.len = left;
+        }
+        else {
+            __throwiferr(append_bytes((vector_t *)&d->pending, buf.p, left));
+        }
+        __throwiferr(e);
+    }
+    __catch:
+        if(IS_ERROR(err))
+            d->err = err;
+        return err;
+}
+
+// Decode the rest once all bytes were fed, then free d. On success *mod is
+// the module, otherwise the first error is returned.
+error_t decoder_finish(decoder_t *d, module_t **mod) {
+    __try {
+        __throwiferr(d->err);
+
+        buffer_t buf;
+        new_buffer(&buf, d->pending.elem, d->pending.len);
+        __throwiferr(decoder_run(d, &buf, true));
 
         // Consider the case where the codesec is empty and the funcsec is non-empty
         // See line 420 of binary.wast
-        __throwif(ERR_FUNCTION_AND_CODE_SECTION_HAVE_INCOSISTENT_LENGTH, m->num_codes != m->funcs.len);
+        __throwif(ERR_FUNCTION_AND_CODE_SECTION_HAVE_INCOSISTENT_LENGTH, d->mod->num_codes != d->mod->funcs.len);
+        *mod = d->mod;
+        d->mod = NULL;
+    }
+    __catch:
+        if(d->mod)
+            free_module(d->mod);
+        free(d->pending.elem);
+        free(d->bodies.elem);
+        free(d->ends.elem);
+        free(d);
+        return err;
+}
+
+error_t decode_module(module_t **mod, uint8_t *image, size_t image_size) {
+    __try {
+        decoder_t *d;
+        __throwiferr(new_decoder(&d));
+        // an error is returned again by decoder_finish, which frees d
+        decoder_feed(d, image, image_size);
+        __throwiferr(decoder_finish(d, mod));
     }
     __catch:
         return err;
+}
+
+// Drop a reference to mod. The last one frees mod and everything compiled
+// from it. No instance of mod may be left; a function of it waiting for a
+// tier-up keeps it until the worker is done with it (see tierup.h).
+void free_module(module_t *mod) {
+    if(__atomic_sub_fetch(&mod->refs, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+
+    VECTOR_FOR_EACH(func, &mod->funcs) {
+        // native code is mapped per function, outside the arena
+        if(func->jitcode)
+            munmap(func->jitcode, func->jitsize);
+    }
+    if(mod->memimage.state == MEMIMAGE_READY)
+        close(mod->memimage.fd);
+
+    // the module is in its own arena
+    arena_t arena = mod->arena;
+    arena_release(&arena);
 }
\ No newline at end of file
@@ -13,13 +13,14 @@ typedef struct {
     uint8_t *end;
 } buffer_t;
 
-error_t new_buffer(buffer_t **d, uint8_t *head, size_t size);
-error_t read_buffer(buffer_t **d, size_t size, buffer_t *buf);
+void new_buffer(buffer_t *d, uint8_t *head, size_t size);
+error_t read_buffer(buffer_t *d, size_t size, buffer_t *buf);
 error_t read_byte(uint8_t *d, buffer_t *buf);
-error_t read_bytes(uint8_t **d, buffer_t *buf);
+error_t read_bytes(uint8_t **d, arena_t *arena, buffer_t *buf);
 error_t read_u32(uint32_t *d, buffer_t *buf);
 error_t read_i32(int32_t *d, buffer_t *buf);
 error_t read_u32_leb128(uint32_t *d, buffer_t *buf);
+error_t read_u64_leb128(uint64_t *d, buffer_t *buf);
 error_t read_i32_leb128(int32_t *d, buffer_t *buf);
 error_t read_i64_leb128(int64_t *d, buffer_t *buf);
 
@@ -36,4 +37,14 @@ error_t decode_elemsec(module_t *mod, buffer_t *buf);
 error_t decode_codesec(module_t *mod, buffer_t *buf);
 error_t decode_datasec(module_t *mod, buffer_t *buf);
 error_t decode_datacountsec(module_t *mod, buffer_t *buf);
-error_t decode_module(module_t **mod, uint8_t *image, size_t image_size);
\ No newline at end of file
+error_t decode_module(module_t **mod, uint8_t *image, size_t image_size);
+
+// Push-style decoding of a module arriving in pieces, e.g. from a pipe or a
+// socket. Sections, and the entries of the code section one by one, are
+// decoded as soon as their bytes were fed, with the decode_*sec functions.
+typedef struct decoder decoder_t;
+error_t new_decoder(decoder_t **d);
+void decoder_set_threads(decoder_t *d, uint32_t num_threads);
+error_t decoder_feed(decoder_t *d, const uint8_t *bytes, size_t len);
+error_t decoder_finish(decoder_t *d, module_t **mod);
+void free_module(module_t *mod);
\ No newline at end of file
@@ -66,4 +66,7 @@ typedef int error_t;
 #define ERR_TRAP_OUT_OF_BOUNDS_MEMORY_ACCESS                    ERR_CODE(49)
 #define ERR_TRAP_OUT_OF_BOUNDS_TABLE_ACCESS                     ERR_CODE(50)
 #define ERR_TRAP_CALL_STACK_EXHAUSTED                           ERR_CODE(51)
-#define ERR_INCOMPATIBLE_IMPORT_TYPE                            ERR_CODE(52)
\ No newline at end of file
+#define ERR_INCOMPATIBLE_IMPORT_TYPE                            ERR_CODE(52)
+
+// instantiation error
+#define ERR_OUT_OF_MEMORY                                       ERR_CODE(53)
\ No newline at end of file
@@ -1,4 +1,10 @@
+#define _GNU_SOURCE     // memfd_create
 #include "exec.h"
+#include "compile.h"
+#include "jit.h"
+#include "tierup.h"
+#include "trap.h"
+#include "numeric.h"
 #include "print.h"
 #include "exception.h"
 #include "memory.h"
@@ -6,6 +12,12 @@
 // todo: fix this?
 #include <math.h>
 #include <string.h>
+#include <inttypes.h>
+#include <dlfcn.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
 
 // stack
 void new_stack(stack_t **d) {
@@ -16,11 +28,13 @@ void new_stack(stack_t **d) {
     
     *stack = (stack_t) {
         .idx        = -1,
-        .pool       = malloc(STACK_SIZE)
+        .pool       = malloc(sizeof(val_t) * (NUM_STACK_ENT + 1)),
+        .frame_idx  = -1,
+        .frames     = malloc(sizeof(frame_t) * (NUM_FRAME_ENT + 1))
     };
 
-    LIST_INIT(&stack->frames);
-    LIST_INIT(&stack->labels);
+    if(!stack->pool || !stack->frames)
+        PANIC("out of memory");
 }
 
 static inline bool full(stack_t *s) {
@@ -36,10 +50,7 @@ error_t push_val(stack_t *stack, val_t val) {
         if(full(stack)) {
             __throw(ERR_TRAP_CALL_STACK_EXHAUSTED);
         }
-        stack->pool[++stack->idx] = (obj_t) {
-            .type   = TYPE_VAL,
-            .val    = val 
-        };
+        stack->pool[++stack->idx] = val;
         //printf("push val: %x idx: %ld\n", val.num.i32, stack->idx);
     }
     __catch:
@@ -83,56 +94,20 @@ static inline error_t push_f64(stack_t *stack, double val) {
         return err;
 }
 
-// todo: fix this?
-error_t push_vals(stack_t *stack, vals_t vals) {
-    __try {
-        size_t num_vals = vals.len;
-        for(int32_t i = (num_vals - 1); 0 <= i; i--) {
-           __throwiferr(push_val(stack, vals.elem[i]));
-        }
-    }
-    __catch:
-        return err;
-}
-
-error_t push_label(stack_t *stack, label_t label) {
-    __try {
-        if(full(stack)) {
-            __throw(ERR_TRAP_CALL_STACK_EXHAUSTED);
-        }
-        obj_t *obj = &stack->pool[++stack->idx];
-
-        *obj = (obj_t) {
-            .type   = TYPE_LABEL,
-            .label  = label 
-        };
-        list_push_back(&stack->labels, &obj->label.link);
-        //printf("push label idx: %ld\n", stack->idx);
-    }
-    __catch:
-        return err;
-}
-
 error_t push_frame(stack_t *stack, frame_t frame) {
     __try {
-        if(full(stack)) {
+        if(stack->frame_idx == NUM_FRAME_ENT) {
             __throw(ERR_TRAP_CALL_STACK_EXHAUSTED);
         }
-        obj_t *obj = &stack->pool[++stack->idx];
-
-        *obj = (obj_t) {
-            .type   = TYPE_FRAME,
-            .frame  = frame 
-        };
-        list_push_back(&stack->frames, &obj->frame.link);
-        //printf("push frame idx: %ld\n", stack->idx);
+        stack->frames[++stack->frame_idx] = frame;
+        //printf("push frame idx: %ld\n", stack->frame_idx);
     }
     __catch:
         return err;
 }
 
 void pop_val(stack_t *stack, val_t *val) {    
-    *val = stack->pool[stack->idx].val;
+    *val = stack->pool[stack->idx];
     stack->idx--;
     //printf("pop val: %x idx: %ld\n", val->num.i32, stack->idx);
 }
@@ -161,1670 +136,1007 @@ static inline void pop_f64(stack_t *stack, double *val) {
     *val = v.num.f64;
 }
 
-// pop all values from the stack top
-void pop_vals(stack_t *stack, vals_t *vals) {
-    // count values
-    size_t num_vals = 0;
-    size_t i = stack->idx;
-    while(stack->pool[i].type == TYPE_VAL) {
-        num_vals++;
-        i--;
-    }
-    
-    // init vector
-    VECTOR_NEW(vals, num_vals, num_vals);
-    
-    // pop values
-    VECTOR_FOR_EACH(val, vals) {
-        pop_val(stack, val);
-    }
+void pop_frame(stack_t *stack, frame_t *frame) {
+    *frame = stack->frames[stack->frame_idx--];
+    //printf("pop frame idx: %ld\n", stack->frame_idx);
 }
 
-void pop_vals_n(stack_t *stack, size_t n, vals_t *vals) {
-    // init vector
-    VECTOR_NEW(vals, n, n);
-    
-    // pop values
-    VECTOR_FOR_EACH(val, vals) {
-        pop_val(stack, val);
-    }
-}
+static error_t invoke_func(store_t *S, funcaddr_t funcaddr);
 
-void pop_label(stack_t *stack, label_t *label) {
-    *label = stack->pool[stack->idx].label;
-    stack->idx--;
-    list_pop_tail(&stack->labels);
-}
+// bulk memory and table operations
+// ref: https://webassembly.github.io/spec/core/exec/instructions.html#memory-instructions
 
-void try_pop_label(stack_t *stack, label_t *label) {
-    // nop
-    if(stack->pool[stack->idx].type != TYPE_LABEL)
-        return;
-    
-    pop_label(stack, label);
+// [a, a + n) lies within mem, without overflowing for 64-bit addresses
+static inline bool mem_in_bounds(meminst_t *mem, uint64_t a, uint64_t n) {
+    uint64_t size = (uint64_t)mem->num_pages * WASM_PAGE_SIZE;
+    return a <= size && n <= size - a;
 }
 
-void pop_frame(stack_t *stack, frame_t *frame) {
-    *frame = stack->pool[stack->idx].frame;
-    stack->idx--;
-    list_pop_tail(&stack->frames);
-    //printf("pop frame idx: %ld\n", stack->idx);
-}
+static error_t memory_init(meminst_t *mem, datainst_t *data, uint64_t d, uint32_t s, uint32_t n) {
+    __try {
+        __throwif(
+            ERR_TRAP_OUT_OF_BOUNDS_MEMORY_ACCESS, 
+            (uint64_t)s + n > data->data.len || !mem_in_bounds(mem, d, n)
+        );
 
-// pop while stack top is not a frame
-void pop_while_not_frame(stack_t *stack) {
-    while(stack->pool[stack->idx].type != TYPE_FRAME) {
-        switch(stack->pool[stack->idx].type) {
-            case TYPE_VAL:
-                stack->idx--;
-                break;
-            case TYPE_LABEL: {
-                label_t tmp;
-                pop_label(stack, &tmp);
-                break;
-            }
-        }
+        memcpy(mem->data + d, data->data.elem + s, n);
     }
+    __catch:
+        return err;
 }
 
-// memory
-// 33bit address space
-typedef uint64_t    eaddr_t;
-typedef uint64_t    paddr_t;
-static paddr_t eaddr_to_paddr(meminst_t *meminst, eaddr_t eaddr) {
-    uint32_t vpn2 = (eaddr) >> 30 & 0x3;
-    uint32_t vpn1 = (eaddr) >> 21 & 0x1ff;
-    uint32_t vpn0 = (eaddr) >> 12 & 0x1ff;
-
-    if(meminst->table2[vpn2] == NULL) {
-        meminst->table2[vpn2] = calloc(1, 4096);
-    }
-    
-    uint8_t ***table1 = meminst->table2[vpn2];
+// copy from src to dst, which may be the same memory
+static error_t memory_copy(meminst_t *dst, meminst_t *src, uint64_t d, uint64_t s, uint64_t n) {
+    __try {
+        __throwif(
+            ERR_TRAP_OUT_OF_BOUNDS_MEMORY_ACCESS, 
+            !mem_in_bounds(src, s, n) || !mem_in_bounds(dst, d, n)
+        );
 
-    if(table1[vpn1] == NULL) {
-        table1[vpn1] = calloc(1, 4096);
+        // the regions may overlap
+        memmove(dst->data + d, src->data + s, n);
     }
+    __catch:
+        return err;
+}
 
-    uint8_t **table0 = table1[vpn1];
+static error_t memory_fill(meminst_t *mem, uint64_t d, uint8_t val, uint64_t n) {
+    __try {
+        __throwif(ERR_TRAP_OUT_OF_BOUNDS_MEMORY_ACCESS, !mem_in_bounds(mem, d, n));
 
-    if(table0[vpn0] == NULL) {
-        table0[vpn0] = calloc(1, 4096);
+        memset(mem->data + d, val, n);
     }
+    __catch:
+        return err;
+}
 
-    return (uint64_t)table0[vpn0] + (eaddr & 0xfff);
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
 }
 
-static void expand_F(functype_t *ty, blocktype_t bt, frame_t *F) {
-    ty->rt1 = (resulttype_t){.len = 0, .elem = NULL};
+// Map the pages of [p, p + size) at once instead of on first touch. They are
+// read faulted, so untouched pages share the zero page and physical memory is
+// only allocated by the first store to each of them.
+// ref: https://man7.org/linux/man-pages/man2/madvise.2.html
+static void populate(uint8_t *p, size_t size) {
+#ifdef MADV_POPULATE_READ
+    if(madvise(p, size, MADV_POPULATE_READ) == 0)
+        return;
+#endif
+    for(size_t off = 0; off < size; off += PAGE_SIZE)
+        (void)((volatile uint8_t *)p)[off];
+}
 
-    switch(bt.valtype) {
-        case 0x40:
-            ty->rt2 = (resulttype_t){.len = 0, .elem = NULL};
-            break;
+#define HUGE_ALIGN_DOWN(p)  ((uint8_t *)((uintptr_t)(p) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1)))
+#define HUGE_ALIGN_UP(p)    HUGE_ALIGN_DOWN((uintptr_t)(p) + HUGE_PAGE_SIZE - 1)
 
-        case TYPE_NUM_I32:
-        case TYPE_NUM_I64:
-        case TYPE_NUM_F32:
-        case TYPE_NUM_F64:
-        case TYPE_EXTENREF:
-            VECTOR_NEW(&ty->rt2, 1, 1);
-            *VECTOR_ELEM(&ty->rt2, 0) = bt.valtype;
+// back [p, p + size) of mem, just made accessible, with huge pages if asked for
+static void back_huge(meminst_t *mem, uint8_t *p, size_t size) {
+    switch(mem->backing) {
+        case MEM_BACKING_THP:
+            madvise(p, size, MADV_HUGEPAGE);
             break;
 
-        default:
-            // treat as typeidx
-            *ty = F->module->types[bt.typeidx];
+        // whole huge pages only: the rest, and memory grown in smaller steps,
+        // keeps base pages
+        case MEM_BACKING_HUGETLB: {
+            uint8_t *start = HUGE_ALIGN_UP(p), *end = HUGE_ALIGN_DOWN(p + size);
+            if(start >= end)
+                break;
+            int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED;
+            if(mmap(start, end - start, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0) != MAP_FAILED)
+                break;
+            // the pool ran out, and the range may be unmapped already
+            if(mmap(start, end - start, PROT_READ | PROT_WRITE, flags, -1, 0) == MAP_FAILED)
+                PANIC("out of memory");
             break;
+        }
     }
 }
 
-// execute a sequence of instructions
-// ref: https://gcc.gnu.org/onlinedocs/gcc/Other-Builtins.html
-// ref: https://github.com/wasm3/wasm3/blob/main/source/m3_exec.h
-// ref: https://github.com/wasm3/wasm3/blob/main/source/m3_math_utils.h
-// ref: https://en.wikipedia.org/wiki/Circular_shift
-#define TRUNC(A, TYPE, RMIN, RMAX)                              \
-    ({                                                          \
-        if(isnan(A)) {                                          \
-            __throw(ERR_TRAP_INVALID_CONVERSION_TO_INTERGER);   \
-        }                                                       \
-        if(A <= RMIN || A >= RMAX) {                            \
-            __throw(ERR_TRAP_INTERGET_OVERFLOW);                \
-        }                                                       \
-        (TYPE)A;                                                \
-    })
+// ref: https://webassembly.github.io/spec/core/exec/instructions.html#table-instructions
+// returns the old size in pages, or -1 if the memory cannot grow by n pages
+static int64_t memory_grow(meminst_t *mem, uint64_t n) {
+    uint64_t sz = mem->num_pages;
+
+    // a 64-bit memory cannot grow past its reservation
+    uint64_t limit = mem->type.is64 ? mem->reserve_size / WASM_PAGE_SIZE : NUM_PAGE_MAX;
+    if(mem->type.has_max && mem->type.max < limit)
+        limit = mem->type.max;
+    if(n > limit - sz)
+        return -1;
+
+    // map the new pages in bulk: grown memory is about to be used
+    uint64_t t0 = now_ns();
+    uint8_t *p = mem->data + mem->num_pages * WASM_PAGE_SIZE;
+    size_t size = (size_t)n * WASM_PAGE_SIZE;
+    if(mprotect(p, size, PROT_READ | PROT_WRITE) != 0)
+        return -1;
+    back_huge(mem, p, size);
+    uint64_t t1 = now_ns();
+    populate(p, size);
+    uint64_t t2 = now_ns();
+
+    mem->stats.grows++;
+    mem->stats.pages_grown += n;
+    mem->stats.grow_ns += t1 - t0;
+    mem->stats.touch_ns += t2 - t1;
+
+    mem->num_pages += n;
+    mem->type.min += n;
+    return sz;
+}
 
-#define I32_TRUNC_F32(A)    TRUNC(A, int32_t, -2147483904.0f, 2147483648.0f)
-#define U32_TRUNC_F32(A)    TRUNC(A, uint32_t,         -1.0f, 4294967296.0f)
-#define I32_TRUNC_F64(A)    TRUNC(A, int32_t, -2147483649.0 , 2147483648.0 )
-#define U32_TRUNC_F64(A)    TRUNC(A, uint32_t,         -1.0 , 4294967296.0 )
-
-#define I64_TRUNC_F32(A)    TRUNC(A, int64_t, -9223373136366403584.0f,  9223372036854775808.0f)
-#define U64_TRUNC_F32(A)    TRUNC(A, uint64_t,                  -1.0f, 18446744073709551616.0f)
-#define I64_TRUNC_F64(A)    TRUNC(A, int64_t, -9223372036854777856.0 ,  9223372036854775808.0 )
-#define U64_TRUNC_F64(A)    TRUNC(A, uint64_t,                  -1.0 , 18446744073709551616.0 )
-
-#define TRUNC_SAT(A, TYPE, RMIN, RMAX, IMIN, IMAX)          \
-    ({                                                      \
-        TYPE __val;                                         \
-        if (isnan(A)) {                                     \
-            __val = 0;                                      \
-        } else if (A <= RMIN) {                             \
-            __val = IMIN;                                   \
-        } else if (A >= RMAX) {                             \
-            __val = IMAX;                                   \
-        } else {                                            \
-            __val = (TYPE)A;                                \
-        }                                                   \
-        __val;                                              \
-    })
+static error_t table_init(tableinst_t *tab, eleminst_t *elem, uint32_t d, uint32_t s, uint32_t n) {
+    __try {
+        __throwif(
+            ERR_TRAP_OUT_OF_BOUNDS_TABLE_ACCESS, 
+            (uint64_t)s + n > elem->elem.len || (uint64_t)d + n > tab->elem.len
+        );
 
-#define I32_TRUNC_SAT_F32(A)    TRUNC_SAT(A, int32_t, -2147483904.0f, 2147483648.0f,   INT32_MIN,  INT32_MAX)
-#define U32_TRUNC_SAT_F32(A)    TRUNC_SAT(A, uint32_t,         -1.0f, 4294967296.0f,         0UL, UINT32_MAX)
-#define I32_TRUNC_SAT_F64(A)    TRUNC_SAT(A, int32_t, -2147483649.0 , 2147483648.0,    INT32_MIN,  INT32_MAX)
-#define U32_TRUNC_SAT_F64(A)    TRUNC_SAT(A, uint32_t,         -1.0 , 4294967296.0,          0UL, UINT32_MAX)
-#define I64_TRUNC_SAT_F32(A)    TRUNC_SAT(A, int64_t, -9223373136366403584.0f,  9223372036854775808.0f, INT64_MIN,  INT64_MAX)
-#define U64_TRUNC_SAT_F32(A)    TRUNC_SAT(A, uint64_t,                  -1.0f, 18446744073709551616.0f,      0ULL, UINT64_MAX)
-#define I64_TRUNC_SAT_F64(A)    TRUNC_SAT(A, int64_t, -9223372036854777856.0 ,  9223372036854775808.0,  INT64_MIN,  INT64_MAX)
-#define U64_TRUNC_SAT_F64(A)    TRUNC_SAT(A, uint64_t,                  -1.0 , 18446744073709551616.0,       0ULL, UINT64_MAX)
+        memcpy(tab->elem.elem + d, elem->elem.elem + s, sizeof(ref_t) * n);
+    }
+    __catch:
+        return err;
+}
 
-static error_t invoke_func(store_t *S, funcaddr_t funcaddr);
+static error_t table_copy(tableinst_t *tab_x, tableinst_t *tab_y, uint32_t d, uint32_t s, uint32_t n) {
+    __try {
+        __throwif(
+            ERR_TRAP_OUT_OF_BOUNDS_TABLE_ACCESS, 
+            (uint64_t)s + n > tab_y->elem.len || (uint64_t)d + n > tab_x->elem.len
+        );
 
-error_t exec_expr(store_t *S, expr_t *expr) {
-    instr_t *ip = *expr;
+        // the regions may overlap if x and y are the same table
+        memmove(tab_x->elem.elem + d, tab_y->elem.elem + s, sizeof(ref_t) * n);
+    }
+    __catch:
+        return err;
+}
 
-    stack_t *stack = S->stack;
+static void table_fill(tableinst_t *tab, uint32_t i, ref_t val, uint32_t n) {
+    ref_t *p = tab->elem.elem + i;
 
-    // current frame
-    frame_t *F = LIST_TAIL(&stack->frames, frame_t, link);
+    // REF_NULL is all ones
+    if(val == REF_NULL) {
+        memset(p, 0xff, sizeof(ref_t) * n);
+        return;
+    }
+    while(n--)
+        *p++ = val;
+}
 
+// call the function at index i of the table, which must have the type typeidx
+static error_t call_indirect(store_t *S, moduleinst_t *module, uint32_t typeidx, uint32_t tableidx, uint32_t i) {
     __try {
-        while(ip) {
-            //printf("[+] ip = %x\n", ip->op1);
-            instr_t *next_ip = ip->next;
-            static instr_t end = {.op1 = OP_END};
-
-            int32_t rhs_i32, lhs_i32;
-            int64_t rhs_i64, lhs_i64;
-            float   rhs_f32, lhs_f32;
-            double  rhs_f64, lhs_f64;
-
-            // unary operator
-            if(ip->op1 == OP_I32_EQZ || (OP_I32_CLZ <= ip->op1 && ip->op1 <= OP_I32_POPCNT) ||
-               (OP_I64_EXTEND_I32_S <= ip->op1 && ip->op1 <= OP_I64_EXTEND_I32_U) ||
-               (OP_I32_EXTEND8_S <= ip->op1 && ip->op1 <= OP_I32_EXTEND16_S) ||
-               (OP_F32_CONVERT_I32_S <= ip->op1 && ip->op1 <= OP_F32_CONVERT_I32_U) ||
-               (OP_F64_CONVERT_I32_S <= ip->op1 && ip->op1 <= OP_F64_CONVERT_I32_U) ||
-               ip->op1 == OP_F32_REINTERPRET_I32) {
-                pop_i32(stack, &lhs_i32);
-            }
-            if(ip->op1 == OP_I64_EQZ || (OP_I64_CLZ <= ip->op1 && ip->op1 <= OP_I64_POPCNT) ||
-               (OP_I64_EXTEND8_S <= ip->op1 && ip->op1 <= OP_I64_EXTEND32_S) ||
-               ip->op1 == OP_I32_WRAP_I64 || 
-               (OP_F32_CONVERT_I64_S <= ip->op1 && ip->op1 <= OP_F32_CONVERT_I64_U) || 
-               (OP_F64_CONVERT_I64_S <= ip->op1 && ip->op1 <= OP_F64_CONVERT_I64_U) ||
-               ip->op1 == OP_F64_REINTERPRET_I64) {
-                pop_i64(stack, &lhs_i64);
-            }
-            if((OP_F32_ABS <= ip->op1 && ip->op1 <= OP_F32_SQRT) || 
-               (OP_I32_TRUNC_F32_S <= ip->op1 && ip->op1 <= OP_I32_TRUNC_F32_U) ||
-               (OP_I64_TRUNC_F32_S <= ip->op1 && ip->op1 <= OP_I64_TRUNC_F32_U) ||
-               ip->op1 == OP_F64_PROMOTE_F32 || 
-               ip->op1 == OP_I32_REINTERPRET_F32 ||
-               (ip->op1 == OP_0XFC && (ip->op2 == 0 || ip->op2 == 1 || ip->op2 == 4 || ip->op2 == 5))) {
-                pop_f32(stack, &lhs_f32);
-            }
-            if((OP_F64_ABS <= ip->op1 && ip->op1 <= OP_F64_SQRT) ||
-               (OP_I32_TRUNC_F64_S <= ip->op1 && ip->op1 <= OP_I32_TRUNC_F64_U) || 
-               (OP_I64_TRUNC_F64_S <= ip->op1 && ip->op1 <= OP_I64_TRUNC_F64_U) || 
-               ip->op1 == OP_F32_DEMOTE_F64 || 
-               ip->op1 == OP_I64_REINTERPRET_F64 ||
-               (ip->op1 == OP_0XFC && (ip->op2 == 2 || ip->op2 == 3 || ip->op2 == 6 || ip->op2 == 7))) {
-                pop_f64(stack, &lhs_f64);
-            }
-            
-            // binary operator
-            if((OP_I32_EQ <= ip->op1 && ip->op1 <= OP_I32_GE_U) || 
-               (OP_I32_ADD <= ip->op1 && ip->op1 <= OP_I32_ROTR)) {
-                pop_i32(stack, &rhs_i32);
-                pop_i32(stack, &lhs_i32);
-            }
-            if((OP_I64_EQ <= ip->op1 && ip->op1 <= OP_I64_GE_U) || 
-               (OP_I64_ADD <= ip->op1 && ip->op1 <= OP_I64_ROTR)) {
-                pop_i64(stack, &rhs_i64);
-                pop_i64(stack, &lhs_i64);
-            }
-            if((OP_F32_EQ <= ip->op1 && ip->op1 <= OP_F32_GE) ||
-               (OP_F32_ADD <= ip->op1 && ip->op1 <= OP_F32_COPYSIGN)) {
-                pop_f32(stack, &rhs_f32);
-                pop_f32(stack, &lhs_f32);
-            }
-            if((OP_F64_EQ <= ip->op1 && ip->op1 <= OP_F64_GE) ||
-               (OP_F64_ADD <= ip->op1 && ip->op1 <= OP_F64_COPYSIGN)) {
-                pop_f64(stack, &rhs_f64);
-                pop_f64(stack, &lhs_f64);
-            }
+        functype_t *ft_expect = &module->types[typeidx];
+        tableaddr_t ta = module->tableaddrs[tableidx];
+        tableinst_t *tab = VECTOR_ELEM(&S->tables, ta);
 
-            switch(ip->op1) {
-                case OP_UNREACHABLE:
-                    __throw(ERR_TRAP_UNREACHABLE);
-                    break;
-                
-                case OP_NOP:
-                    break;
-                
-                case OP_BLOCK: {
-                    functype_t ty;
-                    expand_F(&ty, ip->bt, F);
-                    label_t L = {
-                        .arity  = ty.rt2.len,
-                        .parent = ip,
-                        .continuation = &end,
-                    };
-                    vals_t vals;
-                    pop_vals_n(stack, ty.rt1.len, &vals);
-                    __throwiferr(push_label(stack, L));
-                    __throwiferr(push_vals(stack, vals));
-                    next_ip = ip->in1;
-                    break;
-                }
+        __throwif(ERR_TRAP_UNDEFINED_ELEMENT, i >= tab->elem.len);
+        ref_t r = *VECTOR_ELEM(&tab->elem, i);
+        __throwif(ERR_TRAP_UNINITIALIZED_ELEMENT, r == REF_NULL);
 
-                case OP_LOOP: {
-                    functype_t ty;
-                    expand_F(&ty, ip->bt, F);
-                    label_t L = {
-                        .arity = ty.rt1.len,
-                        .parent = ip,
-                        .continuation = ip,
-                    };
-                    vals_t vals;
-                    pop_vals_n(stack, ty.rt1.len, &vals);
-                    __throwiferr(push_label(stack, L));
-                    __throwiferr(push_vals(stack, vals));
-                    next_ip = ip->in1;
-                    break; 
-                }
+        funcinst_t *f = VECTOR_ELEM(&S->funcs, r);
+        functype_t *ft_actual = f->type;
 
-                case OP_IF: {
-                    int32_t c;
-                    pop_i32(stack, &c);
-
-                    functype_t ty;
-                    expand_F(&ty, ip->bt, F);
-                    label_t L = {
-                        .arity = ty.rt2.len,
-                        .parent = ip,
-                        .continuation = &end,
-                    };
-                    vals_t vals;
-                    pop_vals_n(stack, ty.rt1.len, &vals);
-                    __throwiferr(push_label(stack, L));
-                    __throwiferr(push_vals(stack, vals));
-
-                    if(c) {
-                        next_ip = ip->in1;
-                    } 
-                    else if(ip->in2) {
-                        next_ip = ip->in2;
-                    }
-                    else {
-                        // exec end instruction
-                        static instr_t end = {.op1 = OP_END};
-                        next_ip = &end;
-                    }
-                    break;
-                }
+        __throwif(
+            ERR_TRAP_INDIRECT_CALL_TYPE_MISMATCH, 
+            ft_expect->rt1.len != ft_actual->rt1.len || ft_expect->rt2.len != ft_actual->rt2.len
+        );
 
-                // ref: https://webassembly.github.io/spec/core/exec/instructions.html#returning-from-a-function
-                // ref: https://webassembly.github.io/spec/core/exec/instructions.html#exiting-xref-syntax-instructions-syntax-instr-mathit-instr-ast-with-label-l
-                // The else instruction is treated as an exit from the instruction sequence with a label
-                case OP_ELSE:
-                case OP_END: {
-                    // exit instr* with label L
-                    // pop all values from stack
-                    vals_t vals;
-                    pop_vals(stack, &vals);
-
-                    // exit instr* with label L
-                    label_t l = {.parent = NULL};
-                    try_pop_label(stack, &l);
-                    __throwiferr(push_vals(stack, vals));
-                    next_ip = l.parent != NULL ? l.parent->next : NULL;
-                    break;
-                }
+        for(uint32_t i = 0; i < ft_expect->rt1.len; i++) {
+            valtype_t e = *VECTOR_ELEM(&ft_expect->rt1, i);
+            valtype_t a = *VECTOR_ELEM(&ft_actual->rt1, i);
+            __throwif(ERR_TRAP_INDIRECT_CALL_TYPE_MISMATCH, e != a);
+        }
 
-                case OP_BR_IF: {
-                    labelidx_t idx;
-                    int32_t c;
-                    
-                    pop_i32(stack, &c);
-
-                    if(c == 0) {
-                        break;
-                    }
-                    idx = ip->labelidx;
-                    goto __br;
-
-                case OP_BR_TABLE:
-                    pop_i32(stack, &c);
-                    if(c < ip->labels.len) {
-                        idx = ip->labels.elem[c];
-                    }
-                    else {
-                        idx = ip->default_label;
-                    }
-                    goto __br;
-
-                case OP_BR:
-                    idx = ip->labelidx;
-                __br:
-                    label_t *l = LIST_GET_ELEM(&stack->labels, label_t, link, idx);
-                    vals_t vals;
-                    pop_vals_n(stack, l->arity, &vals);
-                    label_t L;
-                    for(int i = 0; i <= idx; i++) {
-                        vals_t tmp;
-                        pop_vals(stack, &tmp);
-                        pop_label(stack, &L);
-                    }
-                    __throwiferr(push_vals(stack, vals));
-
-                    // br to "outermost" label (return from function)
-                    if(!L.parent) {
-                        next_ip = NULL;
-                    }
-                    else {
-                        // br instruction of block, if is treated as a "end" instruction
-                        switch(L.parent->op1) {
-                            case OP_BLOCK:
-                            case OP_IF:
-                                next_ip = L.parent->next;
-                                break;
-                            case OP_LOOP:
-                                next_ip = L.continuation;
-                                break;
-                        }
-                    }
-                    break;
-                }
+        for(uint32_t i = 0; i < ft_expect->rt2.len; i++) {
+            valtype_t e = *VECTOR_ELEM(&ft_expect->rt2, i);
+            valtype_t a = *VECTOR_ELEM(&ft_actual->rt2, i);
+            __throwif(ERR_TRAP_INDIRECT_CALL_TYPE_MISMATCH, e != a);
+        }
+        __throwiferr(invoke_func(S, r));
+    }
+    __catch:
+        return err;
+}
 
-                // nop
-                case OP_RETURN: {
-                    next_ip = NULL;
-                    break;
-                }
+#define READ_I64(pc)                                            \
+    ({                                                          \
+        uint64_t __v = (uint64_t)(pc)[0] | (uint64_t)(pc)[1] << 32; \
+        (pc) += 2;                                              \
+        (int64_t)__v;                                           \
+    })
 
-                case OP_CALL: {
-                    // invoke func
-                    __throwiferr(invoke_func(S, F->module->funcaddrs[ip->funcidx]));
-                    break;
-                }
+// Instruction dispatch
+// With GNU C, every handler jumps directly to the next one through a table of
+// label addresses. Define DISPATCH_SWITCH (cmake -DCOMPUTED_GOTO=OFF) to use a
+// portable loop around a switch statement instead.
+// ref: https://gcc.gnu.org/onlinedocs/gcc/Labels-as-Values.html
+#if defined(__GNUC__) && !defined(DISPATCH_SWITCH)
+#define DISPATCH_COMPUTED_GOTO
+#endif
+
+#ifdef DISPATCH_COMPUTED_GOTO
+#define INSTR(op)       L_##op:
+#define RINSTR(op)      L_R_##op:
+#define NEXT()          do { ip = pc; goto *dispatch_table[*pc++]; } while(0)
+#else
+#define INSTR(op)       case op:
+#define RINSTR(op)      case OP_R(op):
+#define NEXT()          continue
+#endif
+
+#define DISPATCH_ENTRY(op, ...)     [op] = &&L_##op,
+#define RDISPATCH_ENTRY(op, ...)    [OP_R(op)] = &&L_R_##op,
+
+// operand stack access for the instruction handlers
+#define POP_VAL()       (stack->pool[stack->idx--])
+#define POP_I32()       (POP_VAL().num.i32)
+#define POP_I64()       (POP_VAL().num.i64)
+#define POP_F32()       (POP_VAL().num.f32)
+#define POP_F64()       (POP_VAL().num.f64)
+#define PUSH_VAL(v)     __throwiferr(push_val(stack, v))
+#define PUSH_I32(v)     __throwiferr(push_i32(stack, v))
+#define PUSH_I64(v)     __throwiferr(push_i64(stack, v))
+#define PUSH_F32(v)     __throwiferr(push_f32(stack, v))
+#define PUSH_F64(v)     __throwiferr(push_f64(stack, v))
+
+// frame slot access for the register code
+#define SLOT_I32(i)     (fp[i].num.i32)
+#define SLOT_I64(i)     (fp[i].num.i64)
+#define SLOT_F32(i)     (fp[i].num.f32)
+#define SLOT_F64(i)     (fp[i].num.f64)
+#define SET_I32(i, v)   (fp[i] = (val_t){.num.i32 = (v)})
+#define SET_I64(i, v)   (fp[i] = (val_t){.num.i64 = (v)})
+#define SET_F32(i, v)   (fp[i] = (val_t){.num.f32 = (v)})
+#define SET_F64(i, v)   (fp[i] = (val_t){.num.f64 = (v)})
+
+#define CTYPE_I32       int32_t
+#define CTYPE_I64       int64_t
+#define CTYPE_F32       float
+#define CTYPE_F64       double
+
+// handlers of numeric instructions: lhs (and rhs) are popped as T, the result is pushed as R
+#define UNOP(op, T, R, expr)                                                \
+    INSTR(op) {                                                             \
+        CTYPE_##T lhs = POP_##T();                                          \
+        PUSH_##R(expr);                                                     \
+        NEXT();                                                             \
+    }
 
-                case OP_CALL_INDIRECT: {
-                    tableaddr_t ta = F->module->tableaddrs[ip->x];
-                    tableinst_t *tab = VECTOR_ELEM(&S->tables, ta);
-
-                    functype_t *ft_expect = &F->module->types[ip->y];
-                    
-                    int32_t i;
-                    pop_i32(stack, &i);
-                    __throwif(ERR_TRAP_UNDEFINED_ELEMENT, i >= tab->elem.len);
-                    ref_t r = *VECTOR_ELEM(&tab->elem, i);
-                    __throwif(ERR_TRAP_UNINITIALIZED_ELEMENT, r == REF_NULL);
-
-                    funcinst_t *f = VECTOR_ELEM(&S->funcs, r);
-                    functype_t *ft_actual = f->type;
-
-                    __throwif(
-                        ERR_TRAP_INDIRECT_CALL_TYPE_MISMATCH, 
-                        ft_expect->rt1.len != ft_actual->rt1.len || ft_expect->rt2.len != ft_actual->rt2.len
-                    );
-
-                    for(uint32_t i = 0; i < ft_expect->rt1.len; i++) {
-                        valtype_t e = *VECTOR_ELEM(&ft_expect->rt1, i);
-                        valtype_t a = *VECTOR_ELEM(&ft_actual->rt1, i);
-                        __throwif(ERR_TRAP_INDIRECT_CALL_TYPE_MISMATCH, e != a);
-                    }
-
-                    for(uint32_t i = 0; i < ft_expect->rt2.len; i++) {
-                        valtype_t e = *VECTOR_ELEM(&ft_expect->rt2, i);
-                        valtype_t a = *VECTOR_ELEM(&ft_actual->rt2, i);
-                        __throwif(ERR_TRAP_INDIRECT_CALL_TYPE_MISMATCH, e != a);
-                    }
-                    __throwiferr(invoke_func(S, r));
-                    break;
-                }
+#define BINOP(op, T, R, expr)                                               \
+    INSTR(op) {                                                             \
+        CTYPE_##T rhs = POP_##T();                                          \
+        CTYPE_##T lhs = POP_##T();                                          \
+        PUSH_##R(expr);                                                     \
+        NEXT();                                                             \
+    }
 
-                case OP_DROP: {
-                    val_t val;
-                    pop_val(stack, &val);
-                    break;
-                }
+// register forms: op dst lhs [rhs]
+#define RUNOP(op, T, R, expr)                                               \
+    RINSTR(op) {                                                            \
+        CTYPE_##T lhs = SLOT_##T(pc[1]);                                    \
+        SET_##R(pc[0], expr);                                               \
+        pc += 2;                                                            \
+        NEXT();                                                             \
+    }
 
-                case OP_SELECT:
-                case OP_SELECT_T: {
-                    val_t v1, v2;
-                    int32_t c;
-                    pop_i32(stack, &c);
-                    pop_val(stack, &v2);
-                    pop_val(stack, &v1);
-                    if(c != 0)
-                        __throwiferr(push_val(stack, v1));
-                    else
-                        __throwiferr(push_val(stack, v2));
-                    break;
-                }
+#define RBINOP(op, T, R, expr)                                              \
+    RINSTR(op) {                                                            \
+        CTYPE_##T lhs = SLOT_##T(pc[1]);                                    \
+        CTYPE_##T rhs = SLOT_##T(pc[2]);                                    \
+        SET_##R(pc[0], expr);                                               \
+        pc += 3;                                                            \
+        NEXT();                                                             \
+    }
 
-                case OP_LOCAL_GET: {
-                    localidx_t x = ip->localidx;
-                    val_t val = F->locals[x];
-                    __throwiferr(push_val(stack, val));
-                    break;
-                }
+// Accesses may be unaligned and may straddle host pages, which the single
+// reservation backs contiguously. A memcpy of a fixed size compiles to one
+// host load or store, without casting to a misaligned pointer.
+#define LOAD_MEM(CT, p)     ({ CT __v; memcpy(&__v, (p), sizeof(CT)); __v; })
+#define STORE_MEM(CT, p, v) do { CT __v = (CT)(v); memcpy((p), &__v, sizeof(CT)); } while(0)
+
+// handlers of memory instructions: CT is the type in memory.
+// Floats are loaded and stored through integers to keep their bit patterns.
+// Out-of-bounds accesses fault into a trap (see trap.h).
+#define LOAD(op, R, CT)                                                     \
+    INSTR(op) {                                                             \
+        meminst_t *mem = VECTOR_ELEM(&S->mems, F->module->memaddrs[0]);     \
+        uint64_t ea = (uint64_t)(uint32_t)POP_I32() + *pc++;               \
+        PUSH_##R(LOAD_MEM(CT, mem->data + ea));                             \
+        NEXT();                                                             \
+    }
 
-                case OP_LOCAL_TEE: {
-                    val_t val;
-                    pop_val(stack, &val);
-                    __throwiferr(push_val(stack, val));
-                    __throwiferr(push_val(stack, val));
-                }
+#define STORE(op, T, CT)                                                    \
+    INSTR(op) {                                                             \
+        meminst_t *mem = VECTOR_ELEM(&S->mems, F->module->memaddrs[0]);     \
+        CTYPE_##T c = POP_##T();                                            \
+        uint64_t ea = (uint64_t)(uint32_t)POP_I32() + *pc++;               \
+        STORE_MEM(CT, mem->data + ea, c);                                   \
+        NEXT();                                                             \
+    }
 
-                case OP_LOCAL_SET: {
-                    localidx_t x = ip->localidx;
-                    val_t val;
-                    pop_val(stack, &val);
-                    F->locals[x] = val;
-                    break;
-                }
+// accesses through OP_MEMX, which bounds checks 64-bit addresses explicitly
+// (32-bit ones stay within the guarded reservation)
+#define POP_ADDR(mem)   ((mem)->type.is64 ? (uint64_t)POP_I64() : (uint64_t)(uint32_t)POP_I32())
+#define PUSH_ADDR(mem, v)                                                   \
+    do {                                                                    \
+        if((mem)->type.is64)                                                \
+            PUSH_I64(v);                                                    \
+        else                                                                \
+            PUSH_I32(v);                                                    \
+    } while(0)
+
+#define LOADX(op, R, CT)                                                    \
+    case op: {                                                              \
+        uint64_t offset = READ_I64(pc);                                     \
+        uint64_t ea = POP_ADDR(mem) + offset;                               \
+        __throwif(                                                          \
+            ERR_TRAP_OUT_OF_BOUNDS_MEMORY_ACCESS,                           \
+            mem->type.is64 && (ea < offset || !mem_in_bounds(mem, ea, sizeof(CT))) \
+        );                                                                  \
+        PUSH_##R(LOAD_MEM(CT, mem->data + ea));                             \
+        break;                                                              \
+    }
 
-                case OP_GLOBAL_GET: {
-                    globaladdr_t a = F->module->globaladdrs[ip->globalidx];
-                    globalinst_t *glob = VECTOR_ELEM(&S->globals, a);
-                    __throwiferr(push_val(stack, glob->val));
-                    break;
-                }
+#define STOREX(op, T, CT)                                                   \
+    case op: {                                                              \
+        uint64_t offset = READ_I64(pc);                                     \
+        CTYPE_##T c = POP_##T();                                            \
+        uint64_t ea = POP_ADDR(mem) + offset;                               \
+        __throwif(                                                          \
+            ERR_TRAP_OUT_OF_BOUNDS_MEMORY_ACCESS,                           \
+            mem->type.is64 && (ea < offset || !mem_in_bounds(mem, ea, sizeof(CT))) \
+        );                                                                  \
+        STORE_MEM(CT, mem->data + ea, c);                                   \
+        break;                                                              \
+    }
 
-                case OP_GLOBAL_SET: {
-                    val_t val;
-                    globaladdr_t a = F->module->globaladdrs[ip->globalidx];
-                    globalinst_t *glob = VECTOR_ELEM(&S->globals, a);
-                    pop_val(stack, &val);
-                    glob->val = val;
-                    break;
-                }
+// superinstruction hit counts
+// Counting is compiled in with SUPERINSTR_STATS (cmake -DSUPERINSTR_STATS=ON).
+static uint64_t superinstr_hits[NUM_SUPERINSTRS];
+
+static const char *superinstr_names[NUM_SUPERINSTRS] = {
+    [OP_S_LOCAL_LOCAL_I32_ADD - OP_S_FIRST] = "local.get local.get i32.add",
+    [OP_S_LOCAL_CONST_I32_ADD - OP_S_FIRST] = "local.get i32.const i32.add",
+    [OP_S_I32_EQZ_BR_IF - OP_S_FIRST]       = "i32.eqz br_if",
+    [OP_S_I32_LT_S_BR_IF - OP_S_FIRST]      = "i32.lt_s br_if",
+    [OP_S_LOCAL_I32_LOAD - OP_S_FIRST]      = "local.get i32.load",
+};
+
+#ifdef SUPERINSTR_STATS
+#define COUNT_HIT()     (superinstr_hits[*ip - OP_S_FIRST]++)
+#else
+#define COUNT_HIT()
+#endif
+
+void dump_superinstr_hits(void) {
+#ifndef SUPERINSTR_STATS
+    WARN("superinstruction hits are not counted (build with SUPERINSTR_STATS)");
+#endif
+    for(int i = 0; i < NUM_SUPERINSTRS; i++) {
+        INFO("%-32s %" PRIu64, superinstr_names[i], superinstr_hits[i]);
+    }
+}
 
-                case OP_TABLE_GET: {
-                    tableaddr_t a = F->module->tableaddrs[ip->x];
-                    tableinst_t *tab = VECTOR_ELEM(&S->tables, a);
-                    int32_t i;
-                    pop_i32(stack, &i);
-                    __throwif(ERR_TRAP_OUT_OF_BOUNDS_TABLE_ACCESS, !(i < tab->elem.len));
-                    val_t val;
-                    val.ref = *VECTOR_ELEM(&tab->elem, i);
-                    __throwiferr(push_val(stack, val));
-                    break;
-                }
+// queue a function for background compilation once it gets hot
+// (hotness is only counted in a tiered store)
+static inline void count_hot(store_t *S, funcinst_t *funcinst) {
+    if(S->tier == TIER_TIERED && ++funcinst->hotness == S->hot_threshold)
+        tierup_request(S, funcinst->module->module, funcinst->code);
+}
 
-                case OP_TABLE_SET: {
-                    tableaddr_t a = F->module->tableaddrs[ip->x];
-                    tableinst_t *tab = VECTOR_ELEM(&S->tables, a);
-                    val_t val;
-                    pop_val(stack, &val);
-                    int32_t i;
-                    pop_i32(stack, &i);
-                    __throwif(ERR_TRAP_OUT_OF_BOUNDS_TABLE_ACCESS, !(i < tab->elem.len));
-                    *VECTOR_ELEM(&tab->elem, i) = val.ref;
-                    break;
-                }
+// execute flat code generated by compile_func or compile_func_reg
+static error_t exec_code(store_t *S, uint32_t *pc) {
+    stack_t *stack = S->stack;
 
+    // current frame
+    frame_t *F = &stack->frames[stack->frame_idx];
+
+    // operands of this call start above the frame
+    size_t base = stack->idx + 1;
+
+    // frame slots of the register code: locals, then operands
+    val_t *fp = F->locals;
+
+    // ip points to the opcode cell, pc to the next immediate
+    uint32_t *ip;
+
+#ifdef DISPATCH_COMPUTED_GOTO
+    static const void *const dispatch_table[NUM_OPS] = {
+        [0 ... NUM_OPS - 1] = &&L_UNSUPPORTED,
+        FOREACH_UNOP(DISPATCH_ENTRY)
+        FOREACH_BINOP(DISPATCH_ENTRY)
+        FOREACH_UNOP(RDISPATCH_ENTRY)
+        FOREACH_BINOP(RDISPATCH_ENTRY)
+        [OP_UNREACHABLE]         = &&L_OP_UNREACHABLE,
+        [OP_NOP]                 = &&L_OP_NOP,
+        [OP_IF]                  = &&L_OP_IF,
+        [OP_ELSE]                = &&L_OP_ELSE,
+        [OP_BR_IF]               = &&L_OP_BR_IF,
+        [OP_BR_TABLE]            = &&L_OP_BR_TABLE,
+        [OP_BR]                  = &&L_OP_BR,
+        [OP_RETURN]              = &&L_OP_RETURN,
+        [OP_CALL]                = &&L_OP_CALL,
+        [OP_CALL_INDIRECT]       = &&L_OP_CALL_INDIRECT,
+        [OP_DROP]                = &&L_OP_DROP,
+        [OP_SELECT]              = &&L_OP_SELECT,
+        [OP_SELECT_T]            = &&L_OP_SELECT_T,
+        [OP_LOCAL_GET]           = &&L_OP_LOCAL_GET,
+        [OP_LOCAL_SET]           = &&L_OP_LOCAL_SET,
+        [OP_LOCAL_TEE]           = &&L_OP_LOCAL_TEE,
+        [OP_GLOBAL_GET]          = &&L_OP_GLOBAL_GET,
+        [OP_GLOBAL_SET]          = &&L_OP_GLOBAL_SET,
+        [OP_TABLE_GET]           = &&L_OP_TABLE_GET,
+        [OP_TABLE_SET]           = &&L_OP_TABLE_SET,
+        [OP_I32_LOAD]            = &&L_OP_I32_LOAD,
+        [OP_I64_LOAD]            = &&L_OP_I64_LOAD,
+        [OP_F32_LOAD]            = &&L_OP_F32_LOAD,
+        [OP_F64_LOAD]            = &&L_OP_F64_LOAD,
+        [OP_I32_LOAD8_S]         = &&L_OP_I32_LOAD8_S,
+        [OP_I32_LOAD8_U]         = &&L_OP_I32_LOAD8_U,
+        [OP_I32_LOAD16_S]        = &&L_OP_I32_LOAD16_S,
+        [OP_I32_LOAD16_U]        = &&L_OP_I32_LOAD16_U,
+        [OP_I64_LOAD8_S]         = &&L_OP_I64_LOAD8_S,
+        [OP_I64_LOAD8_U]         = &&L_OP_I64_LOAD8_U,
+        [OP_I64_LOAD16_S]        = &&L_OP_I64_LOAD16_S,
+        [OP_I64_LOAD16_U]        = &&L_OP_I64_LOAD16_U,
+        [OP_I64_LOAD32_S]        = &&L_OP_I64_LOAD32_S,
+        [OP_I64_LOAD32_U]        = &&L_OP_I64_LOAD32_U,
+        [OP_I32_STORE]           = &&L_OP_I32_STORE,
+        [OP_I64_STORE]           = &&L_OP_I64_STORE,
+        [OP_F32_STORE]           = &&L_OP_F32_STORE,
+        [OP_F64_STORE]           = &&L_OP_F64_STORE,
+        [OP_I32_STORE8]          = &&L_OP_I32_STORE8,
+        [OP_I32_STORE16]         = &&L_OP_I32_STORE16,
+        [OP_I64_STORE8]          = &&L_OP_I64_STORE8,
+        [OP_I64_STORE16]         = &&L_OP_I64_STORE16,
+        [OP_I64_STORE32]         = &&L_OP_I64_STORE32,
+        [OP_MEMORY_SIZE]         = &&L_OP_MEMORY_SIZE,
+        [OP_MEMORY_GROW]         = &&L_OP_MEMORY_GROW,
+        [OP_I32_CONST]           = &&L_OP_I32_CONST,
+        [OP_I64_CONST]           = &&L_OP_I64_CONST,
+        [OP_F32_CONST]           = &&L_OP_F32_CONST,
+        [OP_F64_CONST]           = &&L_OP_F64_CONST,
+        [OP_REF_NULL]            = &&L_OP_REF_NULL,
+        [OP_REF_IS_NULL]         = &&L_OP_REF_IS_NULL,
+        [OP_REF_FUNC]            = &&L_OP_REF_FUNC,
+        [OP_MEMORY_INIT]         = &&L_OP_MEMORY_INIT,
+        [OP_DATA_DROP]           = &&L_OP_DATA_DROP,
+        [OP_MEMORY_COPY]         = &&L_OP_MEMORY_COPY,
+        [OP_MEMORY_FILL]         = &&L_OP_MEMORY_FILL,
+        [OP_TABLE_INIT]          = &&L_OP_TABLE_INIT,
+        [OP_ELEM_DROP]           = &&L_OP_ELEM_DROP,
+        [OP_TABLE_COPY]          = &&L_OP_TABLE_COPY,
+        [OP_TABLE_GROW]          = &&L_OP_TABLE_GROW,
+        [OP_TABLE_SIZE]          = &&L_OP_TABLE_SIZE,
+        [OP_TABLE_FILL]          = &&L_OP_TABLE_FILL,
+        [OP_MEMX]                = &&L_OP_MEMX,
+        [OP_R_COPY]              = &&L_OP_R_COPY,
+        [OP_R_CONST32]           = &&L_OP_R_CONST32,
+        [OP_R_CONST64]           = &&L_OP_R_CONST64,
+        [OP_R_SP]                = &&L_OP_R_SP,
+        [OP_R_IF]                = &&L_OP_R_IF,
+        [OP_R_BR_IF]             = &&L_OP_R_BR_IF,
+        [OP_S_LOCAL_LOCAL_I32_ADD] = &&L_OP_S_LOCAL_LOCAL_I32_ADD,
+        [OP_S_LOCAL_CONST_I32_ADD] = &&L_OP_S_LOCAL_CONST_I32_ADD,
+        [OP_S_I32_EQZ_BR_IF]     = &&L_OP_S_I32_EQZ_BR_IF,
+        [OP_S_I32_LT_S_BR_IF]    = &&L_OP_S_I32_LT_S_BR_IF,
+        [OP_S_LOCAL_I32_LOAD]    = &&L_OP_S_LOCAL_I32_LOAD,
+    };
+#endif
 
-                case OP_I32_LOAD:
-                case OP_I64_LOAD:
-                case OP_F32_LOAD:
-                case OP_F64_LOAD:
-                case OP_I32_LOAD8_S:
-                case OP_I32_LOAD8_U:
-                case OP_I32_LOAD16_S:
-                case OP_I32_LOAD16_U:
-                case OP_I64_LOAD8_S:
-                case OP_I64_LOAD8_U:
-                case OP_I64_LOAD16_S:
-                case OP_I64_LOAD16_U:
-                case OP_I64_LOAD32_S:
-                case OP_I64_LOAD32_U: {
-                    memaddr_t a = F->module->memaddrs[0];
-                    meminst_t *mem = VECTOR_ELEM(&S->mems, a);
-
-                    int32_t i;
-                    pop_i32(stack, &i);
-                    eaddr_t ea = (uint32_t)i;
-                    ea += ip->m.offset;
-
-                    int32_t n;
-                    switch(ip->op1) {
-                        case OP_I32_LOAD:
-                        case OP_F32_LOAD:
-                        case OP_I64_LOAD32_S:
-                        case OP_I64_LOAD32_U:
-                            n = 4;
-                            break;
-                        case OP_I64_LOAD:
-                        case OP_F64_LOAD:
-                            n = 8;
-                            break;
-                        case OP_I32_LOAD8_S:
-                        case OP_I32_LOAD8_U:
-                        case OP_I64_LOAD8_S:
-                        case OP_I64_LOAD8_U:
-                            n = 1;
-                            break;
-                        case OP_I32_LOAD16_S:
-                        case OP_I32_LOAD16_U:
-                        case OP_I64_LOAD16_S:
-                        case OP_I64_LOAD16_U:
-                            n = 2;
-                            break;
-                    }
-
-                    if(ea + n > mem->num_pages * WASM_PAGE_SIZE) {
-                        __throw(ERR_TRAP_OUT_OF_BOUNDS_MEMORY_ACCESS);
-                    }
-
-                    // todo: fix this?
-                    uint8_t *paddr = (uint8_t *)eaddr_to_paddr(mem, ea);
-                    val_t val = {.num.i64 = 0};
-
-                    switch(ip->op1) {
-                        case OP_I32_LOAD:
-                            val.num.i32 = *(int32_t *)paddr;
-                            break;
-                        case OP_I32_LOAD8_S:
-                            val.num.i32 = (int32_t)*(int8_t *)paddr;
-                            break;
-                        case OP_I32_LOAD8_U:
-                            val.num.i32 = (int32_t)*(uint8_t *)paddr;
-                            break;
-                        case OP_I32_LOAD16_S:
-                            val.num.i32 = (int32_t)*(int16_t *)paddr;
-                            break;
-                        case OP_I32_LOAD16_U:
-                            val.num.i32 = (int32_t)*(uint16_t *)paddr;
-                            break;
-                        case OP_I64_LOAD:
-                            val.num.i64 = *(int64_t *)paddr;
-                            break;
-                        case OP_I64_LOAD8_S:
-                            val.num.i64 = (int64_t)*(int8_t *)paddr;
-                            break;
-                        case OP_I64_LOAD8_U:
-                            val.num.i64 = (int64_t)*(uint8_t *)paddr;
-                            break;
-                        case OP_I64_LOAD16_S:
-                            val.num.i64 = (int64_t)*(int16_t *)paddr;
-                            break;
-                        case OP_I64_LOAD16_U:
-                            val.num.i64 = (int64_t)*(uint16_t *)paddr;
-                            break;
-                        case OP_I64_LOAD32_S:
-                            val.num.i64 = (int64_t)*(int32_t *)paddr;
-                            break;
-                        case OP_I64_LOAD32_U:
-                            val.num.i64 = (int64_t)*(uint32_t *)paddr;
-                            break;
-                        case OP_F32_LOAD:
-                            val.num.f32 = *(float *)paddr;
-                            break;
-                        case OP_F64_LOAD:
-                            val.num.f64 = *(double *)paddr;
-                            break;
-                    }
-                    __throwiferr(push_val(stack, val));
-                    break;
-                }
+    __try {
+#ifdef DISPATCH_COMPUTED_GOTO
+        NEXT();
+#else
+        for(;;) {
+        ip = pc;
+        switch(*pc++) {
+#endif
+        INSTR(OP_UNREACHABLE) {
+            __throw(ERR_TRAP_UNREACHABLE);
+        }
 
-                case OP_I32_STORE:
-                case OP_I64_STORE:
-                case OP_F32_STORE:
-                case OP_F64_STORE:
-                case OP_I32_STORE8:
-                case OP_I32_STORE16:
-                case OP_I64_STORE8:
-                case OP_I64_STORE16:
-                case OP_I64_STORE32: {
-                    memaddr_t a = F->module->memaddrs[0];
-                    meminst_t *mem = VECTOR_ELEM(&S->mems, a);
-
-                    val_t c;
-                    int32_t i;
-                    pop_val(stack, &c);
-                    pop_i32(stack, &i);
-
-                    uint64_t ea = (uint32_t)i;
-                    ea += ip->m.offset;
-
-                    int32_t n;
-                    switch(ip->op1) {
-                        case OP_I32_STORE:
-                        case OP_F32_STORE:
-                        case OP_I64_STORE32:
-                            n= 4;
-                            break;
-                        case OP_I64_STORE:
-                        case OP_F64_STORE:
-                            n = 8;
-                            break;
-                        case OP_I32_STORE8:
-                        case OP_I64_STORE8:
-                            n = 1;
-                            break;
-                        case OP_I32_STORE16:
-                        case OP_I64_STORE16:
-                            n = 2;
-                            break;
-                    }
-
-                    if(ea + n > mem->num_pages * WASM_PAGE_SIZE) {
-                        __throw(ERR_TRAP_OUT_OF_BOUNDS_MEMORY_ACCESS);
-                    }
-
-                    uint8_t *paddr = (uint8_t *)eaddr_to_paddr(mem, ea);
-
-                    switch(ip->op1) {
-                        case OP_I32_STORE:
-                            *(int32_t *)paddr = c.num.i32;
-                            break;
-                        case OP_I64_STORE:
-                            *(int64_t *)paddr = c.num.i64;
-                            break;
-                        case OP_F32_STORE:
-                            *(float *)paddr = c.num.f32;
-                            break;
-                        case OP_F64_STORE:
-                            *(double *)paddr = c.num.f64;
-                            break;
-                        case OP_I32_STORE8:
-                            *(uint8_t *)paddr = c.num.i32 & 0xff;
-                            break;
-                        case OP_I32_STORE16:
-                            *(uint16_t *)paddr = c.num.i32 & 0xffff;
-                            break;
-                        case OP_I64_STORE8:
-                            *(uint8_t *)paddr = c.num.i64 & 0xff;
-                            break;
-                        case OP_I64_STORE16:
-                            *(uint16_t *)paddr = c.num.i64 & 0xffff;
-                            break;
-                        case OP_I64_STORE32:
-                            *(uint32_t *)paddr = c.num.i64 & 0xffffffff;
-                            break;
-                    }
-                    break;
-                }                
-                
-                case OP_MEMORY_SIZE: {
-                    memaddr_t ma = F->module->memaddrs[0];
-                    meminst_t *mem = VECTOR_ELEM(&S->mems, ma);
-                    __throwiferr(push_i32(stack, mem->num_pages));
-                    break;
-                }
+        INSTR(OP_NOP) {
+            NEXT();
+        }
 
-                case OP_MEMORY_GROW: {
-                    memaddr_t ma = F->module->memaddrs[0];
-                    meminst_t *mem = VECTOR_ELEM(&S->mems, ma);
-
-                    int32_t sz = mem->num_pages;
-                    int32_t n;
-                    pop_i32(stack, &n);
-
-                    if((mem->type.max && n + mem->num_pages > mem->type.max) || \
-                        mem->num_pages + n > NUM_PAGE_MAX) {
-                        __throwiferr(push_i32(stack, -1));
-                    } else {
-                        // grow n page(always success)
-                        mem->num_pages += n;
-                        mem->type.min += n;
-                        __throwiferr(push_i32(stack, sz));
-                    }
-                    break;
-                }
+        INSTR(OP_IF) {
+            // jump to the else arm (or past the end) if the condition is false
+            if(POP_I32() == 0)
+                pc += *pc;
+            else
+                pc++;
+            NEXT();
+        }
 
-                case OP_I32_CONST:
-                    __throwiferr(push_i32(stack, ip->c.i32));
-                    break;
-                
-                case OP_I64_CONST:
-                    __throwiferr(push_i64(stack, ip->c.i64));
-                    break;
-                
-                case OP_F32_CONST:
-                    __throwiferr(push_f32(stack, ip->c.f32));
-                    break;
-                
-                case OP_F64_CONST:
-                    __throwiferr(push_f64(stack, ip->c.f64));
-                    break;
-                
-                case OP_I32_EQZ:
-                    __throwiferr(push_i32(stack, lhs_i32 == 0));
-                    break;
-                                    
-                case OP_I32_EQ:
-                    __throwiferr(push_i32(stack, lhs_i32 == rhs_i32));
-                    break;
-                
-                case OP_I32_NE:
-                    __throwiferr(push_i32(stack, lhs_i32 != rhs_i32));
-                    break;
-                
-                case OP_I32_LT_S:
-                    __throwiferr(push_i32(stack, lhs_i32 < rhs_i32));
-                    break;
-                
-                case OP_I32_LT_U:
-                    __throwiferr(push_i32(stack, (uint32_t)lhs_i32 < (uint32_t)rhs_i32));
-                    break;
-                
-                case OP_I32_GT_S:
-                    __throwiferr(push_i32(stack, lhs_i32 > rhs_i32));
-                    break;
-                
-                case OP_I32_GT_U:
-                    __throwiferr(push_i32(stack, (uint32_t)lhs_i32 > (uint32_t)rhs_i32));
-                    break;
-                
-                case OP_I32_LE_S:
-                    __throwiferr(push_i32(stack, lhs_i32 <= rhs_i32));
-                    break;
-                
-                case OP_I32_LE_U:
-                    __throwiferr(push_i32(stack, (uint32_t)lhs_i32 <= (uint32_t)rhs_i32));
-                    break;
-                
-                case OP_I32_GE_S:
-                    __throwiferr(push_i32(stack, lhs_i32 >= rhs_i32));
-                    break;
-                
-                case OP_I32_GE_U:
-                    __throwiferr(push_i32(stack, (uint32_t)lhs_i32 >= (uint32_t)rhs_i32));
-                    break;
-                
-                case OP_I64_EQZ:
-                    __throwiferr(push_i32(stack, lhs_i64 == 0));
-                    break;
-                                    
-                case OP_I64_EQ:
-                    __throwiferr(push_i32(stack, lhs_i64 == rhs_i64));
-                    break;
-                
-                case OP_I64_NE:
-                    __throwiferr(push_i32(stack, lhs_i64 != rhs_i64));
-                    break;
-                
-                case OP_I64_LT_S:
-                    __throwiferr(push_i32(stack, lhs_i64 < rhs_i64));
-                    break;
-                
-                case OP_I64_LT_U:
-                    __throwiferr(push_i32(stack, (uint64_t)lhs_i64 < (uint64_t)rhs_i64));
-                    break;
-                
-                case OP_I64_GT_S:
-                    __throwiferr(push_i32(stack, lhs_i64 > rhs_i64));
-                    break;
-                
-                case OP_I64_GT_U:
-                    __throwiferr(push_i32(stack, (uint64_t)lhs_i64 > (uint64_t)rhs_i64));
-                    break;
-                
-                case OP_I64_LE_S:
-                    __throwiferr(push_i32(stack, lhs_i64 <= rhs_i64));
-                    break;
-                
-                case OP_I64_LE_U:
-                    __throwiferr(push_i32(stack, (uint64_t)lhs_i64 <= (uint64_t)rhs_i64));
-                    break;
-                
-                case OP_I64_GE_S:
-                    __throwiferr(push_i32(stack, lhs_i64 >= rhs_i64));
-                    break;
-                
-                case OP_I64_GE_U:
-                    __throwiferr(push_i32(stack, (uint64_t)lhs_i64 >= (uint64_t)rhs_i64));
-                    break;
-                
-                case OP_F32_EQ:
-                    __throwiferr(push_i32(stack, lhs_f32 == rhs_f32));
-                    break;
-                
-                case OP_F32_NE:
-                    __throwiferr(push_i32(stack, lhs_f32 != rhs_f32));
-                    break;
-                
-                case OP_F32_LT:
-                    __throwiferr(push_i32(stack, lhs_f32 < rhs_f32));
-                    break;
-                
-                case OP_F32_GT:
-                    __throwiferr(push_i32(stack, lhs_f32 > rhs_f32));
-                    break;
-                
-                case OP_F32_LE:
-                    __throwiferr(push_i32(stack, lhs_f32 <= rhs_f32));
-                    break;
-                
-                case OP_F32_GE:
-                    __throwiferr(push_i32(stack, lhs_f32 >= rhs_f32));
-                    break;
-                
-                case OP_F64_EQ:
-                    __throwiferr(push_i32(stack, lhs_f64 == rhs_f64));
-                    break;
-                
-                case OP_F64_NE:
-                    __throwiferr(push_i32(stack, lhs_f64 != rhs_f64));
-                    break;
-                
-                case OP_F64_LT:
-                    __throwiferr(push_i32(stack, lhs_f64 < rhs_f64));
-                    break;
-                
-                case OP_F64_GT:
-                    __throwiferr(push_i32(stack, lhs_f64 > rhs_f64));
-                    break;
-                
-                case OP_F64_LE:
-                    __throwiferr(push_i32(stack, lhs_f64 <= rhs_f64));
-                    break;
-                
-                case OP_F64_GE:
-                    __throwiferr(push_i32(stack, lhs_f64 >= rhs_f64));
-                    break;
-                
-                case OP_I32_CLZ:
-                    if(lhs_i32 == 0)
-                        __throwiferr(push_i32(stack, 32));
-                    else
-                        __throwiferr(push_i32(stack, __builtin_clz(lhs_i32)));
-                    break;
-                    
-                case OP_I32_CTZ:
-                    __throwiferr(push_i32(stack, __builtin_ctz(lhs_i32)));
-                    break;
-                
-                case OP_I32_POPCNT:
-                    __throwiferr(push_i32(stack, __builtin_popcount(lhs_i32)));
-                    break;
-                
-                case OP_I32_ADD:
-                    __throwiferr(push_i32(stack, lhs_i32 + rhs_i32));
-                    break;
-                
-                case OP_I32_SUB:
-                    __throwiferr(push_i32(stack, lhs_i32 - rhs_i32));
-                    break;
-                
-                case OP_I32_MUL:
-                    __throwiferr(push_i32(stack, lhs_i32 * rhs_i32));
-                    break;
-                
-                case OP_I32_DIV_S:
-                    __throwif(ERR_TRAP_INTERGER_DIVIDE_BY_ZERO, rhs_i32 == 0);
-                    __throwif(ERR_TRAP_INTERGET_OVERFLOW, lhs_i32 == INT32_MIN && rhs_i32 == -1);
-                    __throwiferr(push_i32(stack, lhs_i32 / rhs_i32));
-                    break;
-                
-                case OP_I32_DIV_U:
-                    __throwif(ERR_TRAP_INTERGER_DIVIDE_BY_ZERO, rhs_i32 == 0);
-                    __throwiferr(push_i32(stack, (uint32_t)lhs_i32 / (uint32_t)rhs_i32));
-                    break;
-                
-                case OP_I32_REM_S:
-                    __throwif(ERR_TRAP_INTERGER_DIVIDE_BY_ZERO, rhs_i32 == 0);
-                    if(lhs_i32 == INT32_MIN && rhs_i32 == -1) {
-                        __throwiferr(push_i32(stack, 0));
-                    }
-                    else {
-                        __throwiferr(push_i32(stack, lhs_i32 % rhs_i32));
-                    }
-                    break;
-                
-                case OP_I32_REM_U:
-                    __throwif(ERR_TRAP_INTERGER_DIVIDE_BY_ZERO, rhs_i32 == 0);
-                    __throwiferr(push_i32(stack, (uint32_t)lhs_i32 % (uint32_t)rhs_i32));
-                    break;
-                
-                case OP_I32_AND:
-                    __throwiferr(push_i32(stack, lhs_i32 & rhs_i32));
-                    break;
-                
-                case OP_I32_OR:
-                    __throwiferr(push_i32(stack, lhs_i32 | rhs_i32));
-                    break;
-                
-                case OP_I32_XOR:
-                    __throwiferr(push_i32(stack, lhs_i32 ^ rhs_i32));
-                    break;
-                
-                case OP_I32_SHL:
-                    __throwiferr(push_i32(stack, lhs_i32 << rhs_i32));
-                    break;
-                
-                case OP_I32_SHR_S:
-                    __throwiferr(push_i32(stack, lhs_i32 >> rhs_i32));
-                    break;
-                
-                case OP_I32_SHR_U:
-                    __throwiferr(push_i32(stack, (uint32_t)lhs_i32 >> (uint32_t)rhs_i32));
-                    break;
-                
-                case OP_I32_ROTL: {
-                    uint32_t n = rhs_i32 & 31;
-                    __throwiferr(push_i32(stack, ((uint32_t)lhs_i32 << n) | ((uint32_t)lhs_i32 >> ((-n) & 31))));
-                    break;
-                }
+        // The else instruction ends the then arm, so jump past the end of the if
+        INSTR(OP_ELSE) {
+            pc += *pc;
+            NEXT();
+        }
 
-                case OP_I32_ROTR: {
-                    uint32_t n = rhs_i32 & 31;
-                    __throwiferr(push_i32(stack, ((uint32_t)lhs_i32 >> n) | ((uint32_t)lhs_i32 << ((-n) & 31))));
-                    break;
-                }
+        INSTR(OP_BR_IF) {
+            if(POP_I32() == 0) {
+                pc += 3;
+                NEXT();
+            }
+            goto __br;
+        }
 
-                case OP_I64_CLZ:
-                    if(lhs_i64 == 0)
-                        __throwiferr(push_i64(stack, 64));
-                    else
-                        __throwiferr(push_i64(stack, __builtin_clzl(lhs_i64)));
-                    break;
-                    
-                case OP_I64_CTZ:
-                    __throwiferr(push_i64(stack, __builtin_ctzl(lhs_i64)));
-                    break;
-                
-                case OP_I64_POPCNT:
-                    __throwiferr(push_i64(stack, __builtin_popcountl(lhs_i64)));
-                    break;
-                
-                case OP_I64_ADD:
-                    __throwiferr(push_i64(stack, lhs_i64 + rhs_i64));
-                    break;
-                
-                case OP_I64_SUB:
-                    __throwiferr(push_i64(stack, lhs_i64 - rhs_i64));
-                    break;
-                
-                case OP_I64_MUL:
-                    __throwiferr(push_i64(stack, lhs_i64 * rhs_i64));
-                    break;
-                
-                case OP_I64_DIV_S:
-                    __throwif(ERR_TRAP_INTERGER_DIVIDE_BY_ZERO, rhs_i64 == 0);
-                    __throwif(ERR_TRAP_INTERGET_OVERFLOW, lhs_i64 == INT64_MIN && rhs_i64 == -1);
-                    __throwiferr(push_i64(stack, lhs_i64 / rhs_i64));
-                    break;
-                
-                case OP_I64_DIV_U:
-                    __throwif(ERR_TRAP_INTERGER_DIVIDE_BY_ZERO, rhs_i64 == 0);
-                    __throwiferr(push_i64(stack, (uint64_t)lhs_i64 / (uint64_t)rhs_i64));
-                    break;
-                
-                case OP_I64_REM_S:
-                    __throwif(ERR_TRAP_INTERGER_DIVIDE_BY_ZERO, rhs_i64 == 0);
-                    if(lhs_i64 == INT64_MIN && rhs_i64 == -1) {
-                        __throwiferr(push_i64(stack, 0));
-                    }
-                    else {
-                        __throwiferr(push_i64(stack, lhs_i64 % rhs_i64));
-                    }
-                    break;
-                
-                case OP_I64_REM_U:
-                    __throwif(ERR_TRAP_INTERGER_DIVIDE_BY_ZERO, rhs_i64 == 0);
-                    __throwiferr(push_i64(stack, (uint64_t)lhs_i64 % (uint64_t)rhs_i64));
-                    break;
-                
-                case OP_I64_AND:
-                    __throwiferr(push_i64(stack, lhs_i64 & rhs_i64));
-                    break;
-                
-                case OP_I64_OR:
-                    __throwiferr(push_i64(stack, lhs_i64 | rhs_i64));
-                    break;
-                
-                case OP_I64_XOR:
-                    __throwiferr(push_i64(stack, lhs_i64 ^ rhs_i64));
-                    break;
-                
-                case OP_I64_SHL:
-                    __throwiferr(push_i64(stack, lhs_i64 << rhs_i64));
-                    break;
-                
-                case OP_I64_SHR_S:
-                    __throwiferr(push_i64(stack, lhs_i64 >> rhs_i64));
-                    break;
-                
-                case OP_I64_SHR_U:
-                    __throwiferr(push_i64(stack, (uint64_t)lhs_i64 >> (uint64_t)rhs_i64));
-                    break;
-                
-                case OP_I64_ROTL: {
-                    uint64_t n = rhs_i64 & 63;
-                    __throwiferr(push_i64( stack, ((uint64_t)lhs_i64 << n) | ((uint64_t)lhs_i64 >> ((-n) & 63))));
-                    break;
-                }
+        INSTR(OP_BR_TABLE) {
+            uint32_t c = POP_I32();
+            uint32_t n = *pc++;
+            pc += 3 * (c < n ? c : n);
+            goto __br;
+        }
 
-                case OP_I64_ROTR: {
-                    uint64_t n = rhs_i64 & 63;
-                    __throwiferr(push_i64(stack, ((uint64_t)lhs_i64 >> n) | ((uint64_t)lhs_i64 << ((-n) & 63))));
-                    break;
-                }
+        // pc points to "target height arity" of the branch.
+        // Keep the top arity values at height and discard everything above them.
+        INSTR(OP_BR) {
+        __br:
+            uint32_t height = pc[1];
+            uint32_t arity  = pc[2];
+            // loop back-edges count towards tier-up like calls
+            if((int32_t)pc[0] < 0)
+                count_hot(S, F->funcinst);
+            memmove(
+                &stack->pool[base + height],
+                &stack->pool[stack->idx + 1 - arity],
+                sizeof(val_t) * arity
+            );
+            stack->idx = base + height + arity - 1;
+            pc += (int32_t)pc[0];
+            NEXT();
+        }
 
-                case OP_F32_ABS:
-                    __throwiferr(push_f32(stack, fabsf(lhs_f32)));
-                    break;
+        // ref: https://webassembly.github.io/spec/core/exec/instructions.html#returning-from-a-function
+        INSTR(OP_RETURN) {
+            goto __catch;
+        }
 
-                case OP_F32_NEG:
-                    __throwiferr(push_f32(stack, -lhs_f32));
-                    break;
-                
-                case OP_F32_CEIL:
-                    __throwiferr(push_f32(stack, ceilf(lhs_f32)));
-                    break;
+        INSTR(OP_CALL) {
+            // invoke func
+            __throwiferr(invoke_func(S, F->module->funcaddrs[*pc++]));
+            NEXT();
+        }
 
-                case OP_F32_FLOOR:
-                    __throwiferr(push_f32(stack, floorf(lhs_f32)));
-                    break;
+        INSTR(OP_CALL_INDIRECT) {
+            uint32_t typeidx = *pc++;
+            uint32_t tableidx = *pc++;
+            __throwiferr(call_indirect(S, F->module, typeidx, tableidx, POP_I32()));
+            NEXT();
+        }
 
-                case OP_F32_TRUNC:
-                    __throwiferr(push_f32(stack, truncf(lhs_f32)));
-                    break;
-                
-                case OP_F32_NEAREST:
-                    __throwiferr(push_f32(stack, nearbyintf(lhs_f32)));
-                    break;
-                
-                case OP_F32_SQRT:
-                    __throwiferr(push_f32(stack, sqrtf(lhs_f32)));
-                    break;
-                
-                case OP_F32_ADD:
-                    __throwiferr(push_f32(stack, lhs_f32 + rhs_f32));
-                    break;
-                
-                case OP_F32_SUB:
-                    __throwiferr(push_f32(stack, lhs_f32 - rhs_f32));
-                    break;
-                
-                case OP_F32_MUL:
-                    __throwiferr(push_f32(stack, lhs_f32 * rhs_f32));
-                    break;
-                
-                case OP_F32_DIV:
-                    __throwiferr(push_f32(stack, lhs_f32 / rhs_f32));
-                    break;
-                
-                case OP_F32_MIN:
-                    if(isnan(lhs_f32) || isnan(rhs_f32))
-                        __throwiferr(push_f32(stack, NAN));
-                    else if(lhs_f32 == 0 && rhs_f32 == 0)
-                        __throwiferr(push_f32(stack, signbit(lhs_f32) ? lhs_f32 : rhs_f32));
-                    else 
-                        __throwiferr(push_f32(stack, lhs_f32 < rhs_f32 ? lhs_f32 : rhs_f32));
-                    break;
-                
-                case OP_F32_MAX:
-                    if(isnan(lhs_f32) || isnan(rhs_f32))
-                        __throwiferr(push_f32(stack, NAN));
-                    else if(lhs_f32 == 0 && rhs_f32 == 0)
-                        __throwiferr(push_f32(stack, signbit(lhs_f32) ? rhs_f32 : lhs_f32));
-                    else
-                        __throwiferr(push_f32(stack, lhs_f32 > rhs_f32 ? lhs_f32 : rhs_f32));
-                    break;
-                
-                case OP_F32_COPYSIGN:
-                    __throwiferr(push_f32(stack, copysignf(lhs_f32, rhs_f32)));
-                    break;
-                
-                case OP_F64_ABS:
-                    __throwiferr(push_f64(stack, fabs(lhs_f64)));
-                    break;
-                
-                case OP_F64_NEG:
-                    __throwiferr(push_f64(stack, -lhs_f64));
-                    break;
-                
-                case OP_F64_CEIL:
-                    __throwiferr(push_f64(stack, ceil(lhs_f64)));
-                    break;
-                
-                case OP_F64_FLOOR:
-                    __throwiferr(push_f64(stack, floor(lhs_f64)));
-                    break;
-                
-                case OP_F64_TRUNC:
-                    __throwiferr(push_f64(stack, trunc(lhs_f64)));
-                    break;
-                
-                case OP_F64_NEAREST:
-                    __throwiferr(push_f64(stack, nearbyint(lhs_f64)));
-                    break;
-                
-                case OP_F64_SQRT:
-                    __throwiferr(push_f64(stack, sqrt(lhs_f64)));
-                    break;
-                
-                case OP_F64_ADD:
-                    __throwiferr(push_f64(stack, lhs_f64 + rhs_f64));
-                    break;
-                
-                case OP_F64_SUB:
-                    __throwiferr(push_f64(stack, lhs_f64 - rhs_f64));
-                    break;
-                
-                case OP_F64_MUL:
-                    __throwiferr(push_f64(stack, lhs_f64 * rhs_f64));
-                    break;
-                
-                case OP_F64_DIV:
-                    __throwiferr(push_f64(stack, lhs_f64 / rhs_f64));
-                    break;
-                
-                case OP_F64_MIN:
-                    if(isnan(lhs_f64) || isnan(rhs_f64))
-                        __throwiferr(push_f64(stack, NAN));
-                    else if(lhs_f64 == 0 && rhs_f64 == 0)
-                        __throwiferr(push_f64(stack, signbit(lhs_f64) ? lhs_f64 : rhs_f64));
-                    else
-                        __throwiferr(push_f64(stack, lhs_f64 < rhs_f64 ? lhs_f64 : rhs_f64));
-                    break;
-                
-                case OP_F64_MAX:
-                    if(isnan(lhs_f64) || isnan(rhs_f64))
-                        __throwiferr(push_f64(stack, NAN));
-                    else if(lhs_f64 == 0 && rhs_f64 == 0)
-                        __throwiferr(push_f64(stack, signbit(lhs_f64) ? rhs_f64 : lhs_f64));
-                    else
-                        __throwiferr(push_f64(stack, lhs_f64 > rhs_f64 ? lhs_f64 : rhs_f64));
-                    break;
-                
-                case OP_F64_COPYSIGN:
-                    __throwiferr(push_f64(stack, copysign(lhs_f64, rhs_f64)));
-                    break;
-                
-                case OP_I32_WRAP_I64:
-                    __throwiferr(push_i32(stack, lhs_i64 & 0xffffffff));
-                    break;
+        INSTR(OP_DROP) {
+            stack->idx--;
+            NEXT();
+        }
+
+        INSTR(OP_SELECT)
+        INSTR(OP_SELECT_T) {
+            int32_t c = POP_I32();
+            val_t v2 = POP_VAL();
+            val_t v1 = POP_VAL();
+            PUSH_VAL(c != 0 ? v1 : v2);
+            NEXT();
+        }
+
+        INSTR(OP_LOCAL_GET) {
+            PUSH_VAL(F->locals[*pc++]);
+            NEXT();
+        }
+
+        INSTR(OP_LOCAL_SET) {
+            F->locals[*pc++] = POP_VAL();
+            NEXT();
+        }
+
+        INSTR(OP_LOCAL_TEE) {
+            val_t val = POP_VAL();
+            PUSH_VAL(val);
+            F->locals[*pc++] = val;
+            NEXT();
+        }
 
-                case OP_I32_TRUNC_F32_S: {
-                    __throwiferr(push_i32(stack, I32_TRUNC_F32(lhs_f32)));
-                    break;
-                }
-                
-                case OP_I32_TRUNC_F32_U:
-                    __throwiferr(push_i32(stack, U32_TRUNC_F32(lhs_f32)));
-                    break;
-                
-                case OP_I32_TRUNC_F64_S:
-                    __throwiferr(push_i32(stack, I32_TRUNC_F64(lhs_f64)));
-                    break;
-                
-                case OP_I32_TRUNC_F64_U:
-                    __throwiferr(push_i32(stack, U32_TRUNC_F64(lhs_f64)));
-                    break;
-                
-                case OP_I64_EXTEND_I32_S:
-                    __throwiferr(push_i64(stack, (int64_t)(int32_t)lhs_i32));
-                    break;
-                
-                case OP_I64_EXTEND_I32_U:
-                    __throwiferr(push_i64(stack, (int64_t)(uint32_t)lhs_i32));
-                    break;
+        INSTR(OP_GLOBAL_GET) {
+            globaladdr_t a = F->module->globaladdrs[*pc++];
+            globalinst_t *glob = VECTOR_ELEM(&S->globals, a);
+            PUSH_VAL(glob->val);
+            NEXT();
+        }
 
-                case OP_I64_TRUNC_F32_S:
-                    __throwiferr(push_i64(stack, I64_TRUNC_F32(lhs_f32)));
-                    break;
-                
-                case OP_I64_TRUNC_F32_U:
-                    __throwiferr(push_i64(stack, U64_TRUNC_F32(lhs_f32)));
-                    break;
-                
-                case OP_I64_TRUNC_F64_S:
-                    __throwiferr(push_i64(stack, I64_TRUNC_F64(lhs_f64)));
-                    break;
-                
-                case OP_I64_TRUNC_F64_U:
-                    __throwiferr(push_i64(stack, U64_TRUNC_F64(lhs_f64)));
-                    break;
-                
-                case OP_F32_CONVERT_I32_S:
-                    __throwiferr(push_f32(stack, (float)lhs_i32));
-                    break;
-                
-                case OP_F32_CONVERT_I32_U:
-                    __throwiferr(push_f32(stack, (float)(uint32_t)lhs_i32));
-                    break;
+        INSTR(OP_GLOBAL_SET) {
+            globaladdr_t a = F->module->globaladdrs[*pc++];
+            globalinst_t *glob = VECTOR_ELEM(&S->globals, a);
+            glob->val = POP_VAL();
+            NEXT();
+        }
 
-                case OP_F32_CONVERT_I64_S:
-                    __throwiferr(push_f32(stack, (float)lhs_i64));
-                    break;
-                
-                case OP_F32_CONVERT_I64_U:
-                    __throwiferr(push_f32(stack, (float)(uint64_t)lhs_i64));
-                    break;
-                
-                case OP_F32_DEMOTE_F64:
-                    __throwiferr(push_f32(stack, (float)lhs_f64));
-                    break;
-                
-                case OP_F64_CONVERT_I32_S:
-                    __throwiferr(push_f64(stack, (double)lhs_i32));
-                    break;
+        INSTR(OP_TABLE_GET) {
+            tableaddr_t a = F->module->tableaddrs[*pc++];
+            tableinst_t *tab = VECTOR_ELEM(&S->tables, a);
+            uint32_t i = POP_I32();
+            __throwif(ERR_TRAP_OUT_OF_BOUNDS_TABLE_ACCESS, !(i < tab->elem.len));
+            PUSH_VAL((val_t){.ref = *VECTOR_ELEM(&tab->elem, i)});
+            NEXT();
+        }
 
-                case OP_F64_CONVERT_I32_U:
-                    __throwiferr(push_f64(stack, (double)(uint32_t)lhs_i32));
-                    break;
+        INSTR(OP_TABLE_SET) {
+            tableaddr_t a = F->module->tableaddrs[*pc++];
+            tableinst_t *tab = VECTOR_ELEM(&S->tables, a);
+            val_t val = POP_VAL();
+            uint32_t i = POP_I32();
+            __throwif(ERR_TRAP_OUT_OF_BOUNDS_TABLE_ACCESS, !(i < tab->elem.len));
+            *VECTOR_ELEM(&tab->elem, i) = val.ref;
+            NEXT();
+        }
 
-                case OP_F64_CONVERT_I64_S:
-                    __throwiferr(push_f64(stack, (double)lhs_i64));
-                    break;
+        LOAD(OP_I32_LOAD,       I32, int32_t)
+        LOAD(OP_I64_LOAD,       I64, int64_t)
+        LOAD(OP_F32_LOAD,       I32, int32_t)
+        LOAD(OP_F64_LOAD,       I64, int64_t)
+        LOAD(OP_I32_LOAD8_S,    I32, int8_t)
+        LOAD(OP_I32_LOAD8_U,    I32, uint8_t)
+        LOAD(OP_I32_LOAD16_S,   I32, int16_t)
+        LOAD(OP_I32_LOAD16_U,   I32, uint16_t)
+        LOAD(OP_I64_LOAD8_S,    I64, int8_t)
+        LOAD(OP_I64_LOAD8_U,    I64, uint8_t)
+        LOAD(OP_I64_LOAD16_S,   I64, int16_t)
+        LOAD(OP_I64_LOAD16_U,   I64, uint16_t)
+        LOAD(OP_I64_LOAD32_S,   I64, int32_t)
+        LOAD(OP_I64_LOAD32_U,   I64, uint32_t)
+
+        STORE(OP_I32_STORE,     I32, int32_t)
+        STORE(OP_I64_STORE,     I64, int64_t)
+        STORE(OP_F32_STORE,     I32, int32_t)
+        STORE(OP_F64_STORE,     I64, int64_t)
+        STORE(OP_I32_STORE8,    I32, uint8_t)
+        STORE(OP_I32_STORE16,   I32, uint16_t)
+        STORE(OP_I64_STORE8,    I64, uint8_t)
+        STORE(OP_I64_STORE16,   I64, uint16_t)
+        STORE(OP_I64_STORE32,   I64, uint32_t)
+
+        INSTR(OP_MEMORY_SIZE) {
+            memaddr_t ma = F->module->memaddrs[0];
+            meminst_t *mem = VECTOR_ELEM(&S->mems, ma);
+            PUSH_I32(mem->num_pages);
+            NEXT();
+        }
 
-                case OP_F64_CONVERT_I64_U:
-                    __throwiferr(push_f64(stack, (double)(uint64_t)lhs_i64));
-                    break;
-                
-                case OP_F64_PROMOTE_F32:
-                    __throwiferr(push_f64(stack, (double)lhs_f32));
-                    break;
-                
-                // todo: fix this
-                case OP_I32_REINTERPRET_F32: {
-                    num_t num = {.f32 = lhs_f32};
-                    __throwiferr(push_i32(stack, num.i32));
-                    break;
-                }
+        INSTR(OP_MEMORY_GROW) {
+            memaddr_t ma = F->module->memaddrs[0];
+            meminst_t *mem = VECTOR_ELEM(&S->mems, ma);
+            PUSH_I32(memory_grow(mem, (uint32_t)POP_I32()));
+            NEXT();
+        }
 
-                case OP_I64_REINTERPRET_F64: {
-                    num_t num = {.f64 = lhs_f64};
-                    __throwiferr(push_i64(stack, num.i64));
+        // memory instructions on other memories, see compile_instr
+        INSTR(OP_MEMX) {
+            meminst_t *mem = VECTOR_ELEM(&S->mems, F->module->memaddrs[*pc++]);
+            switch(*pc++) {
+                LOADX(OP_I32_LOAD,      I32, int32_t)
+                LOADX(OP_I64_LOAD,      I64, int64_t)
+                LOADX(OP_F32_LOAD,      I32, int32_t)
+                LOADX(OP_F64_LOAD,      I64, int64_t)
+                LOADX(OP_I32_LOAD8_S,   I32, int8_t)
+                LOADX(OP_I32_LOAD8_U,   I32, uint8_t)
+                LOADX(OP_I32_LOAD16_S,  I32, int16_t)
+                LOADX(OP_I32_LOAD16_U,  I32, uint16_t)
+                LOADX(OP_I64_LOAD8_S,   I64, int8_t)
+                LOADX(OP_I64_LOAD8_U,   I64, uint8_t)
+                LOADX(OP_I64_LOAD16_S,  I64, int16_t)
+                LOADX(OP_I64_LOAD16_U,  I64, uint16_t)
+                LOADX(OP_I64_LOAD32_S,  I64, int32_t)
+                LOADX(OP_I64_LOAD32_U,  I64, uint32_t)
+
+                STOREX(OP_I32_STORE,    I32, int32_t)
+                STOREX(OP_I64_STORE,    I64, int64_t)
+                STOREX(OP_F32_STORE,    I32, int32_t)
+                STOREX(OP_F64_STORE,    I64, int64_t)
+                STOREX(OP_I32_STORE8,   I32, uint8_t)
+                STOREX(OP_I32_STORE16,  I32, uint16_t)
+                STOREX(OP_I64_STORE8,   I64, uint8_t)
+                STOREX(OP_I64_STORE16,  I64, uint16_t)
+                STOREX(OP_I64_STORE32,  I64, uint32_t)
+
+                case OP_MEMORY_SIZE:
+                    PUSH_ADDR(mem, mem->num_pages);
                     break;
-                }
-                
-                case OP_F32_REINTERPRET_I32: {
-                    num_t num = {.i32 = lhs_i32};
-                    __throwiferr(push_f32(stack, num.f32));
+
+                case OP_MEMORY_GROW: {
+                    uint64_t n = POP_ADDR(mem);
+                    PUSH_ADDR(mem, memory_grow(mem, n));
                     break;
                 }
 
-                case OP_F64_REINTERPRET_I64: {
-                    num_t num = {.i64 = lhs_i64};
-                    __throwiferr(push_f64(stack, num.f64));
+                case OP_MEMORY_INIT: {
+                    datainst_t *data = VECTOR_ELEM(&S->datas, F->module->dataaddrs[*pc++]);
+                    uint32_t n = POP_I32();
+                    uint32_t s = POP_I32();
+                    uint64_t d = POP_ADDR(mem);
+                    __throwiferr(memory_init(mem, data, d, s, n));
                     break;
                 }
 
-                case OP_I32_EXTEND8_S:
-                    __throwiferr(push_i32(stack, (int32_t)(int8_t)lhs_i32));
-                    break;
-                
-                case OP_I32_EXTEND16_S: 
-                    __throwiferr(push_i32(stack, (int32_t)(int16_t)lhs_i32));
-                    break;
-                
-                case OP_I64_EXTEND8_S:
-                    __throwiferr(push_i64(stack, (int64_t)(int8_t)lhs_i64));
-                    break;
-                
-                case OP_I64_EXTEND16_S: 
-                    __throwiferr(push_i64(stack, (int64_t)(int16_t)lhs_i64));
-                    break;
-                
-                case OP_I64_EXTEND32_S: 
-                    __throwiferr(push_i64(stack, (int64_t)(int32_t)lhs_i64));
-                    break;
-                
-                case OP_REF_NULL:
-                    __throwiferr(push_val(stack, (val_t){.ref = REF_NULL}));
-                    break;
-                
-                case OP_REF_IS_NULL: {
-                    val_t val;
-                    pop_val(stack, &val);
-                    __throwiferr(push_i32(stack, val.ref == REF_NULL));
+                // mem is the destination
+                case OP_MEMORY_COPY: {
+                    meminst_t *src = VECTOR_ELEM(&S->mems, F->module->memaddrs[*pc++]);
+                    uint64_t n = mem->type.is64 && src->type.is64 ? (uint64_t)POP_I64() : (uint32_t)POP_I32();
+                    uint64_t s = POP_ADDR(src);
+                    uint64_t d = POP_ADDR(mem);
+                    __throwiferr(memory_copy(mem, src, d, s, n));
                     break;
                 }
-                
-                case OP_0XFC:
-                    switch(ip->op2) {
-                        case 0x00:
-                            __throwiferr(push_i32(stack, I32_TRUNC_SAT_F32(lhs_f32)));
-                            break;
-
-                        case 0x01:
-                            __throwiferr(push_i32(stack, U32_TRUNC_SAT_F32(lhs_f32)));
-                            break;
-                        
-                        case 0x02:
-                            __throwiferr(push_i32(stack, I32_TRUNC_SAT_F64(lhs_f64)));
-                            break;
-
-                        case 0x03:
-                            __throwiferr(push_i32(stack, U32_TRUNC_SAT_F64(lhs_f64)));
-                            break;
-                        
-                        case 0x04:
-                            __throwiferr(push_i64(stack, I64_TRUNC_SAT_F32(lhs_f32)));
-                            break;
-                        
-                        case 0x05:
-                            __throwiferr(push_i64(stack, U64_TRUNC_SAT_F32(lhs_f32)));
-                            break;
-
-                        case 0x06:
-                            __throwiferr(push_i64(stack, I64_TRUNC_SAT_F64(lhs_f64)));
-                            break;
-
-                        case 0x07:
-                            __throwiferr(push_i64(stack, U64_TRUNC_SAT_F64(lhs_f64)));
-                            break;
-                        
-                        // mememory.init
-                        case 0x08: {
-                            memaddr_t ma = F->module->memaddrs[0];
-                            meminst_t *mem = VECTOR_ELEM(&S->mems, ma);
-                            dataaddr_t da = F->module->dataaddrs[ip->x];
-                            datainst_t *data = VECTOR_ELEM(&S->datas, da);
-
-                            int32_t n, s, d;
-                            pop_i32(stack, &n);
-                            pop_i32(stack, &s);
-                            pop_i32(stack, &d);
-
-                            uint64_t ea1 = (uint32_t)s, ea2 = (uint32_t)d;
-                            ea1 += (uint32_t)n;
-                            ea2 += (uint32_t)n;
-                            __throwif(ERR_TRAP_OUT_OF_BOUNDS_MEMORY_ACCESS, ea1 > data->data.len || ea2 > mem->num_pages * WASM_PAGE_SIZE);
-                            
-                            while(n--) {
-                                byte_t b = *VECTOR_ELEM(&data->data, s);
-                                
-                                __throwiferr(push_i32(stack, d));
-                                __throwiferr(push_i32(stack, (int32_t)b));
-
-                                instr_t i32_store8 = {
-                                    .op1 = OP_I32_STORE8, .next = NULL, 
-                                    .m = (memarg_t){.offset = 0, .align = 0}
-                                };
-                                expr_t expr = &i32_store8;
-                                __throwiferr(exec_expr(S, &expr));
-                                s++;
-                                d++;
-                            }
-                            break;
-                        }
-
-                        // data.drop
-                        case 0x09: {
-                            dataaddr_t a = F->module->dataaddrs[ip->x];
-                            datainst_t *data = VECTOR_ELEM(&S->datas, a);
-                            VECTOR_INIT(&data->data);
-                            break;
-                        }
-
-                        // memory.copy
-                        case 0x0A: {
-                            memaddr_t ma = F->module->memaddrs[0];
-                            meminst_t *mem = VECTOR_ELEM(&S->mems, ma);
-                            int32_t n, s, d;
-                            pop_i32(stack, &n);
-                            pop_i32(stack, &s);
-                            pop_i32(stack, &d);
-                            
-                            uint64_t ea1 = (uint32_t)s, ea2 = (uint32_t)d;
-                            ea1 += (uint32_t)n;
-                            ea2 += (uint32_t)n;
-                            __throwif(
-                                ERR_TRAP_OUT_OF_BOUNDS_MEMORY_ACCESS, 
-                                ea1 > mem->num_pages * WASM_PAGE_SIZE || \
-                                ea2 > mem->num_pages * WASM_PAGE_SIZE
-                            );
-                            instr_t i32_store8 = {
-                                .op1 = OP_I32_STORE8, .next = NULL, 
-                                .m = (memarg_t){.offset = 0, .align = 0}
-                            };
-                            instr_t i32_load8_u = {
-                                .op1 = OP_I32_LOAD8_U, .next = &i32_store8, 
-                                .m = (memarg_t){.offset = 0, .align = 0}
-                            }; 
-                            expr_t expr = &i32_load8_u;
-                            
-                            while(1) {
-                                if(n == 0)
-                                    break;
-                                
-                                if(d <= s) {
-                                    __throwiferr(push_i32(stack, d));
-                                    __throwiferr(push_i32(stack, s));
-                                    exec_expr(S, &expr);
-                                    d++;
-                                    s++;
-                                }
-                                else {
-                                    __throwiferr(push_i32(stack, d + n - 1));
-                                    __throwiferr(push_i32(stack, s + n - 1));
-                                    exec_expr(S, &expr);
-                                }
-                                n--;
-                            }
-                            break;
-                        }
-
-                        // memory.fill
-                        case 0x0B: {
-                            memaddr_t ma = F->module->memaddrs[0];
-                            meminst_t *mem = VECTOR_ELEM(&S->mems, ma);
-                            int32_t n, val, d;
-                            pop_i32(stack, &n);
-                            pop_i32(stack, &val);
-                            pop_i32(stack, &d);
-                            uint64_t ea = (uint32_t)d;
-                            ea += (uint32_t)n;
-
-                            __throwif(ERR_TRAP_OUT_OF_BOUNDS_MEMORY_ACCESS, ea > mem->num_pages * WASM_PAGE_SIZE);
-
-                            while(n--) {
-                                __throwiferr(push_i32(stack, d));
-                                __throwiferr(push_i32(stack, val));
-
-                                instr_t i32_store8 = {
-                                    .op1 = OP_I32_STORE8, .next = NULL, 
-                                    .m = (memarg_t){.offset = 0, .align = 0}
-                                };
-                                expr_t expr = &i32_store8;
-                                exec_expr(S, &expr);
-                                d++;
-                            }
-                            break;
-                        }
-
-                        // table.init
-                        case 0x0C: {
-                            while(1) {
-                                tableaddr_t ta = F->module->tableaddrs[ip->x];
-                                tableinst_t *tab = VECTOR_ELEM(&S->tables, ta);
-                                elemaddr_t ea = F->module->elemaddrs[ip->y];
-                                eleminst_t *elem = VECTOR_ELEM(&S->elems, ea);
-                                int32_t n, s, d;
-                                pop_i32(stack, &n);
-                                pop_i32(stack, &s);
-                                pop_i32(stack, &d);
-
-                                uint64_t idx1 = (uint32_t)s, idx2 = (uint32_t)d;
-                                idx1 += (uint32_t)n;
-                                idx2 += (uint32_t)n;
-                                
-                                __throwif(
-                                    ERR_TRAP_OUT_OF_BOUNDS_TABLE_ACCESS, 
-                                    idx1 > elem->elem.len || idx2 > tab->elem.len
-                                );
-
-                                if(n == 0)
-                                    break;
-                                
-                                ref_t *ref = VECTOR_ELEM(&elem->elem, s);
-                                __throwiferr(push_i32(stack, d));
-                                __throwiferr(push_val(stack, (val_t){.ref = *ref}));
-                                instr_t table_set = {
-                                    .op1 = OP_TABLE_SET, .next = NULL, 
-                                    .x = ip->x
-                                };
-                                expr_t expr = &table_set;
-                                exec_expr(S, &expr);
-                                push_i32(stack, d + 1);
-                                push_i32(stack, s + 1);
-                                push_i32(stack, n - 1);
-                            }
-                            break;
-                        }
-
-                        // elem.drop
-                        case 0x0D: {
-                            elemaddr_t a = F->module->elemaddrs[ip->x];
-                            eleminst_t *elem = VECTOR_ELEM(&S->elems, a);
-                            VECTOR_INIT(&elem->elem);
-                            break;
-                        }
-
-                        // table.copy
-                        case 0x0E: {
-                            while(1) {
-                                tableaddr_t ta_x = F->module->tableaddrs[ip->x];
-                                tableinst_t *tab_x = VECTOR_ELEM(&S->tables, ta_x);
-                                tableaddr_t ta_y = F->module->tableaddrs[ip->y];
-                                tableinst_t *tab_y = VECTOR_ELEM(&S->tables, ta_y);
-
-                                int32_t n, s, d;
-                                pop_i32(stack, &n);
-                                pop_i32(stack, &s);
-                                pop_i32(stack, &d);
-
-                                uint64_t idx1 = (uint32_t)s, idx2 = (uint32_t)d;
-                                idx1 += (uint32_t)n;
-                                idx2 += (uint32_t)n;
-
-                                __throwif(
-                                    ERR_TRAP_OUT_OF_BOUNDS_TABLE_ACCESS, 
-                                    idx1 > tab_y->elem.len || idx2 > tab_x->elem.len
-                                );
-
-                                instr_t table_set = {
-                                    .op1 = OP_TABLE_SET, .x = ip->x, .next = NULL
-                                };
-                                instr_t table_get = {
-                                    .op1 = OP_TABLE_GET, .x = ip->y, .next = &table_set
-                                };
-                                expr_t expr = &table_get;
-
-                                if(n == 0)
-                                    break;
-                                
-                                if(d <= s) {
-                                    __throwiferr(push_i32(stack, d));
-                                    __throwiferr(push_i32(stack, s));
-                                    exec_expr(S, &expr);
-                                    __throwiferr(push_i32(stack, d + 1));
-                                    __throwiferr(push_i32(stack, s + 1));
-                                }
-                                else {
-                                    __throwiferr(push_i32(stack, d + n - 1));
-                                    __throwiferr(push_i32(stack, s + n - 1));
-                                    exec_expr(S, &expr);
-                                    __throwiferr(push_i32(stack, d));
-                                    __throwiferr(push_i32(stack, s));
-                                }
-                                push_i32(stack, n - 1);
-                            }
-                            break;
-                        }
-
-                        // table.grow
-                        case 0x0F: {
-                            tableaddr_t ta = F->module->tableaddrs[ip->x];
-                            tableinst_t *tab = VECTOR_ELEM(&S->tables, ta);
-                            int32_t sz = tab->elem.len;
-                            int32_t n;
-                            val_t val;
-                            pop_i32(stack, &n);
-                            pop_val(stack, &val);
-
-                            if(tab->type.limits.max && n + tab->elem.len > tab->type.limits.max) {
-                                __throwiferr(push_i32(stack, -1));
-                                break;
-                            }
-
-                            if(!IS_ERROR(VECTOR_GROW(&tab->elem, n))) {
-                                tab->elem.len += n;
-                                // init
-                                for(int i = sz; i < tab->elem.len; i++) {
-                                    *VECTOR_ELEM(&tab->elem, i) = val.ref;
-                                }
-                                __throwiferr(push_i32(stack, sz));
-                            }
-                            else {
-                                __throwiferr(push_i32(stack, -1));
-                            }
-                            break;
-                        }
-
-                        // table.size
-                        case 0x10: {
-                            tableaddr_t ta = F->module->tableaddrs[ip->x];
-                            tableinst_t *tab = VECTOR_ELEM(&S->tables, ta);
-                            __throwiferr(push_i32(stack, tab->elem.len));
-                            break;
-                        }
-
-                        // table.fill
-                        case 0x11: {
-                            tableaddr_t ta = F->module->tableaddrs[ip->x];
-                            tableinst_t *tab = VECTOR_ELEM(&S->tables, ta);
-                            int32_t n, i;
-                            val_t val;
-
-                            pop_i32(stack, &n);
-                            pop_val(stack, &val);
-                            pop_i32(stack, &i);
-
-                            while(1) {
-                                __throwif(ERR_TRAP_OUT_OF_BOUNDS_TABLE_ACCESS, i + n > tab->elem.len);
-
-                                if(n == 0)
-                                    break;
-                                
-                                // table.set
-                                *VECTOR_ELEM(&tab->elem, i) = val.ref;
-                                i++;
-                                n--;
-                            }
-                            break;
-                        }
-                        
-                        default:
-                            PANIC("Exec: unsupported opcode: 0xfc %x", ip->op2);           
-                    }
-                    break;
-                
-                case OP_REF_FUNC: {
-                    funcaddr_t a = F->module->funcaddrs[ip->x];
-                    __throwiferr(push_val(stack, (val_t){.ref = a}));
+
+                case OP_MEMORY_FILL: {
+                    uint64_t n = POP_ADDR(mem);
+                    uint8_t val = POP_I32();
+                    uint64_t d = POP_ADDR(mem);
+                    __throwiferr(memory_fill(mem, d, val, n));
                     break;
                 }
+            }
+            NEXT();
+        }
+
+        INSTR(OP_I32_CONST) {
+            PUSH_I32(*pc++);
+            NEXT();
+        }
+
+        INSTR(OP_I64_CONST) {
+            PUSH_I64(READ_I64(pc));
+            NEXT();
+        }
+
+        // float constants are stored as their bit patterns
+        INSTR(OP_F32_CONST) {
+            PUSH_I32(*pc++);
+            NEXT();
+        }
+
+        INSTR(OP_F64_CONST) {
+            PUSH_I64(READ_I64(pc));
+            NEXT();
+        }
+
+        // numeric instructions, see numeric.h
+        FOREACH_UNOP(UNOP)
+        FOREACH_BINOP(BINOP)
+
+        INSTR(OP_REF_NULL) {
+            PUSH_VAL((val_t){.ref = REF_NULL});
+            NEXT();
+        }
+
+        INSTR(OP_REF_IS_NULL) {
+            PUSH_I32(POP_VAL().ref == REF_NULL);
+            NEXT();
+        }
+
+        INSTR(OP_REF_FUNC) {
+            PUSH_VAL((val_t){.ref = F->module->funcaddrs[*pc++]});
+            NEXT();
+        }
+
+        INSTR(OP_MEMORY_INIT) {
+            memaddr_t ma = F->module->memaddrs[0];
+            meminst_t *mem = VECTOR_ELEM(&S->mems, ma);
+            dataaddr_t da = F->module->dataaddrs[*pc++];
+            datainst_t *data = VECTOR_ELEM(&S->datas, da);
+
+            uint32_t n = POP_I32();
+            uint32_t s = POP_I32();
+            uint32_t d = POP_I32();
+            __throwiferr(memory_init(mem, data, d, s, n));
+            NEXT();
+        }
+
+        INSTR(OP_DATA_DROP) {
+            dataaddr_t a = F->module->dataaddrs[*pc++];
+            datainst_t *data = VECTOR_ELEM(&S->datas, a);
+            VECTOR_INIT(&data->data);
+            NEXT();
+        }
+
+        INSTR(OP_MEMORY_COPY) {
+            memaddr_t ma = F->module->memaddrs[0];
+            meminst_t *mem = VECTOR_ELEM(&S->mems, ma);
+            uint32_t n = POP_I32();
+            uint32_t s = POP_I32();
+            uint32_t d = POP_I32();
+            __throwiferr(memory_copy(mem, mem, d, s, n));
+            NEXT();
+        }
 
-                default:
-                    PANIC("Exec: unsupported opcode: %x\n", ip->op1);
+        INSTR(OP_MEMORY_FILL) {
+            memaddr_t ma = F->module->memaddrs[0];
+            meminst_t *mem = VECTOR_ELEM(&S->mems, ma);
+            uint32_t n = POP_I32();
+            uint8_t val = POP_I32();
+            uint32_t d = POP_I32();
+            __throwiferr(memory_fill(mem, d, val, n));
+            NEXT();
+        }
+
+        INSTR(OP_TABLE_INIT) {
+            tableaddr_t ta = F->module->tableaddrs[*pc++];
+            tableinst_t *tab = VECTOR_ELEM(&S->tables, ta);
+            elemaddr_t ea = F->module->elemaddrs[*pc++];
+            eleminst_t *elem = VECTOR_ELEM(&S->elems, ea);
+            uint32_t n = POP_I32();
+            uint32_t s = POP_I32();
+            uint32_t d = POP_I32();
+            __throwiferr(table_init(tab, elem, d, s, n));
+            NEXT();
+        }
+
+        INSTR(OP_ELEM_DROP) {
+            elemaddr_t a = F->module->elemaddrs[*pc++];
+            eleminst_t *elem = VECTOR_ELEM(&S->elems, a);
+            VECTOR_INIT(&elem->elem);
+            NEXT();
+        }
+
+        INSTR(OP_TABLE_COPY) {
+            tableaddr_t ta_x = F->module->tableaddrs[*pc++];
+            tableinst_t *tab_x = VECTOR_ELEM(&S->tables, ta_x);
+            tableaddr_t ta_y = F->module->tableaddrs[*pc++];
+            tableinst_t *tab_y = VECTOR_ELEM(&S->tables, ta_y);
+            uint32_t n = POP_I32();
+            uint32_t s = POP_I32();
+            uint32_t d = POP_I32();
+            __throwiferr(table_copy(tab_x, tab_y, d, s, n));
+            NEXT();
+        }
+
+        INSTR(OP_TABLE_GROW) {
+            tableaddr_t ta = F->module->tableaddrs[*pc++];
+            tableinst_t *tab = VECTOR_ELEM(&S->tables, ta);
+            int32_t sz = tab->elem.len;
+            int32_t n = POP_I32();
+            val_t val = POP_VAL();
+
+            if(tab->type.limits.max && n + tab->elem.len > tab->type.limits.max) {
+                PUSH_I32(-1);
+                NEXT();
             }
-            
-            // update ip
-            ip = next_ip;
+
+            if(!IS_ERROR(VECTOR_GROW(&tab->elem, n))) {
+                tab->elem.len += n;
+                table_fill(tab, sz, val.ref, n);
+                PUSH_I32(sz);
+            }
+            else {
+                PUSH_I32(-1);
+            }
+            NEXT();
+        }
+
+        INSTR(OP_TABLE_SIZE) {
+            tableaddr_t ta = F->module->tableaddrs[*pc++];
+            tableinst_t *tab = VECTOR_ELEM(&S->tables, ta);
+            PUSH_I32(tab->elem.len);
+            NEXT();
+        }
+
+        INSTR(OP_TABLE_FILL) {
+            tableaddr_t ta = F->module->tableaddrs[*pc++];
+            tableinst_t *tab = VECTOR_ELEM(&S->tables, ta);
+            uint32_t n = POP_I32();
+            val_t val = POP_VAL();
+            uint32_t i = POP_I32();
+
+            __throwif(ERR_TRAP_OUT_OF_BOUNDS_TABLE_ACCESS, (uint64_t)i + n > tab->elem.len);
+            table_fill(tab, i, val.ref, n);
+            NEXT();
+        }
+
+        // superinstructions, see fuse_instrs
+        INSTR(OP_S_LOCAL_LOCAL_I32_ADD) {
+            COUNT_HIT();
+            PUSH_I32((uint32_t)SLOT_I32(pc[0]) + (uint32_t)SLOT_I32(pc[1]));
+            pc += 2;
+            NEXT();
+        }
+
+        INSTR(OP_S_LOCAL_CONST_I32_ADD) {
+            COUNT_HIT();
+            PUSH_I32((uint32_t)SLOT_I32(pc[0]) + pc[1]);
+            pc += 2;
+            NEXT();
+        }
+
+        INSTR(OP_S_I32_EQZ_BR_IF) {
+            COUNT_HIT();
+            if(POP_I32() != 0) {
+                pc += 3;
+                NEXT();
+            }
+            goto __br;
+        }
+
+        INSTR(OP_S_I32_LT_S_BR_IF) {
+            COUNT_HIT();
+            int32_t rhs = POP_I32();
+            int32_t lhs = POP_I32();
+            if(!(lhs < rhs)) {
+                pc += 3;
+                NEXT();
+            }
+            goto __br;
+        }
+
+        INSTR(OP_S_LOCAL_I32_LOAD) {
+            COUNT_HIT();
+            meminst_t *mem = VECTOR_ELEM(&S->mems, F->module->memaddrs[0]);
+            uint64_t ea = (uint64_t)(uint32_t)SLOT_I32(pc[0]) + pc[1];
+            PUSH_I32(LOAD_MEM(int32_t, mem->data + ea));
+            pc += 2;
+            NEXT();
+        }
+
+        // register code, see compile_func_reg
+        INSTR(OP_R_COPY) {
+            fp[pc[0]] = fp[pc[1]];
+            pc += 2;
+            NEXT();
         }
+
+        INSTR(OP_R_CONST32) {
+            SET_I32(pc[0], pc[1]);
+            pc += 2;
+            NEXT();
+        }
+
+        INSTR(OP_R_CONST64) {
+            uint32_t dst = *pc++;
+            SET_I64(dst, READ_I64(pc));
+            NEXT();
+        }
+
+        // set the stack index before a stack instruction
+        INSTR(OP_R_SP) {
+            stack->idx = (fp - stack->pool) + *pc++ - 1;
+            NEXT();
+        }
+
+        INSTR(OP_R_IF) {
+            if(SLOT_I32(pc[0]) == 0)
+                pc += 1 + pc[1];
+            else
+                pc += 2;
+            NEXT();
+        }
+
+        // only emitted for branches without values, which ignore the stack index
+        INSTR(OP_R_BR_IF) {
+            if(SLOT_I32(*pc++) == 0) {
+                pc += 3;
+                NEXT();
+            }
+            goto __br;
+        }
+
+        FOREACH_UNOP(RUNOP)
+        FOREACH_BINOP(RBINOP)
+
+#ifdef DISPATCH_COMPUTED_GOTO
+        L_UNSUPPORTED:
+#else
+        default:
+#endif
+            PANIC("Exec: unsupported opcode: %x\n", *ip);
+#ifndef DISPATCH_COMPUTED_GOTO
+        }
+        }
+#endif
     }
     __catch:
         return err;
@@ -1837,47 +1149,138 @@ static error_t invoke_func(store_t *S, funcaddr_t funcaddr) {
 
         funcinst_t *funcinst = VECTOR_ELEM(&S->funcs, funcaddr);
         functype_t *functype = funcinst->type;
+        func_t *func = funcinst->code;
 
         // create new frame
+        // The arguments on top of the caller's operands become the first locals,
+        // the remaining locals are zeroed right above them.
         frame_t frame;
-        uint32_t num_locals = functype->rt1.len + funcinst->code->locals.len;
+        uint32_t num_params = functype->rt1.len;
+        uint32_t num_locals = func->locals.len;
         frame.module = funcinst->module;
-        frame.locals = calloc(sizeof(val_t), num_locals);
+        frame.funcinst = funcinst;
+        frame.locals = &stack->pool[stack->idx + 1 - num_params];
 
-        // pop args
-        for(int32_t i = (functype->rt1.len - 1); 0 <= i; i--) {
-            pop_val(stack, &frame.locals[i]);
-        }
+        __throwif(ERR_TRAP_CALL_STACK_EXHAUSTED, stack->idx + 1 + num_locals > NUM_STACK_ENT);
+        memset(&stack->pool[stack->idx + 1], 0, sizeof(val_t) * num_locals);
+        stack->idx += num_locals;
         
         // push activation frame
         frame.arity  = functype->rt2.len;
         __throwiferr(push_frame(stack, frame));
 
-        // create label L
-        static instr_t end = {.op1 = OP_END, .next = NULL};
-        label_t L = {.arity = functype->rt2.len, .parent = NULL, .continuation = &end};
-        // enter instr* with label L
-        __throwiferr(push_label(stack, L));
+        // functions the JIT cannot compile run as stack code
+        if(S->tier == TIER_JIT && !funcinst->native && !func->jitcode && !func->no_jit) {
+            if(IS_ERROR(jit_compile(funcinst->module->module, func)))
+                func->no_jit = true;
+        }
+
+        void *native = funcinst->native;
+        if(!native && S->tier == TIER_JIT)
+            native = func->jitcode;
+        else if(!native && S->tier == TIER_TIERED) {
+            native = __atomic_load_n(&func->jitcode, __ATOMIC_ACQUIRE);
+            if(!native)
+                count_hot(S, funcinst);
+        }
+
+        uint32_t *code = func->code.elem;
+        if(native) {
+            // native code pushes operands without checking the stack bounds
+            __throwif(ERR_TRAP_CALL_STACK_EXHAUSTED, stack->idx + 1 + func->max_height > NUM_STACK_ENT + 1);
+
+            val_t *sp = &stack->pool[stack->idx + 1];
+            __throwiferr(((jitcode_t)native)(S, frame.module, frame.locals, &sp));
+            stack->idx = sp - stack->pool - 1;
+            code = NULL;
+        }
+        else if(S->tier == TIER_REGISTER) {
+            if(!func->regcode.elem) {
+                __throwiferr(compile_func_reg(funcinst->module->module, func));
+            }
+            code = func->regcode.elem;
+
+            // register code writes its frame slots without checking the stack bounds
+            __throwif(
+                ERR_TRAP_CALL_STACK_EXHAUSTED,
+                (frame.locals - stack->pool) + func->max_slots > NUM_STACK_ENT + 1
+            );
+        }
 
-        __throwiferr(exec_expr(S, &funcinst->code->body));
+        if(code)
+            __throwiferr(exec_code(S, code));
 
-        // return from a function("return" instruction)
-        vals_t vals;
-        pop_vals_n(stack, frame.arity, &vals);
-        pop_while_not_frame(stack);
+        // return from a function("return" instruction):
+        // pop the frame and move the results down over the locals
+        val_t *results = &stack->pool[stack->idx + 1 - frame.arity];
         pop_frame(stack, &frame);
-        __throwiferr(push_vals(stack, vals));
+        memmove(frame.locals, results, sizeof(val_t) * frame.arity);
+        stack->idx = (frame.locals - stack->pool) + frame.arity - 1;
+    }
+    __catch:
+        return err;
+}
+
+typedef struct {
+    store_t     *S;
+    funcaddr_t  funcaddr;
+} call_t;
+
+static error_t invoke_call(void *arg) {
+    call_t *call = arg;
+    return invoke_func(call->S, call->funcaddr);
+}
+
+// invoke_func from the embedder, with faults in linear memory turned into traps
+static error_t invoke_guarded(store_t *S, funcaddr_t funcaddr) {
+    call_t call = {.S = S, .funcaddr = funcaddr};
+    return trap_guard(invoke_call, &call, ERR_TRAP_OUT_OF_BOUNDS_MEMORY_ACCESS);
+}
+
+// runtime helpers called from native code, see jit.h
+// *sp is the operand stack pointer of the native code.
+error_t jit_call(store_t *S, moduleinst_t *module, val_t **sp, uint32_t funcidx) {
+    __try {
+        stack_t *stack = S->stack;
+        stack->idx = *sp - stack->pool - 1;
+        __throwiferr(invoke_func(S, module->funcaddrs[funcidx]));
+        *sp = &stack->pool[stack->idx + 1];
+    }
+    __catch:
+        return err;
+}
+
+error_t jit_call_indirect(store_t *S, moduleinst_t *module, val_t **sp, uint32_t typeidx, uint32_t tableidx, uint32_t i) {
+    __try {
+        stack_t *stack = S->stack;
+        stack->idx = *sp - stack->pool - 1;
+        __throwiferr(call_indirect(S, module, typeidx, tableidx, i));
+        *sp = &stack->pool[stack->idx + 1];
     }
     __catch:
         return err;
 }
 
+val_t *jit_global(store_t *S, moduleinst_t *module, uint32_t globalidx) {
+    return &VECTOR_ELEM(&S->globals, module->globaladdrs[globalidx])->val;
+}
+
+int32_t jit_memory_size(store_t *S, moduleinst_t *module) {
+    return VECTOR_ELEM(&S->mems, module->memaddrs[0])->num_pages;
+}
+
+int32_t jit_memory_grow(store_t *S, moduleinst_t *module, int32_t n) {
+    return memory_grow(VECTOR_ELEM(&S->mems, module->memaddrs[0]), (uint32_t)n);
+}
+
 static funcaddr_t alloc_func(store_t *S, func_t *func, moduleinst_t *moduleinst) {
     funcinst_t funcinst;
 
     funcinst.type = &moduleinst->types[func->type];
     funcinst.module = moduleinst;
     funcinst.code   = func;
+    funcinst.native = NULL;
+    funcinst.hotness = 0;
 
     return VECTOR_APPEND(&S->funcs, funcinst);
 }
@@ -1890,55 +1293,291 @@ static tableaddr_t alloc_table(store_t *S, table_t *table) {
     VECTOR_NEW(&tableinst.elem, n, n);
 
     // init with ref.null
-    VECTOR_FOR_EACH(elem, &tableinst.elem) {
-        *elem = REF_NULL;
-    }
+    table_fill(&tableinst, 0, REF_NULL, n);
 
     return VECTOR_APPEND(&S->tables, tableinst);
 }
 
-static memaddr_t alloc_mem(store_t *S, mem_t *mem) {
+// Build the memory image of mod if every active data segment has a constant
+// offset within the initial memory 0, and return its new state. Otherwise
+// (imported memory, offsets from globals, segments out of bounds or for other
+// memories) instantiate copies the data as before.
+// ref: https://man7.org/linux/man-pages/man2/memfd_create.2.html
+static uint8_t build_memimage(module_t *mod) {
+    memimage_t *img = &mod->memimage;
+
+    // only memory 0 gets an image, and only if the module defines it
+    if(mod->num_mem_imports || !mod->mems.len)
+        goto none;
+
+    uint64_t limit = (uint64_t)VECTOR_ELEM(&mod->mems, 0)->type.min * WASM_PAGE_SIZE;
+    uint64_t size = 0;
+    VECTOR_FOR_EACH(data, &mod->datas) {
+        if(data->mode.kind != DATA_MODE_ACTIVE)
+            continue;
+
+        instr_t *offset = data->mode.offset;
+        if(data->mode.memory != 0 || offset->op1 != OP_I32_CONST || offset->next->op1 != OP_END)
+            goto none;
+
+        uint64_t end = (uint64_t)(uint32_t)offset->c.i32 + data->init.len;
+        if(end > limit)
+            goto none;
+        if(end > size)
+            size = end;
+    }
+    size = (size + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+    if(size == 0)
+        goto none;
+
+    int fd = memfd_create("wasm-memimage", MFD_CLOEXEC);
+    if(fd < 0)
+        goto none;
+    if(ftruncate(fd, size) != 0)
+        goto fail;
+
+    // later segments overwrite earlier ones, as with memory.init in order
+    VECTOR_FOR_EACH(data, &mod->datas) {
+        if(data->mode.kind != DATA_MODE_ACTIVE)
+            continue;
+        off_t offset = (uint32_t)data->mode.offset->c.i32;
+        if(pwrite(fd, data->init.elem, data->init.len, offset) != (ssize_t)data->init.len)
+            goto fail;
+    }
+
+    img->fd = fd;
+    img->size = size;
+    __atomic_store_n(&img->state, MEMIMAGE_READY, __ATOMIC_RELEASE);
+    return MEMIMAGE_READY;
+
+fail:
+    close(fd);
+none:
+    __atomic_store_n(&img->state, MEMIMAGE_NONE, __ATOMIC_RELEASE);
+    return MEMIMAGE_NONE;
+}
+
+// The memory image of mod for an instantiation, or NULL to copy the data.
+// The first instantiation builds the image; those racing with it copy the
+// data rather than wait.
+static memimage_t *get_memimage(module_t *mod) {
+    uint8_t state = MEMIMAGE_UNBUILT;
+    if(__atomic_compare_exchange_n(
+        &mod->memimage.state, &state, MEMIMAGE_BUILDING, false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE
+    ))
+        state = build_memimage(mod);
+    return state == MEMIMAGE_READY ? &mod->memimage : NULL;
+}
+
+// memory pool
+// Reservations of released memories are reset and kept for the next
+// instantiation, which saves mapping 8 GiB and registering it with trap.c.
+static struct {
+    pthread_mutex_t lock;
+    uint32_t        len;
+    uint8_t         *data[MEM_POOL_SIZE];
+} mempool = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+// map size bytes of address space aligned to HUGE_PAGE_SIZE, so that huge
+// pages line up with the start of a memory; NULL if there is no room
+static uint8_t *map_reserve(size_t size) {
+    size_t len = size + HUGE_PAGE_SIZE;
+    uint8_t *p = mmap(NULL, len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(p == MAP_FAILED)
+        return NULL;
+
+    uint8_t *data = HUGE_ALIGN_UP(p);
+    if(data > p)
+        munmap(p, data - p);
+    munmap(data + size, p + len - (data + size));
+    return data;
+}
+
+static uint8_t *reserve_mem(void) {
+    uint8_t *data = NULL;
+
+    pthread_mutex_lock(&mempool.lock);
+    if(mempool.len)
+        data = mempool.data[--mempool.len];
+    pthread_mutex_unlock(&mempool.lock);
+
+    if(!data) {
+        data = map_reserve(MEM_RESERVE_SIZE);
+        if(data)
+            trap_register(data, MEM_RESERVE_SIZE);
+    }
+    return data;
+}
+
+// drop the contents of mem and return its reservation to the pool, or unmap it
+// ref: https://man7.org/linux/man-pages/man2/madvise.2.html
+static void unreserve_mem(meminst_t *mem) {
+    uint8_t *data = mem->data;
+    size_t size = mem->num_pages * WASM_PAGE_SIZE;
+
+    // 64-bit memories are sized to their type and never pooled
+    if(mem->type.is64) {
+        munmap(data, mem->reserve_size);
+        mem->data = NULL;
+        mem->num_pages = 0;
+        return;
+    }
+
+    // MADV_DONTNEED would bring back the image, and keep huge pages for the
+    // next memory, so map fresh pages over them
+    size_t remap = mem->backing == MEM_BACKING_PAGES ? mem->image_size : size;
+    bool reset = !remap || mmap(
+        data, remap, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0
+    ) != MAP_FAILED;
+    reset = reset &&
+        madvise(data, size, MADV_DONTNEED) == 0 &&
+        mprotect(data, size, PROT_NONE) == 0;
+
+    mem->data = NULL;
+    mem->num_pages = 0;
+
+    pthread_mutex_lock(&mempool.lock);
+    if(reset && mempool.len < MEM_POOL_SIZE) {
+        mempool.data[mempool.len++] = data;
+        data = NULL;
+    }
+    pthread_mutex_unlock(&mempool.lock);
+
+    // the pool is full or the reset failed: give the address space back
+    if(data) {
+        trap_unregister(data);
+        munmap(data, MEM_RESERVE_SIZE);
+    }
+}
+
+// reserve the address space of a 64-bit memory: its maximum, or
+// MEM64_RESERVE_PAGES without one, but no less than its minimum
+static uint8_t *reserve_mem64(memtype_t *type, size_t *reserve_size) {
+    uint64_t n = type->has_max ? type->max : MEM64_RESERVE_PAGES;
+    if(n < type->min)
+        n = type->min;
+    if(n > MEM64_MAX_RESERVE_PAGES)
+        n = MEM64_MAX_RESERVE_PAGES;
+
+    // short of address space, settle for the minimum and never grow
+    uint8_t *data = map_reserve(n * WASM_PAGE_SIZE);
+    if(!data && n > type->min) {
+        n = type->min;
+        data = map_reserve(n * WASM_PAGE_SIZE);
+    }
+    *reserve_size = n * WASM_PAGE_SIZE;
+    return data;
+}
+
+// allocate a memory of type mem, mapping img (see get_memimage) if not NULL
+static error_t alloc_mem(store_t *S, mem_t *mem, memimage_t *img, memaddr_t *memaddr) {
     meminst_t meminst;
     
     meminst.type = mem->type;
     meminst.num_pages = mem->type.min;
-    for(uint32_t i = 0; i < 4; i++) {
-        meminst.table2[i] = NULL;
-    }
+    meminst.stats = (memstats_t){0};
+    meminst.image_size = 0;
+    meminst.backing = S->mem_backing;
+    meminst.data = NULL;
+
+    __try {
+        // reserve the whole address space, then commit the initial pages
+        if(mem->type.is64) {
+            // accesses are bounds checked, so the reservation needs no guard pages
+            __throwif(ERR_OUT_OF_MEMORY, mem->type.min > MEM64_MAX_RESERVE_PAGES);
+            meminst.data = reserve_mem64(&mem->type, &meminst.reserve_size);
+        }
+        else {
+            meminst.reserve_size = MEM_RESERVE_SIZE;
+            meminst.data = reserve_mem();
+        }
+        __throwif(ERR_OUT_OF_MEMORY, !meminst.data);
+        __throwif(
+            ERR_OUT_OF_MEMORY,
+            mprotect(meminst.data, meminst.num_pages * WASM_PAGE_SIZE, PROT_READ | PROT_WRITE) != 0
+        );
 
-    return VECTOR_APPEND(&S->mems, meminst);
+        // the initial contents, shared with other instances until written
+        if(img) {
+            void *p = mmap(meminst.data, img->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, img->fd, 0);
+            __throwif(ERR_OUT_OF_MEMORY, p == MAP_FAILED);
+            meminst.image_size = img->size;
+        }
+        back_huge(&meminst, meminst.data + meminst.image_size, meminst.num_pages * WASM_PAGE_SIZE - meminst.image_size);
+
+        *memaddr = VECTOR_APPEND(&S->mems, meminst);
+    }
+    __catch:
+        // give back the reservation
+        if(IS_ERROR(err) && meminst.data)
+            unreserve_mem(&meminst);
+        return err;
 }
 
 static dataaddr_t alloc_data(store_t *S, data_t *data) {
     datainst_t datainst;
 
-    VECTOR_COPY(&datainst.data, &data->init);
+    // share the bytes with the module: data.drop only forgets them
+    datainst.data.cap = data->init.cap;
+    datainst.data.len = data->init.len;
+    datainst.data.ent_size = data->init.ent_size;
+    datainst.data.elem = data->init.elem;
 
     return VECTOR_APPEND(&S->datas, datainst);
 }
 
-static globaladdr_t alloc_global(store_t *S, global_t *global) {
+// evaluate a constant expression
+// ref: https://webassembly.github.io/spec/core/valid/instructions.html#constant-expressions
+static val_t eval_const_expr(store_t *S, moduleinst_t *moduleinst, expr_t expr) {
+    val_t val = {.num.i64 = 0};
+
+    for(instr_t *ip = expr; ip; ip = ip->next) {
+        switch(ip->op1) {
+            case OP_I32_CONST:
+                val = (val_t){.num.i32 = ip->c.i32};
+                break;
+            case OP_I64_CONST:
+                val = (val_t){.num.i64 = ip->c.i64};
+                break;
+            case OP_F32_CONST:
+                val = (val_t){.num.f32 = ip->c.f32};
+                break;
+            case OP_F64_CONST:
+                val = (val_t){.num.f64 = ip->c.f64};
+                break;
+            case OP_GLOBAL_GET: {
+                globaladdr_t a = moduleinst->globaladdrs[ip->globalidx];
+                val = VECTOR_ELEM(&S->globals, a)->val;
+                break;
+            }
+            case OP_REF_NULL:
+                val = (val_t){.ref = REF_NULL};
+                break;
+            case OP_REF_FUNC:
+                val = (val_t){.ref = moduleinst->funcaddrs[ip->x]};
+                break;
+        }
+    }
+    return val;
+}
+
+static globaladdr_t alloc_global(store_t *S, global_t *global, moduleinst_t *moduleinst) {
     globalinst_t globalinst;
 
     globalinst.gt = global->gt;
-
-    exec_expr(S, &global->expr);
-    pop_val(S->stack, &globalinst.val);
+    globalinst.val = eval_const_expr(S, moduleinst, global->expr);
     
     return VECTOR_APPEND(&S->globals, globalinst);
 }
 
-static elemaddr_t alloc_elem(store_t *S, elem_t *elem) {
+static elemaddr_t alloc_elem(store_t *S, elem_t *elem, moduleinst_t *moduleinst) {
     eleminst_t eleminst;
 
     VECTOR_NEW(&eleminst.elem, elem->init.len, elem->init.len);
 
     for(uint32_t j = 0; j < elem->init.len; j++) {
         expr_t *init = VECTOR_ELEM(&elem->init, j);
-        exec_expr(S, init);
-        val_t val;
-        pop_val(S->stack, &val);
-        *VECTOR_ELEM(&eleminst.elem, j) = val.ref;
+        *VECTOR_ELEM(&eleminst.elem, j) = eval_const_expr(S, moduleinst, *init).ref;
     }
 
     return VECTOR_APPEND(&S->elems, eleminst);
@@ -1957,6 +1596,13 @@ store_t *new_store(void) {
     VECTOR_INIT(&S->elems);
     VECTOR_INIT(&S->datas);
 
+    trap_init();
+
+    S->tier = TIER_STACK;
+    S->hot_threshold = HOT_THRESHOLD;
+    S->tierup = NULL;
+    S->mem_backing = MEM_BACKING_PAGES;
+
     return S;
 }
 
@@ -1977,6 +1623,7 @@ error_t instantiate(store_t *S, module_t *module, externvals_t *externvals, modu
 
         // create new moduleinst
         moduleinst_t *moduleinst = *inst = malloc(sizeof(moduleinst_t));
+        moduleinst->module = module;
         moduleinst->types = module->types.elem;
         moduleinst->funcaddrs = malloc(
             sizeof(funcaddr_t) * (module->num_func_imports + module->funcs.len)
@@ -1984,7 +1631,9 @@ error_t instantiate(store_t *S, module_t *module, externvals_t *externvals, modu
         moduleinst->tableaddrs = malloc(
             sizeof(tableaddr_t) * (module->num_table_imports + module->tables.len)
         );
-        moduleinst->memaddrs = malloc(sizeof(memaddr_t) * 1);
+        moduleinst->memaddrs = malloc(
+            sizeof(memaddr_t) * (module->num_mem_imports + module->mems.len)
+        );
         moduleinst->dataaddrs = malloc(
             sizeof(dataaddr_t) * module->datas.len
         );
@@ -2037,8 +1686,9 @@ error_t instantiate(store_t *S, module_t *module, externvals_t *externvals, modu
         }
 
         // alloc mems
+        memimage_t *img = get_memimage(module);
         VECTOR_FOR_EACH(mem, &module->mems) {
-            moduleinst->memaddrs[memidx] = alloc_mem(S, mem);
+            __throwiferr(alloc_mem(S, mem, memidx == 0 ? img : NULL, &moduleinst->memaddrs[memidx]));
             memidx++;
         }
 
@@ -2049,17 +1699,14 @@ error_t instantiate(store_t *S, module_t *module, externvals_t *externvals, modu
         }
 
         // alloc globals
-        frame_t F = {.module = moduleinst, .locals = NULL};
-        __throwiferr(push_frame(S->stack, F));
-
         VECTOR_FOR_EACH(global, &module->globals) {
-            moduleinst->globaladdrs[globalidx] = alloc_global(S, global);
+            moduleinst->globaladdrs[globalidx] = alloc_global(S, global, moduleinst);
             globalidx++;
         }
 
         // alloc elems
         VECTOR_FOR_EACH(elem, &module->elems) {
-            moduleinst->elemaddrs[elemidx] = alloc_elem(S, elem);
+            moduleinst->elemaddrs[elemidx] = alloc_elem(S, elem, moduleinst);
             elemidx++;
         }
 
@@ -2090,72 +1737,47 @@ error_t instantiate(store_t *S, module_t *module, externvals_t *externvals, modu
 
         for(uint32_t i = 0; i < module->elems.len; i++) {
             elem_t *elem = VECTOR_ELEM(&module->elems, i);
-            
-            instr_t elem_drop = {
-                .op1 = OP_0XFC, .op2 = 0x0D, .x = i, .next = NULL
-            };
-            instr_t table_init = {
-                .op1 = OP_0XFC, .op2 = 0x0C, .x = elem->mode.table, .y = i, .next = &elem_drop
-            };
+            eleminst_t *eleminst = VECTOR_ELEM(&S->elems, moduleinst->elemaddrs[i]);
 
             switch(elem->mode.kind) {
                 // init table if elemmode is active
                 case 0: {
-                     // exec instruction sequence
-                    __throwiferr(exec_expr(S, &elem->mode.offset));
+                    tableinst_t *tab = VECTOR_ELEM(&S->tables, moduleinst->tableaddrs[elem->mode.table]);
+                    val_t offset = eval_const_expr(S, moduleinst, elem->mode.offset);
 
-                    // exec i32.const 0; i32.const n;
-                    __throwiferr(push_i32(S->stack, 0));
-                    __throwiferr(push_i32(S->stack, elem->init.len));
-
-                    // table.init
-                    expr_t expr = &table_init;
-                    __throwiferr(exec_expr(S, &expr));
-                    
+                    // table.init; elem.drop
+                    __throwiferr(table_init(tab, eleminst, offset.num.i32, 0, elem->init.len));
+                    VECTOR_INIT(&eleminst->elem);
                     break;
                 }
 
                 // exec elem.drop if elemmode is declarative
-                case 2: {
-                    // table.init
-                    expr_t expr = &elem_drop;
-                    __throwiferr(exec_expr(S, &expr));
+                case 2:
+                    VECTOR_INIT(&eleminst->elem);
                     break;
-                }
             }
         }
 
-        // init memory if datamode is active
-        for(uint32_t i = 0; i < module->datas.len; i++) {
+        // init memory if datamode is active (the memory image holds the data already)
+        for(uint32_t i = 0; i < module->datas.len && !img; i++) {
             data_t *data = VECTOR_ELEM(&module->datas, i);
 
             if(data->mode.kind != DATA_MODE_ACTIVE)
                 continue;
             
-            __throwif(ERR_FAILED, data->mode.memory != 0);
-
-            __throwiferr(exec_expr(S, &data->mode.offset));
-
-            // i32.const 0
-            __throwiferr(push_i32(S->stack, 0));
-            // i32.const n
-            __throwiferr(push_i32(S->stack, data->init.len));
+            meminst_t *mem = VECTOR_ELEM(&S->mems, moduleinst->memaddrs[data->mode.memory]);
+            datainst_t *datainst = VECTOR_ELEM(&S->datas, moduleinst->dataaddrs[i]);
+            val_t offset = eval_const_expr(S, moduleinst, data->mode.offset);
+            uint64_t d = mem->type.is64 ? (uint64_t)offset.num.i64 : (uint32_t)offset.num.i32;
 
             // memory.init i
-            instr_t memory_init = {
-                .op1 = OP_0XFC, .op2 = 8, .x = i, .next = NULL
-            };
-            expr_t expr = &memory_init;
-            __throwiferr(exec_expr(S, &expr));
+            __throwiferr(memory_init(mem, datainst, d, 0, data->init.len));
         }
 
         // exec start function if exists
         if(module->has_start) {
-            __throwiferr(invoke_func(S, F.module->funcaddrs[module->start]));
+            __throwiferr(invoke_guarded(S, moduleinst->funcaddrs[module->start]));
         }
-
-        pop_frame(S->stack, &F);
-        // todo: support start section
     }
     __catch:
         return err;
@@ -2164,8 +1786,11 @@ error_t instantiate(store_t *S, module_t *module, externvals_t *externvals, modu
 // The args is a reference to args_t. 
 // This is because args is also used to return results.
 error_t invoke(store_t *S, funcaddr_t funcaddr, args_t *args) {
+    stack_t *stack = S->stack;
+    size_t idx = stack->idx;
+    size_t frame_idx = stack->frame_idx;
+
     __try {
-        stack_t *stack = S->stack;
 
         funcinst_t *funcinst = VECTOR_ELEM(&S->funcs, funcaddr);
         __throwif(ERR_FAILED, !funcinst);
@@ -2173,9 +1798,9 @@ error_t invoke(store_t *S, funcaddr_t funcaddr, args_t *args) {
         functype_t *functype = funcinst->type;
         __throwif(ERR_FAILED, args->len != functype->rt1.len);
 
-        size_t idx = 0;
+        size_t i = 0;
         VECTOR_FOR_EACH(arg, args) {
-            __throwif(ERR_FAILED, arg->type != *VECTOR_ELEM(&functype->rt1, idx++));
+            __throwif(ERR_FAILED, arg->type != *VECTOR_ELEM(&functype->rt1, i++));
         }
 
         // Omit the process of pushing the dummy frame onto the stack.
@@ -2187,17 +1812,120 @@ error_t invoke(store_t *S, funcaddr_t funcaddr, args_t *args) {
         }
 
         // invoke func
-        __throwiferr(invoke_func(S, funcaddr));
+        __throwiferr(invoke_guarded(S, funcaddr));
 
         // reuse args to return results since it is no longer used.
         //free(args->elem);
         VECTOR_NEW(args, functype->rt2.len, functype->rt2.len);
-        idx = 0;
+        i = 0;
         VECTOR_FOR_EACH_REVERSE(ret, args) {
-            ret->type = *VECTOR_ELEM(&functype->rt2, idx++);
+            ret->type = *VECTOR_ELEM(&functype->rt2, i++);
             pop_val(stack, &ret->val);
         }
     }
+    __catch:
+        // discard the frames and operands left by a trap
+        if(IS_ERROR(err)) {
+            stack->idx = idx;
+            stack->frame_idx = frame_idx;
+        }
+        return err;
+}
+
+// Return the memories defined by inst to the pool (see unreserve_mem).
+// The instance and its memories must not be used afterwards; imported
+// memories belong to their own instance and are left alone.
+void release_instance(store_t *S, moduleinst_t *inst) {
+    module_t *mod = inst->module;
+
+    for(uint32_t i = 0; i < mod->mems.len; i++) {
+        meminst_t *mem = VECTOR_ELEM(&S->mems, inst->memaddrs[mod->num_mem_imports + i]);
+        if(mem->data)
+            unreserve_mem(mem);
+    }
+}
+
+// Bind the functions of inst to the native code in the shared object at path,
+// built from the same module by wasm2so, which records the hash of the module
+// bytes. Functions without native code there keep running as flat code.
+error_t load_aot(store_t *S, moduleinst_t *inst, const char *path) {
+    void *so = dlopen(path, RTLD_NOW);
+
+    __try {
+        __throwif(ERR_FAILED, !so);
+
+        module_t *mod = inst->module;
+        const uint64_t *hash = dlsym(so, "wasm2so_module_hash");
+        const uint32_t *num_funcs = dlsym(so, "wasm2so_num_funcs");
+        void *const *funcs = dlsym(so, "wasm2so_funcs");
+        __throwif(ERR_FAILED, !hash || !num_funcs || !funcs);
+        __throwif(ERR_FAILED, *hash != mod->hash || *num_funcs != mod->funcs.len);
+
+        for(uint32_t i = 0; i < mod->funcs.len; i++) {
+            funcaddr_t a = inst->funcaddrs[mod->num_func_imports + i];
+            VECTOR_ELEM(&S->funcs, a)->native = funcs[i];
+        }
+    }
+    __catch:
+        if(IS_ERROR(err) && so)
+            dlclose(so);
+        return err;
+}
+
+// host access to linear memory
+
+static meminst_t *host_mem(store_t *S, memaddr_t memaddr) {
+    meminst_t *mem = VECTOR_ELEM(&S->mems, memaddr);
+    return mem && mem->data ? mem : NULL;
+}
+
+// Return the base of the memory at memaddr and store its current size in bytes
+// to *size. The memory never moves when it grows, so the pointer stays valid
+// until its instance is released; only the size has to be fetched again.
+uint8_t *mem_data(store_t *S, memaddr_t memaddr, uint64_t *size) {
+    meminst_t *mem = host_mem(S, memaddr);
+    if(!mem)
+        return NULL;
+
+    *size = (uint64_t)mem->num_pages * WASM_PAGE_SIZE;
+    return mem->data;
+}
+
+error_t mem_read(store_t *S, memaddr_t memaddr, uint64_t a, void *dst, uint64_t n) {
+    meminst_t *mem = host_mem(S, memaddr);
+
+    __try {
+        __throwif(ERR_FAILED, !mem);
+        __throwif(ERR_TRAP_OUT_OF_BOUNDS_MEMORY_ACCESS, !mem_in_bounds(mem, a, n));
+
+        memcpy(dst, mem->data + a, n);
+    }
     __catch:
         return err;
-}
\ No newline at end of file
+}
+
+error_t mem_write(store_t *S, memaddr_t memaddr, uint64_t a, const void *src, uint64_t n) {
+    meminst_t *mem = host_mem(S, memaddr);
+
+    __try {
+        __throwif(ERR_FAILED, !mem);
+        __throwif(ERR_TRAP_OUT_OF_BOUNDS_MEMORY_ACCESS, !mem_in_bounds(mem, a, n));
+
+        memcpy(mem->data + a, src, n);
+    }
+    __catch:
+        return err;
+}
+
+// like memory.copy, the memories may be the same and the regions may overlap
+error_t mem_copy(store_t *S, memaddr_t dst, uint64_t d, memaddr_t src, uint64_t s, uint64_t n) {
+    meminst_t *dmem = host_mem(S, dst);
+    meminst_t *smem = host_mem(S, src);
+
+    __try {
+        __throwif(ERR_FAILED, !dmem || !smem);
+        __throwiferr(memory_copy(dmem, smem, d, s, n));
+    }
+    __catch:
+        return err;
+}
@@ -36,6 +36,8 @@ typedef struct {
 } exportinst_t;
 
 typedef struct {
+    // the module this instance was created from
+    module_t                *module;
     functype_t              *types;
     funcaddr_t              *funcaddrs;
     tableaddr_t             *tableaddrs;
@@ -51,6 +53,10 @@ typedef struct {
     functype_t          *type;
     moduleinst_t        *module;
     func_t              *code;
+    // native code bound by load_aot, run instead of code
+    void                *native;
+    // calls and loop back-edges while running as stack code (see tierup.h)
+    uint32_t            hotness;
 } funcinst_t;
 
 #define REF_NULL    -1
@@ -75,51 +81,77 @@ typedef union {
 typedef VECTOR(val_t) vals_t;
 
 typedef struct {
-    list_elem_t     link;
-    uint32_t        arity;
-    instr_t         *parent;
-    instr_t         *continuation;
-} label_t;
-
-typedef struct {
-    list_elem_t     link;
     uint32_t        arity;
     val_t           *locals;
     moduleinst_t    *module;
+    funcinst_t      *funcinst;
 } frame_t;
 
 // stack
-typedef struct {
-    uint32_t        type; // identifier
-    union {
-        val_t       val;
-        label_t     label;
-        frame_t     frame;
-    };
-} obj_t;
-
-#define TYPE_VAL        0
-#define TYPE_LABEL      1
-#define TYPE_FRAME      2
-
+// Operands are untagged values in a dense array.
+// Frames are kept apart in their own array (the control stack).
 #define STACK_SIZE      (4096 * 16)
-#define NUM_STACK_ENT   (STACK_SIZE / sizeof(obj_t) - 1)
+#define NUM_STACK_ENT   (STACK_SIZE / sizeof(val_t) - 1)
+#define NUM_FRAME_ENT   (1024 - 1)
 
 typedef struct {
-    list_t          frames;
-    list_t          labels;
     size_t          idx;
-    obj_t           *pool;
+    val_t           *pool;
+    size_t          frame_idx;
+    frame_t         *frames;
 } stack_t;
 
 #define PAGE_SIZE       (4096)
 #define WASM_PAGE_SIZE  (PAGE_SIZE * 16)
 #define NUM_PAGE_MAX    (65536)
 
+// Linear memory is a single reservation covering every effective address
+// (a 32-bit address plus a 32-bit offset, plus the access size). Pages past
+// num_pages are inaccessible, so an out-of-bounds access faults and the
+// fault is turned into ERR_TRAP_OUT_OF_BOUNDS_MEMORY_ACCESS.
+#define MEM_RESERVE_SIZE    (2 * (uint64_t)NUM_PAGE_MAX * WASM_PAGE_SIZE + WASM_PAGE_SIZE)
+
+// A 64-bit memory (memory64) reserves room for its maximum, or for
+// MEM64_RESERVE_PAGES pages without one, and bounds checks every access
+// instead. Reservations are capped at MEM64_MAX_RESERVE_PAGES (the 47-bit
+// user address space); a larger minimum fails instantiation.
+#define MEM64_RESERVE_PAGES     (1 << 20)
+#define MEM64_MAX_RESERVE_PAGES ((uint64_t)1 << 31)
+
+// Pages backing linear memory, chosen per store with store_t.mem_backing.
+// Huge pages cut TLB misses of guests touching large memories.
+// ref: https://www.kernel.org/doc/html/latest/admin-guide/mm/transhuge.html
+// ref: https://www.kernel.org/doc/html/latest/admin-guide/mm/hugetlbpage.html
+#define MEM_BACKING_PAGES   0   // base pages
+#define MEM_BACKING_THP     1   // transparent huge pages (MADV_HUGEPAGE)
+#define MEM_BACKING_HUGETLB 2   // the hugetlb pool (MAP_HUGETLB), base pages once it runs out
+#define HUGE_PAGE_SIZE      (2 * 1024 * 1024)
+
+// reservations of released memories kept for reuse (see release_instance);
+// the pool never holds more, the others are unmapped
+#define MEM_POOL_SIZE       64
+
+// counters of memory.grow, which maps the new pages to the zero page at once
+typedef struct {
+    uint64_t        grows;
+    uint64_t        pages_grown;
+    // time spent making the new pages accessible
+    uint64_t        grow_ns;
+    // time spent read faulting them (paid on first touch otherwise)
+    uint64_t        touch_ns;
+} memstats_t;
+
 typedef struct {
     memtype_t       type;
     size_t          num_pages;
-    uint8_t ***     table2[4];
+    uint8_t         *data;
+    // bytes reserved at data
+    size_t          reserve_size;
+    // bytes at data mapped from the memory image of the module
+    size_t          image_size;
+    // MEM_BACKING_*
+    uint32_t        backing;
+    memstats_t      stats;
 } meminst_t;
 
 typedef struct {
@@ -144,8 +176,23 @@ typedef struct {
     VECTOR(eleminst_t)      elems;
     VECTOR(datainst_t)      datas;
     stack_t                 *stack;
+    // code executed by the functions called in this store
+    uint32_t                tier;
+    // hotness at which TIER_TIERED compiles a function in the background
+    uint32_t                hot_threshold;
+    struct tierup           *tierup;
+    // pages backing the memories allocated from now on (MEM_BACKING_*)
+    uint32_t                mem_backing;
 } store_t;
 
+// execution tiers
+#define TIER_STACK      0   // stack code (compile_func)
+#define TIER_REGISTER   1   // register code (compile_func_reg)
+#define TIER_JIT        2   // native code (jit_compile), or stack code as a fallback
+#define TIER_TIERED     3   // stack code, then native code once hot (see tierup.h)
+
+#define HOT_THRESHOLD   1000
+
 typedef struct {
     valtype_t   type;
     val_t       val;
@@ -155,13 +202,21 @@ typedef VECTOR(arg_t) args_t;
 
 void new_stack(stack_t **d);
 error_t push_val(stack_t *stack, val_t val);
-error_t push_label(stack_t *stack, label_t label);
 error_t push_frame(stack_t *stack, frame_t frame);
 void pop_val(stack_t *stack, val_t *val);
-void pop_vals(stack_t *stack, vals_t *vals);
-void pop_label(stack_t *stack, label_t *label);
 void pop_frame(stack_t *stack, frame_t *frame);
 
 store_t *new_store(void);
 error_t instantiate(store_t *S, module_t *module, externvals_t *externvals, moduleinst_t **inst);
-error_t invoke(store_t *S, funcaddr_t funcaddr, args_t *args);
\ No newline at end of file
+error_t invoke(store_t *S, funcaddr_t funcaddr, args_t *args);
+void release_instance(store_t *S, moduleinst_t *inst);
+error_t load_aot(store_t *S, moduleinst_t *inst, const char *path);
+
+// Host access to the memory at a memaddr (e.g. the value of an exported memory).
+// mem_data gives its base and current size for zero-copy I/O; the others check
+// bounds and fail with ERR_TRAP_OUT_OF_BOUNDS_MEMORY_ACCESS like the guest would.
+uint8_t *mem_data(store_t *S, memaddr_t memaddr, uint64_t *size);
+error_t mem_read(store_t *S, memaddr_t memaddr, uint64_t a, void *dst, uint64_t n);
+error_t mem_write(store_t *S, memaddr_t memaddr, uint64_t a, const void *src, uint64_t n);
+error_t mem_copy(store_t *S, memaddr_t dst, uint64_t d, memaddr_t src, uint64_t s, uint64_t n);
+void dump_superinstr_hits(void);
\ No newline at end of file
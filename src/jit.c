@@ -0,0 +1,787 @@
+#include "jit.h"
+#include "compile.h"
+#include "print.h"
+#include "exception.h"
+#include "memory.h"
+
+#include <string.h>
+#include <sys/mman.h>
+
+#if defined(__x86_64__)
+
+// ref: https://www.intel.com/content/www/us/en/developer/articles/technical/intel-sdm.html
+// ref: https://wiki.osdev.org/X86-64_Instruction_Encoding
+
+// registers
+enum {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8,  R9,  R10, R11, R12, R13, R14, R15
+};
+
+#define REG_LOCALS      RBX
+#define REG_MEM         RBP
+#define REG_SP          R12
+#define REG_STORE       R13
+#define REG_MODULE      R14
+#define REG_SAVE        R15
+
+// condition codes of jcc, setcc and cmovcc
+enum {
+    CC_O, CC_NO, CC_B, CC_AE, CC_E, CC_NE, CC_BE, CC_A,
+    CC_S, CC_NS, CC_P, CC_NP, CC_L, CC_GE, CC_LE, CC_G
+};
+
+// jmp instead of jcc
+#define CC_ALWAYS       -1
+
+// rel32 of a jump to a cell of the flat code, patched once the code is compiled
+typedef struct {
+    uint32_t    pos;
+    uint32_t    target;
+} fixup_t;
+
+typedef struct {
+    VECTOR(uint8_t)     buf;
+    // native offset of each cell starting an instruction
+    uint32_t            *offsets;
+    VECTOR(fixup_t)     fixups;
+    // offset of the operands from the locals
+    int32_t             base;
+    // the module has a memory 0, whose base the prologue loads into REG_MEM
+    bool                has_mem;
+    // shared code ahead of the function body
+    uint32_t            exit;           // return to the caller
+    uint32_t            exit_err;       // return the error in eax
+    uint32_t            trap_unreachable;
+    uint32_t            trap_div;
+    uint32_t            trap_overflow;
+} jit_t;
+
+// operand n below the top, and local i
+#define OPD(n)          (-8 * ((n) + 1))
+#define LOCAL(i)        (8 * (int32_t)(i))
+
+static inline void emit8(jit_t *j, uint8_t b) {
+    VECTOR_APPEND(&j->buf, b);
+}
+
+static inline void emit32(jit_t *j, uint32_t v) {
+    for(int i = 0; i < 4; i++)
+        emit8(j, v >> (8 * i));
+}
+
+static inline void emit64(jit_t *j, uint64_t v) {
+    emit32(j, v);
+    emit32(j, v >> 32);
+}
+
+static inline void patch32(jit_t *j, uint32_t pos, uint32_t v) {
+    memcpy(&j->buf.elem[pos], &v, sizeof(v));
+}
+
+static inline bool is_imm8(int32_t v) {
+    return -128 <= v && v <= 127;
+}
+
+static void emit_rex(jit_t *j, bool w, int reg, int rm) {
+    uint8_t rex = 0x40 | w << 3 | (reg >> 3) << 2 | (rm >> 3);
+    if(rex != 0x40)
+        emit8(j, rex);
+}
+
+// opcode bytes, most significant first (0x0FAF is 0F AF)
+static void emit_opcode(jit_t *j, uint32_t op) {
+    if(op > 0xff)
+        emit8(j, op >> 8);
+    emit8(j, op);
+}
+
+// op reg, [base + disp] (prefix 0 is none, reg is the opcode extension of group opcodes)
+static void emit_mem(jit_t *j, uint8_t prefix, bool w, uint32_t op, int reg, int base, int32_t disp) {
+    if(prefix)
+        emit8(j, prefix);
+    emit_rex(j, w, reg, base);
+    emit_opcode(j, op);
+    emit8(j, (is_imm8(disp) ? 0x40 : 0x80) | (reg & 7) << 3 | (base & 7));
+    // rsp and r12 need a SIB byte
+    if((base & 7) == RSP)
+        emit8(j, 0x24);
+    if(is_imm8(disp))
+        emit8(j, disp);
+    else
+        emit32(j, disp);
+}
+
+// op reg, rm
+static void emit_reg(jit_t *j, uint8_t prefix, bool w, uint32_t op, int reg, int rm) {
+    if(prefix)
+        emit8(j, prefix);
+    emit_rex(j, w, reg, rm);
+    emit_opcode(j, op);
+    emit8(j, 0xc0 | (reg & 7) << 3 | (rm & 7));
+}
+
+// op rm, imm of the 0x81 group (0: add, 4: and, 5: sub, 6: xor, 7: cmp)
+static void emit_alu_imm(jit_t *j, bool w, int ext, int rm, int32_t imm) {
+    emit_reg(j, 0, w, is_imm8(imm) ? 0x83 : 0x81, ext, rm);
+    if(is_imm8(imm))
+        emit8(j, imm);
+    else
+        emit32(j, imm);
+}
+
+// mov reg, imm (a 32bit mov clears the upper half)
+static void emit_mov_imm(jit_t *j, int reg, uint64_t imm) {
+    bool w = imm > UINT32_MAX;
+    emit_rex(j, w, 0, reg);
+    emit8(j, 0xb8 + (reg & 7));
+    if(w)
+        emit64(j, imm);
+    else
+        emit32(j, imm);
+}
+
+static inline void load_opd(jit_t *j, bool w, int reg, int n) {
+    emit_mem(j, 0, w, 0x8b, reg, REG_SP, OPD(n));
+}
+
+// operands are stored as whole slots (-1 is the slot above the top)
+static inline void store_opd(jit_t *j, int reg, int n) {
+    emit_mem(j, 0, true, 0x89, reg, REG_SP, OPD(n));
+}
+
+// push (n > 0) or pop (n < 0) operands, keeping the flags
+static inline void adjust_sp(jit_t *j, int n) {
+    emit_mem(j, 0, true, 0x8d, REG_SP, REG_SP, 8 * n);
+}
+
+// push rax
+static inline void push_rax(jit_t *j) {
+    store_opd(j, RAX, -1);
+    adjust_sp(j, 1);
+}
+
+// jmp or jcc with a rel32 to patch, returns the position of the rel32
+static uint32_t emit_jump(jit_t *j, int cc) {
+    if(cc == CC_ALWAYS) {
+        emit8(j, 0xe9);
+    } else {
+        emit8(j, 0x0f);
+        emit8(j, 0x80 + cc);
+    }
+    emit32(j, 0);
+    return j->buf.len - 4;
+}
+
+static inline void patch_jump(jit_t *j, uint32_t pos, uint32_t to) {
+    patch32(j, pos, to - (pos + 4));
+}
+
+static inline void emit_jump_to(jit_t *j, int cc, uint32_t to) {
+    patch_jump(j, emit_jump(j, cc), to);
+}
+
+static inline void emit_jump_cell(jit_t *j, int cc, uint32_t cell) {
+    fixup_t f = {.pos = emit_jump(j, cc), .target = cell};
+    VECTOR_APPEND(&j->fixups, f);
+}
+
+// call a runtime helper with the store and the module instance as the first arguments
+static void emit_call(jit_t *j, void *fn) {
+    emit_reg(j, 0, true, 0x89, REG_STORE, RDI);
+    emit_reg(j, 0, true, 0x89, REG_MODULE, RSI);
+    emit_mov_imm(j, RAX, (uint64_t)fn);
+    emit_reg(j, 0, false, 0xff, 2, RAX);
+}
+
+// call a helper that may change the operand stack and return an error
+static void emit_call_sync(jit_t *j, void *fn) {
+    emit_mem(j, 0, true, 0x89, REG_SP, REG_SAVE, 0);
+    emit_call(j, fn);
+    emit_reg(j, 0, false, 0x85, RAX, RAX);
+    emit_jump_to(j, CC_NE, j->exit_err);
+    emit_mem(j, 0, true, 0x8b, REG_SP, REG_SAVE, 0);
+}
+
+// address of edx + offset in memory 0 in rax
+// (out-of-bounds accesses fault in the guard region of the memory)
+static void emit_mem_addr(jit_t *j, uint32_t offset) {
+    emit_reg(j, 0, true, 0x89, REG_MEM, RAX);
+    emit_reg(j, 0, true, 0x01, RDX, RAX);
+    if(offset > INT32_MAX) {
+        emit_mov_imm(j, RDX, offset);
+        emit_reg(j, 0, true, 0x01, RDX, RAX);
+    }
+    else if(offset) {
+        emit_alu_imm(j, true, 0, RAX, offset);
+    }
+}
+
+// keep the top arity operands at height, then jump to the target
+// (code[cell] is "target height arity" of the branch)
+static void emit_br(jit_t *j, uint32_t *code, uint32_t cell) {
+    uint32_t height = code[cell + 1];
+    uint32_t arity  = code[cell + 2];
+
+    for(uint32_t i = 0; i < arity; i++) {
+        load_opd(j, true, RAX, arity - 1 - i);
+        emit_mem(j, 0, true, 0x89, RAX, REG_LOCALS, j->base + 8 * (height + i));
+    }
+    emit_mem(j, 0, true, 0x8d, REG_SP, REG_LOCALS, j->base + 8 * (height + arity));
+    emit_jump_cell(j, CC_ALWAYS, cell + (int32_t)code[cell]);
+}
+
+// branch if the condition code does not hold
+static void emit_br_unless(jit_t *j, int cc, uint32_t *code, uint32_t cell) {
+    uint32_t skip = emit_jump(j, cc);
+    emit_br(j, code, cell);
+    patch_jump(j, skip, j->buf.len);
+}
+
+// op eax, [top] over the two top operands
+static void emit_binop(jit_t *j, bool w, uint32_t op) {
+    load_opd(j, w, RAX, 1);
+    emit_mem(j, 0, w, op, RAX, REG_SP, OPD(0));
+    store_opd(j, RAX, 1);
+    adjust_sp(j, -1);
+}
+
+static void emit_shift(jit_t *j, bool w, int ext) {
+    load_opd(j, false, RCX, 0);
+    load_opd(j, w, RAX, 1);
+    emit_reg(j, 0, w, 0xd3, ext, RAX);
+    store_opd(j, RAX, 1);
+    adjust_sp(j, -1);
+}
+
+// setcc al; movzx eax, al
+static void emit_setcc(jit_t *j, int cc) {
+    emit_reg(j, 0, false, 0x0f90 + cc, 0, RAX);
+    emit_reg(j, 0, false, 0x0fb6, RAX, RAX);
+}
+
+static void emit_cmp(jit_t *j, bool w, int cc) {
+    load_opd(j, w, RAX, 1);
+    emit_mem(j, 0, w, 0x3b, RAX, REG_SP, OPD(0));
+    emit_setcc(j, cc);
+    store_opd(j, RAX, 1);
+    adjust_sp(j, -1);
+}
+
+static void emit_eqz(jit_t *j, bool w) {
+    load_opd(j, w, RAX, 0);
+    emit_reg(j, 0, w, 0x85, RAX, RAX);
+    emit_setcc(j, CC_E);
+    store_opd(j, RAX, 0);
+}
+
+// see DIV_S, DIV_U, REM_S and REM_U
+static void emit_divrem(jit_t *j, bool w, bool sign, bool rem) {
+    load_opd(j, w, RCX, 0);
+    emit_reg(j, 0, w, 0x85, RCX, RCX);
+    emit_jump_to(j, CC_E, j->trap_div);
+    load_opd(j, w, RAX, 1);
+
+    if(sign) {
+        // INT_MIN / -1 overflows, and x % -1 is x % 1
+        emit_alu_imm(j, w, 7, RCX, -1);
+        uint32_t skip = emit_jump(j, CC_NE);
+        if(rem) {
+            emit_mov_imm(j, RCX, 1);
+        } else {
+            emit_mov_imm(j, RDX, w ? (uint64_t)INT64_MIN : (uint32_t)INT32_MIN);
+            emit_reg(j, 0, w, 0x3b, RAX, RDX);
+            emit_jump_to(j, CC_E, j->trap_overflow);
+        }
+        patch_jump(j, skip, j->buf.len);
+        // cdq or cqo, then idiv
+        emit_rex(j, w, 0, 0);
+        emit8(j, 0x99);
+        emit_reg(j, 0, w, 0xf7, 7, RCX);
+    } else {
+        emit_reg(j, 0, false, 0x31, RDX, RDX);
+        emit_reg(j, 0, w, 0xf7, 6, RCX);
+    }
+    store_opd(j, rem ? RDX : RAX, 1);
+    adjust_sp(j, -1);
+}
+
+// clz and ctz with bsr and bsf, which set ZF for zero
+static void emit_clz(jit_t *j, bool w) {
+    // 31 - bsr(x), or 32 for zero (and the same for 64bit)
+    emit_mov_imm(j, RCX, w ? 127 : 63);
+    emit_mem(j, 0, w, 0x0fbd, RAX, REG_SP, OPD(0));
+    emit_reg(j, 0, w, 0x0f44, RAX, RCX);
+    emit_alu_imm(j, w, 6, RAX, w ? 63 : 31);
+    store_opd(j, RAX, 0);
+}
+
+static void emit_ctz(jit_t *j, bool w) {
+    emit_mov_imm(j, RCX, w ? 64 : 32);
+    emit_mem(j, 0, w, 0x0fbc, RAX, REG_SP, OPD(0));
+    emit_reg(j, 0, w, 0x0f44, RAX, RCX);
+    store_opd(j, RAX, 0);
+}
+
+// unary operators loading the top operand with an extending mov
+static void emit_extend(jit_t *j, bool w, uint32_t op) {
+    emit_mem(j, 0, w, op, RAX, REG_SP, OPD(0));
+    store_opd(j, RAX, 0);
+}
+
+// loads: the mov from memory, like the CT of LOAD in exec.c
+typedef struct {
+    bool        w;
+    uint32_t    op;
+    uint32_t    size;
+} jit_load_t;
+
+static const jit_load_t loads[] = {
+    [OP_I32_LOAD     - OP_I32_LOAD] = {false, 0x8b,   4},
+    [OP_I64_LOAD     - OP_I32_LOAD] = {true,  0x8b,   8},
+    [OP_F32_LOAD     - OP_I32_LOAD] = {false, 0x8b,   4},
+    [OP_F64_LOAD     - OP_I32_LOAD] = {true,  0x8b,   8},
+    [OP_I32_LOAD8_S  - OP_I32_LOAD] = {false, 0x0fbe, 1},
+    [OP_I32_LOAD8_U  - OP_I32_LOAD] = {false, 0x0fb6, 1},
+    [OP_I32_LOAD16_S - OP_I32_LOAD] = {false, 0x0fbf, 2},
+    [OP_I32_LOAD16_U - OP_I32_LOAD] = {false, 0x0fb7, 2},
+    [OP_I64_LOAD8_S  - OP_I32_LOAD] = {true,  0x0fbe, 1},
+    [OP_I64_LOAD8_U  - OP_I32_LOAD] = {false, 0x0fb6, 1},
+    [OP_I64_LOAD16_S - OP_I32_LOAD] = {true,  0x0fbf, 2},
+    [OP_I64_LOAD16_U - OP_I32_LOAD] = {false, 0x0fb7, 2},
+    [OP_I64_LOAD32_S - OP_I32_LOAD] = {true,  0x63,   4},
+    [OP_I64_LOAD32_U - OP_I32_LOAD] = {false, 0x8b,   4},
+};
+
+// stores: the size stored from rcx
+static const uint32_t stores[] = {
+    [OP_I32_STORE   - OP_I32_STORE] = 4,
+    [OP_I64_STORE   - OP_I32_STORE] = 8,
+    [OP_F32_STORE   - OP_I32_STORE] = 4,
+    [OP_F64_STORE   - OP_I32_STORE] = 8,
+    [OP_I32_STORE8  - OP_I32_STORE] = 1,
+    [OP_I32_STORE16 - OP_I32_STORE] = 2,
+    [OP_I64_STORE8  - OP_I32_STORE] = 1,
+    [OP_I64_STORE16 - OP_I32_STORE] = 2,
+    [OP_I64_STORE32 - OP_I32_STORE] = 4,
+};
+
+// code shared by the function body: the prologue jumps over it
+static void emit_prologue(jit_t *j) {
+    // push rbx, rbp, r12-r15 and keep rsp aligned for calls
+    emit8(j, 0x53);
+    emit8(j, 0x55);
+    for(int r = R12; r <= R15; r++) {
+        emit_rex(j, false, 0, r);
+        emit8(j, 0x50 + (r & 7));
+    }
+    emit_alu_imm(j, true, 5, RSP, 8);
+    emit_reg(j, 0, true, 0x89, RDI, REG_STORE);
+    emit_reg(j, 0, true, 0x89, RSI, REG_MODULE);
+    emit_reg(j, 0, true, 0x89, RDX, REG_LOCALS);
+    emit_reg(j, 0, true, 0x89, RCX, REG_SAVE);
+    emit_mem(j, 0, true, 0x8b, REG_SP, REG_SAVE, 0);
+
+    // REG_MEM = S->mems.elem[module->memaddrs[0]].data, which stays put as
+    // the memory grows
+    if(j->has_mem) {
+        emit_mem(j, 0, true, 0x8b, RAX, REG_MODULE, offsetof(moduleinst_t, memaddrs));
+        emit_mem(j, 0, false, 0x8b, RAX, RAX, 0);
+        emit_reg(j, 0, true, 0x69, RAX, RAX);
+        emit32(j, sizeof(meminst_t));
+        emit_mem(j, 0, true, 0x03, RAX, REG_STORE, offsetof(store_t, mems.elem));
+        emit_mem(j, 0, true, 0x8b, REG_MEM, RAX, offsetof(meminst_t, data));
+    }
+    uint32_t body = emit_jump(j, CC_ALWAYS);
+
+    struct {
+        uint32_t    *pos;
+        error_t     err;
+    } traps[] = {
+        {&j->trap_unreachable,  ERR_TRAP_UNREACHABLE},
+        {&j->trap_div,          ERR_TRAP_INTERGER_DIVIDE_BY_ZERO},
+        {&j->trap_overflow,     ERR_TRAP_INTERGET_OVERFLOW},
+    };
+    uint32_t exits[3];
+    for(int i = 0; i < 3; i++) {
+        *traps[i].pos = j->buf.len;
+        emit_mov_imm(j, RAX, (uint32_t)traps[i].err);
+        exits[i] = emit_jump(j, CC_ALWAYS);
+    }
+
+    // save the operand stack pointer for the caller
+    j->exit = j->buf.len;
+    emit_mem(j, 0, true, 0x89, REG_SP, REG_SAVE, 0);
+    emit_reg(j, 0, false, 0x31, RAX, RAX);
+
+    j->exit_err = j->buf.len;
+    for(int i = 0; i < 3; i++)
+        patch_jump(j, exits[i], j->exit_err);
+    emit_mem(j, 0, true, 0x8d, RSP, RSP, 8);
+    for(int r = R15; r >= R12; r--) {
+        emit_rex(j, false, 0, r);
+        emit8(j, 0x58 + (r & 7));
+    }
+    emit8(j, 0x5d);
+    emit8(j, 0x5b);
+    emit8(j, 0xc3);
+
+    patch_jump(j, body, j->buf.len);
+}
+
+static error_t jit_code(jit_t *j, code_t *code) {
+    __try {
+        uint32_t *c = code->elem;
+
+        for(uint32_t i = 0; i < code->len; ) {
+            j->offsets[i] = j->buf.len;
+            uint32_t op = c[i++];
+
+            switch(op) {
+                case OP_NOP:
+                    break;
+
+                case OP_UNREACHABLE:
+                    emit_jump_to(j, CC_ALWAYS, j->trap_unreachable);
+                    break;
+
+                case OP_IF:
+                    load_opd(j, false, RAX, 0);
+                    adjust_sp(j, -1);
+                    emit_reg(j, 0, false, 0x85, RAX, RAX);
+                    emit_jump_cell(j, CC_E, i + (int32_t)c[i]);
+                    i++;
+                    break;
+
+                case OP_ELSE:
+                    emit_jump_cell(j, CC_ALWAYS, i + (int32_t)c[i]);
+                    i++;
+                    break;
+
+                case OP_BR:
+                    emit_br(j, c, i);
+                    i += 3;
+                    break;
+
+                case OP_BR_IF:
+                    load_opd(j, false, RAX, 0);
+                    adjust_sp(j, -1);
+                    emit_reg(j, 0, false, 0x85, RAX, RAX);
+                    emit_br_unless(j, CC_E, c, i);
+                    i += 3;
+                    break;
+
+                case OP_BR_TABLE: {
+                    // compare the index with each label in turn
+                    uint32_t n = c[i++];
+                    load_opd(j, false, RCX, 0);
+                    adjust_sp(j, -1);
+                    for(uint32_t k = 0; k < n; k++) {
+                        emit_alu_imm(j, false, 7, RCX, k);
+                        emit_br_unless(j, CC_NE, c, i + 3 * k);
+                    }
+                    emit_br(j, c, i + 3 * n);
+                    i += 3 * (n + 1);
+                    break;
+                }
+
+                case OP_RETURN:
+                    emit_jump_to(j, CC_ALWAYS, j->exit);
+                    break;
+
+                case OP_CALL:
+                    emit_reg(j, 0, true, 0x89, REG_SAVE, RDX);
+                    emit_mov_imm(j, RCX, c[i++]);
+                    emit_call_sync(j, jit_call);
+                    break;
+
+                case OP_CALL_INDIRECT:
+                    load_opd(j, false, R9, 0);
+                    adjust_sp(j, -1);
+                    emit_reg(j, 0, true, 0x89, REG_SAVE, RDX);
+                    emit_mov_imm(j, RCX, c[i++]);
+                    emit_mov_imm(j, R8, c[i++]);
+                    emit_call_sync(j, jit_call_indirect);
+                    break;
+
+                case OP_DROP:
+                    adjust_sp(j, -1);
+                    break;
+
+                case OP_SELECT:
+                case OP_SELECT_T:
+                    load_opd(j, false, RCX, 0);
+                    load_opd(j, true, RAX, 2);
+                    emit_reg(j, 0, false, 0x85, RCX, RCX);
+                    emit_mem(j, 0, true, 0x0f44, RAX, REG_SP, OPD(1));
+                    store_opd(j, RAX, 2);
+                    adjust_sp(j, -2);
+                    break;
+
+                case OP_LOCAL_GET:
+                    emit_mem(j, 0, true, 0x8b, RAX, REG_LOCALS, LOCAL(c[i++]));
+                    push_rax(j);
+                    break;
+
+                case OP_LOCAL_SET:
+                    load_opd(j, true, RAX, 0);
+                    emit_mem(j, 0, true, 0x89, RAX, REG_LOCALS, LOCAL(c[i++]));
+                    adjust_sp(j, -1);
+                    break;
+
+                case OP_LOCAL_TEE:
+                    load_opd(j, true, RAX, 0);
+                    emit_mem(j, 0, true, 0x89, RAX, REG_LOCALS, LOCAL(c[i++]));
+                    break;
+
+                case OP_GLOBAL_GET:
+                    emit_mov_imm(j, RDX, c[i++]);
+                    emit_call(j, jit_global);
+                    emit_mem(j, 0, true, 0x8b, RAX, RAX, 0);
+                    push_rax(j);
+                    break;
+
+                case OP_GLOBAL_SET:
+                    emit_mov_imm(j, RDX, c[i++]);
+                    emit_call(j, jit_global);
+                    load_opd(j, true, RCX, 0);
+                    emit_mem(j, 0, true, 0x89, RCX, RAX, 0);
+                    adjust_sp(j, -1);
+                    break;
+
+                case OP_I32_LOAD ... OP_I64_LOAD32_U: {
+                    const jit_load_t *l = &loads[op - OP_I32_LOAD];
+                    load_opd(j, false, RDX, 0);
+                    emit_mem_addr(j, c[i++]);
+                    emit_mem(j, 0, l->w, l->op, RAX, RAX, 0);
+                    store_opd(j, RAX, 0);
+                    break;
+                }
+
+                case OP_I32_STORE ... OP_I64_STORE32: {
+                    uint32_t size = stores[op - OP_I32_STORE];
+                    load_opd(j, false, RDX, 1);
+                    emit_mem_addr(j, c[i++]);
+                    load_opd(j, true, RCX, 0);
+                    emit_mem(j, size == 2 ? 0x66 : 0, size == 8, size == 1 ? 0x88 : 0x89, RCX, RAX, 0);
+                    adjust_sp(j, -2);
+                    break;
+                }
+
+                case OP_MEMORY_SIZE:
+                    emit_call(j, jit_memory_size);
+                    emit_reg(j, 0, false, 0x89, RAX, RAX);
+                    push_rax(j);
+                    break;
+
+                case OP_MEMORY_GROW:
+                    load_opd(j, false, RDX, 0);
+                    emit_call(j, jit_memory_grow);
+                    emit_reg(j, 0, false, 0x89, RAX, RAX);
+                    store_opd(j, RAX, 0);
+                    break;
+
+                // float constants are stored as their bit patterns
+                case OP_I32_CONST:
+                case OP_F32_CONST:
+                    emit_mov_imm(j, RAX, c[i++]);
+                    push_rax(j);
+                    break;
+
+                case OP_I64_CONST:
+                case OP_F64_CONST:
+                    emit_rex(j, true, 0, RAX);
+                    emit8(j, 0xb8);
+                    emit32(j, c[i++]);
+                    emit32(j, c[i++]);
+                    push_rax(j);
+                    break;
+
+                case OP_I32_EQZ:    emit_eqz(j, false);             break;
+                case OP_I64_EQZ:    emit_eqz(j, true);              break;
+
+                case OP_I32_EQ:     emit_cmp(j, false, CC_E);       break;
+                case OP_I32_NE:     emit_cmp(j, false, CC_NE);      break;
+                case OP_I32_LT_S:   emit_cmp(j, false, CC_L);       break;
+                case OP_I32_LT_U:   emit_cmp(j, false, CC_B);       break;
+                case OP_I32_GT_S:   emit_cmp(j, false, CC_G);       break;
+                case OP_I32_GT_U:   emit_cmp(j, false, CC_A);       break;
+                case OP_I32_LE_S:   emit_cmp(j, false, CC_LE);      break;
+                case OP_I32_LE_U:   emit_cmp(j, false, CC_BE);      break;
+                case OP_I32_GE_S:   emit_cmp(j, false, CC_GE);      break;
+                case OP_I32_GE_U:   emit_cmp(j, false, CC_AE);      break;
+                case OP_I64_EQ:     emit_cmp(j, true, CC_E);        break;
+                case OP_I64_NE:     emit_cmp(j, true, CC_NE);       break;
+                case OP_I64_LT_S:   emit_cmp(j, true, CC_L);        break;
+                case OP_I64_LT_U:   emit_cmp(j, true, CC_B);        break;
+                case OP_I64_GT_S:   emit_cmp(j, true, CC_G);        break;
+                case OP_I64_GT_U:   emit_cmp(j, true, CC_A);        break;
+                case OP_I64_LE_S:   emit_cmp(j, true, CC_LE);       break;
+                case OP_I64_LE_U:   emit_cmp(j, true, CC_BE);       break;
+                case OP_I64_GE_S:   emit_cmp(j, true, CC_GE);       break;
+                case OP_I64_GE_U:   emit_cmp(j, true, CC_AE);       break;
+
+                case OP_I32_CLZ:    emit_clz(j, false);             break;
+                case OP_I32_CTZ:    emit_ctz(j, false);             break;
+                case OP_I64_CLZ:    emit_clz(j, true);              break;
+                case OP_I64_CTZ:    emit_ctz(j, true);              break;
+
+                case OP_I32_POPCNT:
+                case OP_I64_POPCNT:
+                    __throwif(ERR_FAILED, !__builtin_cpu_supports("popcnt"));
+                    emit_mem(j, 0xf3, op == OP_I64_POPCNT, 0x0fb8, RAX, REG_SP, OPD(0));
+                    store_opd(j, RAX, 0);
+                    break;
+
+                case OP_I32_ADD:    emit_binop(j, false, 0x03);     break;
+                case OP_I32_SUB:    emit_binop(j, false, 0x2b);     break;
+                case OP_I32_MUL:    emit_binop(j, false, 0x0faf);   break;
+                case OP_I32_AND:    emit_binop(j, false, 0x23);     break;
+                case OP_I32_OR:     emit_binop(j, false, 0x0b);     break;
+                case OP_I32_XOR:    emit_binop(j, false, 0x33);     break;
+                case OP_I64_ADD:    emit_binop(j, true, 0x03);      break;
+                case OP_I64_SUB:    emit_binop(j, true, 0x2b);      break;
+                case OP_I64_MUL:    emit_binop(j, true, 0x0faf);    break;
+                case OP_I64_AND:    emit_binop(j, true, 0x23);      break;
+                case OP_I64_OR:     emit_binop(j, true, 0x0b);      break;
+                case OP_I64_XOR:    emit_binop(j, true, 0x33);      break;
+
+                case OP_I32_DIV_S:  emit_divrem(j, false, true, false);  break;
+                case OP_I32_DIV_U:  emit_divrem(j, false, false, false); break;
+                case OP_I32_REM_S:  emit_divrem(j, false, true, true);   break;
+                case OP_I32_REM_U:  emit_divrem(j, false, false, true);  break;
+                case OP_I64_DIV_S:  emit_divrem(j, true, true, false);   break;
+                case OP_I64_DIV_U:  emit_divrem(j, true, false, false);  break;
+                case OP_I64_REM_S:  emit_divrem(j, true, true, true);    break;
+                case OP_I64_REM_U:  emit_divrem(j, true, false, true);   break;
+
+                // the count is masked like in wasm
+                case OP_I32_SHL:    emit_shift(j, false, 4);        break;
+                case OP_I32_SHR_S:  emit_shift(j, false, 7);        break;
+                case OP_I32_SHR_U:  emit_shift(j, false, 5);        break;
+                case OP_I32_ROTL:   emit_shift(j, false, 0);        break;
+                case OP_I32_ROTR:   emit_shift(j, false, 1);        break;
+                case OP_I64_SHL:    emit_shift(j, true, 4);         break;
+                case OP_I64_SHR_S:  emit_shift(j, true, 7);         break;
+                case OP_I64_SHR_U:  emit_shift(j, true, 5);         break;
+                case OP_I64_ROTL:   emit_shift(j, true, 0);         break;
+                case OP_I64_ROTR:   emit_shift(j, true, 1);         break;
+
+                case OP_I32_WRAP_I64:
+                case OP_I64_EXTEND_I32_U:
+                    emit_extend(j, false, 0x8b);
+                    break;
+
+                case OP_I64_EXTEND_I32_S:
+                case OP_I64_EXTEND32_S:
+                    emit_extend(j, true, 0x63);
+                    break;
+
+                case OP_I32_EXTEND8_S:  emit_extend(j, false, 0x0fbe);  break;
+                case OP_I32_EXTEND16_S: emit_extend(j, false, 0x0fbf);  break;
+                case OP_I64_EXTEND8_S:  emit_extend(j, true, 0x0fbe);   break;
+                case OP_I64_EXTEND16_S: emit_extend(j, true, 0x0fbf);   break;
+
+                // operands keep their bits
+                case OP_I32_REINTERPRET_F32:
+                case OP_I64_REINTERPRET_F64:
+                case OP_F32_REINTERPRET_I32:
+                case OP_F64_REINTERPRET_I64:
+                    break;
+
+                case OP_S_LOCAL_LOCAL_I32_ADD:
+                    emit_mem(j, 0, false, 0x8b, RAX, REG_LOCALS, LOCAL(c[i++]));
+                    emit_mem(j, 0, false, 0x03, RAX, REG_LOCALS, LOCAL(c[i++]));
+                    push_rax(j);
+                    break;
+
+                case OP_S_LOCAL_CONST_I32_ADD:
+                    emit_mem(j, 0, false, 0x8b, RAX, REG_LOCALS, LOCAL(c[i++]));
+                    emit_alu_imm(j, false, 0, RAX, c[i++]);
+                    push_rax(j);
+                    break;
+
+                case OP_S_I32_EQZ_BR_IF:
+                    load_opd(j, false, RAX, 0);
+                    adjust_sp(j, -1);
+                    emit_reg(j, 0, false, 0x85, RAX, RAX);
+                    emit_br_unless(j, CC_NE, c, i);
+                    i += 3;
+                    break;
+
+                case OP_S_I32_LT_S_BR_IF:
+                    load_opd(j, false, RAX, 1);
+                    emit_mem(j, 0, false, 0x3b, RAX, REG_SP, OPD(0));
+                    adjust_sp(j, -2);
+                    emit_br_unless(j, CC_GE, c, i);
+                    i += 3;
+                    break;
+
+                case OP_S_LOCAL_I32_LOAD:
+                    emit_mem(j, 0, false, 0x8b, RDX, REG_LOCALS, LOCAL(c[i++]));
+                    emit_mem_addr(j, c[i++]);
+                    emit_mem(j, 0, false, 0x8b, RAX, RAX, 0);
+                    push_rax(j);
+                    break;
+
+                default:
+                    __throw(ERR_FAILED);
+            }
+        }
+
+        VECTOR_FOR_EACH(f, &j->fixups) {
+            patch_jump(j, f->pos, j->offsets[f->target]);
+        }
+    }
+    __catch:
+        return err;
+}
+
+// compile the flat code of func into func->jitcode
+// ERR_FAILED is returned if the function uses an instruction the JIT does not support.
+error_t jit_compile(module_t *mod, func_t *func) {
+    jit_t j = {.offsets = NULL};
+    VECTOR_INIT(&j.buf);
+    VECTOR_INIT(&j.fixups);
+
+    __try {
+        functype_t *type = VECTOR_ELEM(&mod->types, func->type);
+        __throwif(ERR_FAILED, !type);
+        j.base = 8 * (type->rt1.len + func->locals.len);
+        j.has_mem = mod->num_mem_imports + mod->mems.len > 0;
+
+        __throwiferr(VECTOR_NEW(&j.buf, 0, 256));
+        __throwiferr(VECTOR_NEW(&j.fixups, 0, 16));
+        j.offsets = calloc(func->code.len, sizeof(uint32_t));
+        __throwif(ERR_FAILED, !j.offsets);
+
+        emit_prologue(&j);
+        __throwiferr(jit_code(&j, &func->code));
+
+        // copy the code to executable pages
+        void *p = mmap(NULL, j.buf.len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        __throwif(ERR_FAILED, p == MAP_FAILED);
+        memcpy(p, j.buf.elem, j.buf.len);
+        if(mprotect(p, j.buf.len, PROT_READ | PROT_EXEC) != 0) {
+            munmap(p, j.buf.len);
+            __throw(ERR_FAILED);
+        }
+        func->jitsize = j.buf.len;
+        // a tiered store may read jitcode while the worker compiles
+        __atomic_store_n(&func->jitcode, p, __ATOMIC_RELEASE);
+    }
+    __catch:
+        free(j.buf.elem);
+        free(j.fixups.elem);
+        free(j.offsets);
+        return err;
+}
+
+#else
+
+// no JIT on other architectures: every function runs as stack code
+error_t jit_compile(module_t *mod, func_t *func) {
+    return ERR_FAILED;
+}
+
+#endif
@@ -0,0 +1,36 @@
+#pragma once
+
+// jit.h defines the baseline JIT of TIER_JIT.
+// jit_compile translates the flat code of a function (see compile.h) into
+// x86-64 machine code in a single pass, one instruction at a time. Operands
+// stay in the value stack, and the native code keeps these in registers:
+//
+//  rbx     locals of the frame
+//  rbp     base of memory 0, if the module has one
+//  r12     operand stack pointer (the slot above the top operand)
+//  r13     store
+//  r14     module instance of the frame
+//  r15     where r12 is saved for the runtime helpers
+//
+// Loads and stores address memory 0 from rbp directly; calls, globals and
+// memory.size/grow go through the runtime helpers below.
+// Functions using other instructions (floating point arithmetic, tables,
+// references, bulk memory, memories other than a 32-bit memory 0) are not
+// compiled and run as stack code instead.
+
+#include "exec.h"
+#include "module.h"
+#include "error.h"
+
+// Native code of a function, called with the frame of the function pushed.
+// Operands are pushed at *sp, which points past the results on return.
+typedef error_t (*jitcode_t)(store_t *S, moduleinst_t *module, val_t *locals, val_t **sp);
+
+error_t jit_compile(module_t *mod, func_t *func);
+
+// runtime helpers called from native code (see exec.c)
+error_t jit_call(store_t *S, moduleinst_t *module, val_t **sp, uint32_t funcidx);
+error_t jit_call_indirect(store_t *S, moduleinst_t *module, val_t **sp, uint32_t typeidx, uint32_t tableidx, uint32_t i);
+val_t *jit_global(store_t *S, moduleinst_t *module, uint32_t globalidx);
+int32_t jit_memory_size(store_t *S, moduleinst_t *module);
+int32_t jit_memory_grow(store_t *S, moduleinst_t *module, int32_t n);
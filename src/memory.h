@@ -7,4 +7,5 @@ void *malloc(size_t size);
 void *calloc(size_t nmemb, size_t size);
 void *realloc(void *ptr, size_t size);
 void free(void *ptr);
-void *memcpy(void *dest, const void *src, size_t n);
\ No newline at end of file
+void *memcpy(void *dest, const void *src, size_t n);
+void *memmove(void *dest, const void *src, size_t n);
\ No newline at end of file
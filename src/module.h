@@ -7,6 +7,7 @@
 #include <stdbool.h>
 #include "vector.h"
 #include "list.h"
+#include "arena.h"
 
 typedef uint8_t     byte_t;
 typedef uint8_t     valtype_t;
@@ -237,7 +238,9 @@ typedef union {
 
 typedef struct {
     uint32_t    align;
-    uint32_t    offset;
+    // 64 bits wide for memory64, at most UINT32_MAX otherwise
+    uint64_t    offset;
+    uint32_t    memidx;
 } memarg_t;
 
 typedef struct instr {
@@ -285,16 +288,47 @@ typedef struct {
 
 typedef instr_t * expr_t;
 
+// flat code lowered from expr_t by compile_func (see compile.h)
+typedef VECTOR(uint32_t) code_t;
+
+// side table entry recorded by the validator for each branch target:
+// the operand stack height of the target label and the number of values it takes
+typedef struct {
+    uint32_t    height;
+    uint32_t    arity;
+} branch_t;
+
+typedef VECTOR(branch_t) sidetable_t;
+
 typedef struct {
     typeidx_t           type;
     VECTOR(valtype_t)   locals;
     expr_t              body;
+    // branch targets in program order (br_table: each label, then the default)
+    sidetable_t         sidetable;
+    code_t              code;
+    // register code, compiled on first use by a store using TIER_REGISTER
+    code_t              regcode;
+    // frame slots used by the register code
+    uint32_t            max_slots;
+    // highest operand stack height, found by the validator
+    uint32_t            max_height;
+    // native code, compiled on first use by a store using TIER_JIT
+    void                *jitcode;
+    // bytes mapped at jitcode
+    size_t              jitsize;
+    // the JIT cannot compile this function, which runs as stack code instead
+    bool                no_jit;
 } func_t;
 
+// Limits of tables and memories. 64-bit memories (memory64) count pages
+// beyond 32 bits and are addressed with i64.
+// ref: https://github.com/WebAssembly/memory64/blob/main/proposals/memory64/Overview.md
 typedef struct {
-    uint32_t    min;
+    uint64_t    min;
     uint8_t     has_max;
-    uint32_t    max;
+    uint64_t    max;
+    bool        is64;
 } limits_t;
 
 typedef struct {
@@ -383,6 +417,20 @@ typedef struct {
     exportdesc_t    exportdesc;
 } export_t;
 
+// Initial contents of the memory of a module: the active data segments laid
+// out at their offsets in a memfd, which each instance maps copy-on-write.
+// state is accessed atomically: fd and size are published by the release
+// store of MEMIMAGE_READY.
+#define MEMIMAGE_UNBUILT    0   // built by the first instantiation
+#define MEMIMAGE_NONE       1   // no image: data is copied by memory.init
+#define MEMIMAGE_READY      2
+#define MEMIMAGE_BUILDING   3   // an instantiation on another thread builds it
+typedef struct {
+    uint8_t     state;
+    int         fd;
+    size_t      size;
+} memimage_t;
+
 typedef struct {
     VECTOR(functype_t)  types;
     VECTOR(func_t)      funcs;
@@ -400,4 +448,13 @@ typedef struct {
     uint32_t            num_table_imports;
     uint32_t            num_mem_imports;
     uint32_t            num_global_imports;
+    memimage_t          memimage;
+    // threads decoding and validating the function bodies (see decoder_set_threads)
+    uint32_t            num_threads;
+    // FNV-1a of the bytes of the module, which load_aot checks
+    uint64_t            hash;
+    // the owner's reference and one per queued tier-up job (see free_module)
+    uint32_t            refs;
+    // everything above is allocated from here (see free_module)
+    arena_t             arena;
 } module_t;
\ No newline at end of file
@@ -0,0 +1,233 @@
+#pragma once
+
+// Numeric instructions, shared by the compilers (to count operands) and the
+// interpreter (to generate handlers).
+// X(op, operand type, result type, result computed from lhs and rhs)
+// The expressions are expanded in exec.c and in the C code generated by wasm2so.
+// They use the macros below, which trap with __throw (see exception.h) and need math.h.
+
+#define FOREACH_UNOP(X)                                                       \
+    X(OP_I32_EQZ,             I32, I32, lhs == 0)                             \
+    X(OP_I64_EQZ,             I64, I32, lhs == 0)                             \
+    X(OP_I32_CLZ,             I32, I32, lhs == 0 ? 32 : __builtin_clz(lhs))   \
+    X(OP_I32_CTZ,             I32, I32, lhs == 0 ? 32 : __builtin_ctz(lhs))   \
+    X(OP_I32_POPCNT,          I32, I32, __builtin_popcount(lhs))              \
+    X(OP_I64_CLZ,             I64, I64, lhs == 0 ? 64 : __builtin_clzll(lhs)) \
+    X(OP_I64_CTZ,             I64, I64, lhs == 0 ? 64 : __builtin_ctzll(lhs)) \
+    X(OP_I64_POPCNT,          I64, I64, __builtin_popcountll(lhs))            \
+    X(OP_F32_ABS,             F32, F32, fabsf(lhs))                           \
+    X(OP_F32_NEG,             F32, F32, -lhs)                                 \
+    X(OP_F32_CEIL,            F32, F32, ceilf(lhs))                           \
+    X(OP_F32_FLOOR,           F32, F32, floorf(lhs))                          \
+    X(OP_F32_TRUNC,           F32, F32, truncf(lhs))                          \
+    X(OP_F32_NEAREST,         F32, F32, nearbyintf(lhs))                      \
+    X(OP_F32_SQRT,            F32, F32, sqrtf(lhs))                           \
+    X(OP_F64_ABS,             F64, F64, fabs(lhs))                            \
+    X(OP_F64_NEG,             F64, F64, -lhs)                                 \
+    X(OP_F64_CEIL,            F64, F64, ceil(lhs))                            \
+    X(OP_F64_FLOOR,           F64, F64, floor(lhs))                           \
+    X(OP_F64_TRUNC,           F64, F64, trunc(lhs))                           \
+    X(OP_F64_NEAREST,         F64, F64, nearbyint(lhs))                       \
+    X(OP_F64_SQRT,            F64, F64, sqrt(lhs))                            \
+    X(OP_I32_WRAP_I64,        I64, I32, lhs & 0xffffffff)                     \
+    X(OP_I32_TRUNC_F32_S,     F32, I32, I32_TRUNC_F32(lhs))                   \
+    X(OP_I32_TRUNC_F32_U,     F32, I32, U32_TRUNC_F32(lhs))                   \
+    X(OP_I32_TRUNC_F64_S,     F64, I32, I32_TRUNC_F64(lhs))                   \
+    X(OP_I32_TRUNC_F64_U,     F64, I32, U32_TRUNC_F64(lhs))                   \
+    X(OP_I64_EXTEND_I32_S,    I32, I64, (int64_t)(int32_t)lhs)                \
+    X(OP_I64_EXTEND_I32_U,    I32, I64, (int64_t)(uint32_t)lhs)               \
+    X(OP_I64_TRUNC_F32_S,     F32, I64, I64_TRUNC_F32(lhs))                   \
+    X(OP_I64_TRUNC_F32_U,     F32, I64, U64_TRUNC_F32(lhs))                   \
+    X(OP_I64_TRUNC_F64_S,     F64, I64, I64_TRUNC_F64(lhs))                   \
+    X(OP_I64_TRUNC_F64_U,     F64, I64, U64_TRUNC_F64(lhs))                   \
+    X(OP_F32_CONVERT_I32_S,   I32, F32, (float)lhs)                           \
+    X(OP_F32_CONVERT_I32_U,   I32, F32, (float)(uint32_t)lhs)                 \
+    X(OP_F32_CONVERT_I64_S,   I64, F32, (float)lhs)                           \
+    X(OP_F32_CONVERT_I64_U,   I64, F32, (float)(uint64_t)lhs)                 \
+    X(OP_F32_DEMOTE_F64,      F64, F32, (float)lhs)                           \
+    X(OP_F64_CONVERT_I32_S,   I32, F64, (double)lhs)                          \
+    X(OP_F64_CONVERT_I32_U,   I32, F64, (double)(uint32_t)lhs)                \
+    X(OP_F64_CONVERT_I64_S,   I64, F64, (double)lhs)                          \
+    X(OP_F64_CONVERT_I64_U,   I64, F64, (double)(uint64_t)lhs)                \
+    X(OP_F64_PROMOTE_F32,     F32, F64, (double)lhs)                          \
+    X(OP_I32_REINTERPRET_F32, I32, I32, lhs)                                  \
+    X(OP_I64_REINTERPRET_F64, I64, I64, lhs)                                  \
+    X(OP_F32_REINTERPRET_I32, I32, I32, lhs)                                  \
+    X(OP_F64_REINTERPRET_I64, I64, I64, lhs)                                  \
+    X(OP_I32_EXTEND8_S,       I32, I32, (int32_t)(int8_t)lhs)                 \
+    X(OP_I32_EXTEND16_S,      I32, I32, (int32_t)(int16_t)lhs)                \
+    X(OP_I64_EXTEND8_S,       I64, I64, (int64_t)(int8_t)lhs)                 \
+    X(OP_I64_EXTEND16_S,      I64, I64, (int64_t)(int16_t)lhs)                \
+    X(OP_I64_EXTEND32_S,      I64, I64, (int64_t)(int32_t)lhs)                \
+    X(OP_I32_TRUNC_SAT_F32_S, F32, I32, I32_TRUNC_SAT_F32(lhs))               \
+    X(OP_I32_TRUNC_SAT_F32_U, F32, I32, U32_TRUNC_SAT_F32(lhs))               \
+    X(OP_I32_TRUNC_SAT_F64_S, F64, I32, I32_TRUNC_SAT_F64(lhs))               \
+    X(OP_I32_TRUNC_SAT_F64_U, F64, I32, U32_TRUNC_SAT_F64(lhs))               \
+    X(OP_I64_TRUNC_SAT_F32_S, F32, I64, I64_TRUNC_SAT_F32(lhs))               \
+    X(OP_I64_TRUNC_SAT_F32_U, F32, I64, U64_TRUNC_SAT_F32(lhs))               \
+    X(OP_I64_TRUNC_SAT_F64_S, F64, I64, I64_TRUNC_SAT_F64(lhs))               \
+    X(OP_I64_TRUNC_SAT_F64_U, F64, I64, U64_TRUNC_SAT_F64(lhs))
+
+#define FOREACH_BINOP(X)                                         \
+    X(OP_I32_EQ,       I32, I32, lhs == rhs)                     \
+    X(OP_I32_NE,       I32, I32, lhs != rhs)                     \
+    X(OP_I32_LT_S,     I32, I32, lhs < rhs)                      \
+    X(OP_I32_LT_U,     I32, I32, (uint32_t)lhs < (uint32_t)rhs)  \
+    X(OP_I32_GT_S,     I32, I32, lhs > rhs)                      \
+    X(OP_I32_GT_U,     I32, I32, (uint32_t)lhs > (uint32_t)rhs)  \
+    X(OP_I32_LE_S,     I32, I32, lhs <= rhs)                     \
+    X(OP_I32_LE_U,     I32, I32, (uint32_t)lhs <= (uint32_t)rhs) \
+    X(OP_I32_GE_S,     I32, I32, lhs >= rhs)                     \
+    X(OP_I32_GE_U,     I32, I32, (uint32_t)lhs >= (uint32_t)rhs) \
+    X(OP_I64_EQ,       I64, I32, lhs == rhs)                     \
+    X(OP_I64_NE,       I64, I32, lhs != rhs)                     \
+    X(OP_I64_LT_S,     I64, I32, lhs < rhs)                      \
+    X(OP_I64_LT_U,     I64, I32, (uint64_t)lhs < (uint64_t)rhs)  \
+    X(OP_I64_GT_S,     I64, I32, lhs > rhs)                      \
+    X(OP_I64_GT_U,     I64, I32, (uint64_t)lhs > (uint64_t)rhs)  \
+    X(OP_I64_LE_S,     I64, I32, lhs <= rhs)                     \
+    X(OP_I64_LE_U,     I64, I32, (uint64_t)lhs <= (uint64_t)rhs) \
+    X(OP_I64_GE_S,     I64, I32, lhs >= rhs)                     \
+    X(OP_I64_GE_U,     I64, I32, (uint64_t)lhs >= (uint64_t)rhs) \
+    X(OP_F32_EQ,       F32, I32, lhs == rhs)                     \
+    X(OP_F32_NE,       F32, I32, lhs != rhs)                     \
+    X(OP_F32_LT,       F32, I32, lhs < rhs)                      \
+    X(OP_F32_GT,       F32, I32, lhs > rhs)                      \
+    X(OP_F32_LE,       F32, I32, lhs <= rhs)                     \
+    X(OP_F32_GE,       F32, I32, lhs >= rhs)                     \
+    X(OP_F64_EQ,       F64, I32, lhs == rhs)                     \
+    X(OP_F64_NE,       F64, I32, lhs != rhs)                     \
+    X(OP_F64_LT,       F64, I32, lhs < rhs)                      \
+    X(OP_F64_GT,       F64, I32, lhs > rhs)                      \
+    X(OP_F64_LE,       F64, I32, lhs <= rhs)                     \
+    X(OP_F64_GE,       F64, I32, lhs >= rhs)                     \
+    X(OP_I32_ADD,      I32, I32, (uint32_t)lhs + (uint32_t)rhs)  \
+    X(OP_I32_SUB,      I32, I32, (uint32_t)lhs - (uint32_t)rhs)  \
+    X(OP_I32_MUL,      I32, I32, (uint32_t)lhs * (uint32_t)rhs)  \
+    X(OP_I32_DIV_S,    I32, I32, DIV_S(lhs, rhs, INT32_MIN))     \
+    X(OP_I32_DIV_U,    I32, I32, DIV_U(uint32_t, lhs, rhs))      \
+    X(OP_I32_REM_S,    I32, I32, REM_S(lhs, rhs))                \
+    X(OP_I32_REM_U,    I32, I32, REM_U(uint32_t, lhs, rhs))      \
+    X(OP_I32_AND,      I32, I32, lhs & rhs)                      \
+    X(OP_I32_OR,       I32, I32, lhs | rhs)                      \
+    X(OP_I32_XOR,      I32, I32, lhs ^ rhs)                      \
+    X(OP_I32_SHL,      I32, I32, (uint32_t)lhs << (rhs & 31))    \
+    X(OP_I32_SHR_S,    I32, I32, lhs >> (rhs & 31))              \
+    X(OP_I32_SHR_U,    I32, I32, (uint32_t)lhs >> (rhs & 31))    \
+    X(OP_I32_ROTL,     I32, I32, ROTL32(lhs, rhs))               \
+    X(OP_I32_ROTR,     I32, I32, ROTR32(lhs, rhs))               \
+    X(OP_I64_ADD,      I64, I64, (uint64_t)lhs + (uint64_t)rhs)  \
+    X(OP_I64_SUB,      I64, I64, (uint64_t)lhs - (uint64_t)rhs)  \
+    X(OP_I64_MUL,      I64, I64, (uint64_t)lhs * (uint64_t)rhs)  \
+    X(OP_I64_DIV_S,    I64, I64, DIV_S(lhs, rhs, INT64_MIN))     \
+    X(OP_I64_DIV_U,    I64, I64, DIV_U(uint64_t, lhs, rhs))      \
+    X(OP_I64_REM_S,    I64, I64, REM_S(lhs, rhs))                \
+    X(OP_I64_REM_U,    I64, I64, REM_U(uint64_t, lhs, rhs))      \
+    X(OP_I64_AND,      I64, I64, lhs & rhs)                      \
+    X(OP_I64_OR,       I64, I64, lhs | rhs)                      \
+    X(OP_I64_XOR,      I64, I64, lhs ^ rhs)                      \
+    X(OP_I64_SHL,      I64, I64, (uint64_t)lhs << (rhs & 63))    \
+    X(OP_I64_SHR_S,    I64, I64, lhs >> (rhs & 63))              \
+    X(OP_I64_SHR_U,    I64, I64, (uint64_t)lhs >> (rhs & 63))    \
+    X(OP_I64_ROTL,     I64, I64, ROTL64(lhs, rhs))               \
+    X(OP_I64_ROTR,     I64, I64, ROTR64(lhs, rhs))               \
+    X(OP_F32_ADD,      F32, F32, lhs + rhs)                      \
+    X(OP_F32_SUB,      F32, F32, lhs - rhs)                      \
+    X(OP_F32_MUL,      F32, F32, lhs * rhs)                      \
+    X(OP_F32_DIV,      F32, F32, lhs / rhs)                      \
+    X(OP_F32_MIN,      F32, F32, MIN(lhs, rhs))                  \
+    X(OP_F32_MAX,      F32, F32, MAX(lhs, rhs))                  \
+    X(OP_F32_COPYSIGN, F32, F32, copysignf(lhs, rhs))            \
+    X(OP_F64_ADD,      F64, F64, lhs + rhs)                      \
+    X(OP_F64_SUB,      F64, F64, lhs - rhs)                      \
+    X(OP_F64_MUL,      F64, F64, lhs * rhs)                      \
+    X(OP_F64_DIV,      F64, F64, lhs / rhs)                      \
+    X(OP_F64_MIN,      F64, F64, MIN(lhs, rhs))                  \
+    X(OP_F64_MAX,      F64, F64, MAX(lhs, rhs))                  \
+    X(OP_F64_COPYSIGN, F64, F64, copysign(lhs, rhs))
+
+// helpers of the expressions
+// ref: https://gcc.gnu.org/onlinedocs/gcc/Other-Builtins.html
+// ref: https://github.com/wasm3/wasm3/blob/main/source/m3_exec.h
+// ref: https://github.com/wasm3/wasm3/blob/main/source/m3_math_utils.h
+// ref: https://en.wikipedia.org/wiki/Circular_shift
+#define TRUNC(A, TYPE, RMIN, RMAX)                              \
+    ({                                                          \
+        if(isnan(A)) {                                          \
+            __throw(ERR_TRAP_INVALID_CONVERSION_TO_INTERGER);   \
+        }                                                       \
+        if(A <= RMIN || A >= RMAX) {                            \
+            __throw(ERR_TRAP_INTERGET_OVERFLOW);                \
+        }                                                       \
+        (TYPE)A;                                                \
+    })
+
+#define I32_TRUNC_F32(A)    TRUNC(A, int32_t, -2147483904.0f, 2147483648.0f)
+#define U32_TRUNC_F32(A)    TRUNC(A, uint32_t,         -1.0f, 4294967296.0f)
+#define I32_TRUNC_F64(A)    TRUNC(A, int32_t, -2147483649.0 , 2147483648.0 )
+#define U32_TRUNC_F64(A)    TRUNC(A, uint32_t,         -1.0 , 4294967296.0 )
+
+#define I64_TRUNC_F32(A)    TRUNC(A, int64_t, -9223373136366403584.0f,  9223372036854775808.0f)
+#define U64_TRUNC_F32(A)    TRUNC(A, uint64_t,                  -1.0f, 18446744073709551616.0f)
+#define I64_TRUNC_F64(A)    TRUNC(A, int64_t, -9223372036854777856.0 ,  9223372036854775808.0 )
+#define U64_TRUNC_F64(A)    TRUNC(A, uint64_t,                  -1.0 , 18446744073709551616.0 )
+
+#define TRUNC_SAT(A, TYPE, RMIN, RMAX, IMIN, IMAX)          \
+    ({                                                      \
+        TYPE __val;                                         \
+        if (isnan(A)) {                                     \
+            __val = 0;                                      \
+        } else if (A <= RMIN) {                             \
+            __val = IMIN;                                   \
+        } else if (A >= RMAX) {                             \
+            __val = IMAX;                                   \
+        } else {                                            \
+            __val = (TYPE)A;                                \
+        }                                                   \
+        __val;                                              \
+    })
+
+#define I32_TRUNC_SAT_F32(A)    TRUNC_SAT(A, int32_t, -2147483904.0f, 2147483648.0f,   INT32_MIN,  INT32_MAX)
+#define U32_TRUNC_SAT_F32(A)    TRUNC_SAT(A, uint32_t,         -1.0f, 4294967296.0f,         0UL, UINT32_MAX)
+#define I32_TRUNC_SAT_F64(A)    TRUNC_SAT(A, int32_t, -2147483649.0 , 2147483648.0,    INT32_MIN,  INT32_MAX)
+#define U32_TRUNC_SAT_F64(A)    TRUNC_SAT(A, uint32_t,         -1.0 , 4294967296.0,          0UL, UINT32_MAX)
+#define I64_TRUNC_SAT_F32(A)    TRUNC_SAT(A, int64_t, -9223373136366403584.0f,  9223372036854775808.0f, INT64_MIN,  INT64_MAX)
+#define U64_TRUNC_SAT_F32(A)    TRUNC_SAT(A, uint64_t,                  -1.0f, 18446744073709551616.0f,      0ULL, UINT64_MAX)
+#define I64_TRUNC_SAT_F64(A)    TRUNC_SAT(A, int64_t, -9223372036854777856.0 ,  9223372036854775808.0,  INT64_MIN,  INT64_MAX)
+#define U64_TRUNC_SAT_F64(A)    TRUNC_SAT(A, uint64_t,                  -1.0 , 18446744073709551616.0,       0ULL, UINT64_MAX)
+
+// ref: https://github.com/wasm3/wasm3/blob/main/source/m3_math_utils.h
+#define MIN(A, B)                                                           \
+    (isnan(A) || isnan(B) ? NAN : (A == 0 && B == 0) ? (signbit(A) ? A : B) : (A < B ? A : B))
+#define MAX(A, B)                                                           \
+    (isnan(A) || isnan(B) ? NAN : (A == 0 && B == 0) ? (signbit(A) ? B : A) : (A > B ? A : B))
+
+#define ROTL32(A, B)    ((uint32_t)(A) << ((B) & 31) | (uint32_t)(A) >> ((-(B)) & 31))
+#define ROTR32(A, B)    ((uint32_t)(A) >> ((B) & 31) | (uint32_t)(A) << ((-(B)) & 31))
+#define ROTL64(A, B)    ((uint64_t)(A) << ((B) & 63) | (uint64_t)(A) >> ((-(B)) & 63))
+#define ROTR64(A, B)    ((uint64_t)(A) >> ((B) & 63) | (uint64_t)(A) << ((-(B)) & 63))
+
+#define DIV_S(A, B, MIN)                                                    \
+    ({                                                                      \
+        __throwif(ERR_TRAP_INTERGER_DIVIDE_BY_ZERO, B == 0);                \
+        __throwif(ERR_TRAP_INTERGET_OVERFLOW, A == MIN && B == -1);         \
+        A / B;                                                              \
+    })
+
+#define DIV_U(TYPE, A, B)                                                   \
+    ({                                                                      \
+        __throwif(ERR_TRAP_INTERGER_DIVIDE_BY_ZERO, B == 0);                \
+        (TYPE)A / (TYPE)B;                                                  \
+    })
+
+#define REM_S(A, B)                                                         \
+    ({                                                                      \
+        __throwif(ERR_TRAP_INTERGER_DIVIDE_BY_ZERO, B == 0);                \
+        B == -1 ? 0 : A % B;                                                \
+    })
+
+#define REM_U(TYPE, A, B)                                                   \
+    ({                                                                      \
+        __throwif(ERR_TRAP_INTERGER_DIVIDE_BY_ZERO, B == 0);                \
+        (TYPE)A % (TYPE)B;                                                  \
+    })
@@ -0,0 +1,51 @@
+#include "pool.h"
+
+#include <pthread.h>
+
+typedef struct {
+    work_t          fn;
+    void            *arg;
+    uint32_t        n;
+    // next item to take
+    uint32_t        next;
+} pool_t;
+
+typedef struct {
+    pool_t          *pool;
+    uint32_t        worker;
+} worker_t;
+
+static void *run(void *arg) {
+    worker_t *w = arg;
+    pool_t *pool = w->pool;
+
+    uint32_t i;
+    while((i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED)) < pool->n)
+        pool->fn(pool->arg, w->worker, i);
+    return NULL;
+}
+
+void parallel_for(uint32_t num_threads, uint32_t n, work_t fn, void *arg) {
+    pool_t pool = {.fn = fn, .arg = arg, .n = n, .next = 0};
+    pthread_t threads[MAX_THREADS];
+    worker_t workers[MAX_THREADS];
+
+    if(num_threads > MAX_THREADS)
+        num_threads = MAX_THREADS;
+    if(num_threads > n)
+        num_threads = n;
+
+    // a thread that fails to start leaves its items to the others
+    uint32_t started = 1;
+    for(uint32_t t = 1; t < num_threads; t++) {
+        workers[started] = (worker_t){.pool = &pool, .worker = started};
+        if(pthread_create(&threads[started], NULL, run, &workers[started]) == 0)
+            started++;
+    }
+
+    workers[0] = (worker_t){.pool = &pool, .worker = 0};
+    run(&workers[0]);
+
+    for(uint32_t t = 1; t < started; t++)
+        pthread_join(threads[t], NULL);
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+// pool.h runs independent work items on a number of threads.
+// Used to decode and validate function bodies in parallel (see
+// decoder_set_threads).
+
+#include <stdint.h>
+
+#define MAX_THREADS     64
+
+// run by worker for item i
+typedef void (*work_t)(void *arg, uint32_t worker, uint32_t i);
+
+// Call fn for every i in [0, n) on up to num_threads threads, the calling one
+// included, and return once all calls have returned. Items are taken in order
+// by whichever thread is free. worker is in [0, num_threads) and is only used by
+// one thread at a time, so it can index per-thread state.
+void parallel_for(uint32_t num_threads, uint32_t n, work_t fn, void *arg);
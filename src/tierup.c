@@ -0,0 +1,79 @@
+#include "tierup.h"
+#include "decode.h"
+#include "jit.h"
+#include "list.h"
+#include "print.h"
+#include "memory.h"
+
+#include <pthread.h>
+
+typedef struct {
+    list_elem_t     link;
+    module_t        *mod;
+    func_t          *func;
+} job_t;
+
+struct tierup {
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    // jobs waiting for the worker, the most recent one is compiled first
+    list_t          jobs;
+};
+
+static void *worker(void *arg) {
+    tierup_t *T = arg;
+
+    for(;;) {
+        pthread_mutex_lock(&T->lock);
+        job_t *job;
+        while(!(job = LIST_POP_TAIL(&T->jobs, job_t, link)))
+            pthread_cond_wait(&T->cond, &T->lock);
+        pthread_mutex_unlock(&T->lock);
+
+        // the worker is the only writer of jitcode and no_jit in a tiered store
+        func_t *func = job->func;
+        if(!__atomic_load_n(&func->jitcode, __ATOMIC_ACQUIRE) && !func->no_jit) {
+            if(IS_ERROR(jit_compile(job->mod, func)))
+                func->no_jit = true;
+        }
+        free_module(job->mod);
+        free(job);
+    }
+    return NULL;
+}
+
+static tierup_t *new_tierup(void) {
+    tierup_t *T = malloc(sizeof(tierup_t));
+    if(!T)
+        PANIC("out of memory");
+
+    pthread_mutex_init(&T->lock, NULL);
+    pthread_cond_init(&T->cond, NULL);
+    LIST_INIT(&T->jobs);
+
+    // the worker lives as long as the process, like the store
+    if(pthread_create(&T->thread, NULL, worker, T) != 0)
+        PANIC("failed to start the tier-up worker");
+    pthread_detach(T->thread);
+    return T;
+}
+
+void tierup_request(store_t *S, module_t *mod, func_t *func) {
+    if(!S->tierup)
+        S->tierup = new_tierup();
+
+    tierup_t *T = S->tierup;
+    job_t *job = malloc(sizeof(job_t));
+    if(!job)
+        return;
+    // the job keeps mod alive, even past free_module by its owner
+    __atomic_add_fetch(&mod->refs, 1, __ATOMIC_RELAXED);
+    job->mod = mod;
+    job->func = func;
+
+    pthread_mutex_lock(&T->lock);
+    list_push_back(&T->jobs, &job->link);
+    pthread_cond_signal(&T->cond);
+    pthread_mutex_unlock(&T->lock);
+}
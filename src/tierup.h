@@ -0,0 +1,17 @@
+#pragma once
+
+// tierup.h defines the background compiler of TIER_TIERED.
+// Functions start as stack code and count their calls and loop back-edges
+// in funcinst_t.hotness. A function reaching the threshold of its store is
+// queued for jit_compile on a worker thread, which publishes func->jitcode
+// atomically. invoke_func picks up the native code on the next call.
+// A queued job holds a reference to the module of its function, so the
+// module may be freed with free_module while the job waits.
+
+#include "exec.h"
+#include "module.h"
+
+typedef struct tierup tierup_t;
+
+// queue func for compilation, starting the worker of S on first use
+void tierup_request(store_t *S, module_t *mod, func_t *func);
@@ -0,0 +1,113 @@
+#include "trap.h"
+#include "print.h"
+#include "memory.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <pthread.h>
+
+// ref: https://man7.org/linux/man-pages/man2/sigaction.2.html
+// ref: https://github.com/WebAssembly/design/blob/main/Rationale.md#linear-memory
+
+// Regions live on a list the handler can walk without locking. Nodes are
+// never freed: an unregistered region has size 0 and is reused by the next
+// trap_register.
+typedef struct region {
+    struct region   *next;
+    uint8_t         *base;
+    size_t          size;
+    bool            used;
+} region_t;
+
+static region_t *regions;
+static struct sigaction old_segv;
+
+// the innermost trap_guard running on this thread
+static __thread sigjmp_buf *trap_jmp;
+
+static bool in_region(uint8_t *addr) {
+    for(region_t *r = __atomic_load_n(&regions, __ATOMIC_ACQUIRE); r; r = r->next) {
+        size_t size = __atomic_load_n(&r->size, __ATOMIC_ACQUIRE);
+        uint8_t *base = __atomic_load_n(&r->base, __ATOMIC_RELAXED);
+        if(addr >= base && addr < base + size)
+            return true;
+    }
+    return false;
+}
+
+static void on_segv(int sig, siginfo_t *info, void *ctx) {
+    if(trap_jmp && in_region(info->si_addr))
+        siglongjmp(*trap_jmp, 1);
+
+    // not a trap: pass the fault on to the previous handler
+    if(old_segv.sa_flags & SA_SIGINFO)
+        old_segv.sa_sigaction(sig, info, ctx);
+    else if(old_segv.sa_handler != SIG_IGN && old_segv.sa_handler != SIG_DFL)
+        old_segv.sa_handler(sig);
+    else
+        sigaction(SIGSEGV, &old_segv, NULL);
+}
+
+static void install(void) {
+    struct sigaction sa = {.sa_sigaction = on_segv, .sa_flags = SA_SIGINFO};
+    sigemptyset(&sa.sa_mask);
+    if(sigaction(SIGSEGV, &sa, &old_segv) != 0)
+        PANIC("failed to install the SIGSEGV handler");
+}
+
+void trap_init(void) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, install);
+}
+
+void trap_register(void *base, size_t size) {
+    // take over an unregistered node if there is one
+    for(region_t *r = __atomic_load_n(&regions, __ATOMIC_ACQUIRE); r; r = r->next) {
+        bool used = false;
+        if(__atomic_compare_exchange_n(&r->used, &used, true, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&r->base, (uint8_t *)base, __ATOMIC_RELAXED);
+            __atomic_store_n(&r->size, size, __ATOMIC_RELEASE);
+            return;
+        }
+    }
+
+    region_t *r = malloc(sizeof(region_t));
+    if(!r)
+        PANIC("out of memory");
+
+    r->base = base;
+    r->size = size;
+    r->used = true;
+    r->next = __atomic_load_n(&regions, __ATOMIC_RELAXED);
+    while(!__atomic_compare_exchange_n(&regions, &r->next, r, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+}
+
+void trap_unregister(void *base) {
+    for(region_t *r = __atomic_load_n(&regions, __ATOMIC_ACQUIRE); r; r = r->next) {
+        if(__atomic_load_n(&r->used, __ATOMIC_ACQUIRE) && r->base == base && r->size) {
+            __atomic_store_n(&r->size, 0, __ATOMIC_RELEASE);
+            __atomic_store_n(&r->used, false, __ATOMIC_RELEASE);
+            return;
+        }
+    }
+}
+
+error_t trap_guard(error_t (*fn)(void *), void *arg, error_t trap) {
+    sigjmp_buf jmp;
+    sigjmp_buf *prev = trap_jmp;
+    error_t err;
+
+    if(sigsetjmp(jmp, 1) == 0) {
+        trap_jmp = &jmp;
+        err = fn(arg);
+    }
+    else {
+        err = trap;
+    }
+
+    trap_jmp = prev;
+    return err;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+// trap.h turns faults into traps.
+// Linear memory is a large reservation whose pages past the memory size are
+// inaccessible (see meminst_t), so loads and stores need no bounds checks.
+// A SIGSEGV at an address in a registered region, raised while trap_guard is
+// running on the same thread, returns from trap_guard with a trap instead.
+//
+// This file does not include exec.h: signal.h defines its own stack_t.
+
+#include "error.h"
+#include <stddef.h>
+
+// install the SIGSEGV handler (once per process)
+void trap_init(void);
+
+// faults in [base, base + size) become traps
+void trap_register(void *base, size_t size);
+
+// forget the region registered at base, before it is unmapped
+void trap_unregister(void *base);
+
+// run fn(arg), or return trap if it faults in a registered region
+error_t trap_guard(error_t (*fn)(void *), void *arg, error_t trap);
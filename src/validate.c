@@ -1,9 +1,11 @@
 #include <stdbool.h>
 #include <string.h>
 #include "validate.h"
+#include "compile.h"
 #include "print.h"
 #include "exception.h"
 #include "memory.h"
+#include "pool.h"
 
 // used only in validation
 #define STACK_SIZE 4096
@@ -23,6 +25,12 @@ static inline void push(type_stack *stack, valtype_t ty) {
     //printf("push %x idx: %ld\n", ty, stack->idx);
 }
 
+// address type of a memory
+// ref: https://github.com/WebAssembly/memory64/blob/main/proposals/memory64/Overview.md#validation
+static inline valtype_t addrtype(memtype_t *mem) {
+    return mem->is64 ? TYPE_NUM_I64 : TYPE_NUM_I32;
+}
+
 // Type is not verified if expect is 0.
 static inline error_t try_pop(type_stack *stack, valtype_t expect) {
     __try {
@@ -56,6 +64,28 @@ static inline error_t peek_stack_top(type_stack *stack, valtype_t *t) {
         return err;
 }
 
+// operand stack height of the current block, relative to the function
+static inline uint32_t stack_height(context_t *C, type_stack *stack) {
+    labeltype_t *l = LIST_TAIL(&C->labels, labeltype_t, link);
+    return l->height + (stack->idx + 1);
+}
+
+// keep the highest operand stack height of the function
+// (constant expressions are validated outside of any function label)
+static inline void update_max_height(context_t *C, type_stack *stack) {
+    if(!LIST_TAIL(&C->labels, labeltype_t, link))
+        return;
+    uint32_t h = stack_height(C, stack);
+    if(h > C->max_height)
+        C->max_height = h;
+}
+
+// record the target of a branch to label l in the side table
+static inline void record_branch(context_t *C, labeltype_t *l) {
+    branch_t b = {.height = l->height, .arity = l->ty.len};
+    VECTOR_APPEND(C->sidetable, b);
+}
+
 error_t validate_blocktype(context_t *C, blocktype_t bt, functype_t *ty) {
     __try {
         VECTOR_INIT(&ty->rt1);
@@ -114,6 +144,8 @@ error_t validate_instr(context_t *C, instr_t *ip, type_stack *stack) {
                     l.ty = ty.rt2;
                 else
                     l.ty = ty.rt1;
+                // the block's values start below its params
+                l.height = stack_height(C, stack) - ty.rt1.len;
                 
                 list_push_back(&C->labels, &l.link);
 
@@ -138,7 +170,11 @@ error_t validate_instr(context_t *C, instr_t *ip, type_stack *stack) {
                 __throwif(ERR_FAILED, IS_ERROR(validate_blocktype(C, ip->bt, &ty)));
 
                 // push label
-                labeltype_t l = {.ty = ty.rt2};
+                // the condition is still on the stack here
+                labeltype_t l = {
+                    .ty     = ty.rt2,
+                    .height = stack_height(C, stack) - 1 - ty.rt1.len
+                };
                 list_push_back(&C->labels, &l.link);
                 
                 __throwiferr(validate_instrs(C, ip->in1, &ty.rt1, &ty.rt2));
@@ -166,6 +202,7 @@ error_t validate_instr(context_t *C, instr_t *ip, type_stack *stack) {
             case OP_BR: {
                 labeltype_t *l = LIST_GET_ELEM(&C->labels, labeltype_t, link, ip->labelidx);
                 __throwif(ERR_UNKNOWN_LABEL, !l);
+                record_branch(C, l);
                 VECTOR_FOR_EACH_REVERSE(t, &l->ty) {
                     __throwiferr(try_pop(stack, *t));
                 }
@@ -178,6 +215,7 @@ error_t validate_instr(context_t *C, instr_t *ip, type_stack *stack) {
             case OP_BR_IF: {
                 labeltype_t *l = LIST_GET_ELEM(&C->labels, labeltype_t, link, ip->labelidx);
                 __throwif(ERR_UNKNOWN_LABEL, !l);
+                record_branch(C, l);
                 __throwiferr(try_pop(stack, TYPE_NUM_I32));
                 VECTOR_FOR_EACH_REVERSE(t, &l->ty) {
                     __throwiferr(try_pop(stack, *t));
@@ -196,6 +234,7 @@ error_t validate_instr(context_t *C, instr_t *ip, type_stack *stack) {
                 VECTOR_FOR_EACH(i, &ip->labels) {
                     labeltype_t *l = LIST_GET_ELEM(&C->labels, labeltype_t, link, *i);
                     __throwif(ERR_UNKNOWN_LABEL, !l);
+                    record_branch(C, l);
 
                     __throwif(ERR_TYPE_MISMATCH, default_label->ty.len != l->ty.len);
 
@@ -209,6 +248,7 @@ error_t validate_instr(context_t *C, instr_t *ip, type_stack *stack) {
                     stack->polymorphic = true;
                 }
 
+                record_branch(C, default_label);
                 __throwiferr(try_pop(stack, TYPE_NUM_I32));
                 VECTOR_FOR_EACH_REVERSE(t, &default_label->ty) {
                     __throwiferr(try_pop(stack, *t));
@@ -359,7 +399,7 @@ error_t validate_instr(context_t *C, instr_t *ip, type_stack *stack) {
             case OP_I64_LOAD16_U:
             case OP_I64_LOAD32_S:
             case OP_I64_LOAD32_U: {
-                memtype_t *mem = VECTOR_ELEM(&C->mems, 0);
+                memtype_t *mem = VECTOR_ELEM(&C->mems, ip->m.memidx);
                 __throwif(ERR_UNKNOWN_MEMORY, !mem);
                 int32_t n;
                 switch(ip->op1) {
@@ -387,7 +427,7 @@ error_t validate_instr(context_t *C, instr_t *ip, type_stack *stack) {
                         break;
                 }
                 __throwif(ERR_ALIGNMENT_MUST_NOT_BE_LARGER_THAN_NATURAL, (1 << ip->m.align) > n);
-                __throwiferr(try_pop(stack, TYPE_NUM_I32));
+                __throwiferr(try_pop(stack, addrtype(mem)));
                 valtype_t t;
                 switch(ip->op1) {
                     case OP_I32_LOAD:
@@ -425,7 +465,7 @@ error_t validate_instr(context_t *C, instr_t *ip, type_stack *stack) {
             case OP_I64_STORE8:
             case OP_I64_STORE16:
             case OP_I64_STORE32: {
-                memtype_t *mem = VECTOR_ELEM(&C->mems, 0);
+                memtype_t *mem = VECTOR_ELEM(&C->mems, ip->m.memidx);
                 __throwif(ERR_UNKNOWN_MEMORY, !mem);
                 int32_t n;
                 switch(ip->op1) {
@@ -469,24 +509,24 @@ error_t validate_instr(context_t *C, instr_t *ip, type_stack *stack) {
                         break;
                 }
                 __throwiferr(try_pop(stack, t));
-                __throwiferr(try_pop(stack, TYPE_NUM_I32));
+                __throwiferr(try_pop(stack, addrtype(mem)));
                 break;
             }
 
             case OP_MEMORY_SIZE: {
-                memtype_t *mem = VECTOR_ELEM(&C->mems, 0);
+                memtype_t *mem = VECTOR_ELEM(&C->mems, ip->x);
                 __throwif(ERR_UNKNOWN_MEMORY, !mem);
-                // valid with [] -> [i32]
-                push(stack, TYPE_NUM_I32);
+                // valid with [] -> [at] (at: i64 for a 64-bit memory, i32 otherwise)
+                push(stack, addrtype(mem));
                 break;
             }
 
             case OP_MEMORY_GROW: {
-                memtype_t *mem = VECTOR_ELEM(&C->mems, 0);
+                memtype_t *mem = VECTOR_ELEM(&C->mems, ip->x);
                 __throwif(ERR_UNKNOWN_MEMORY, !mem);
-                // valid with [i32] -> [i32]
-                __throwiferr(try_pop(stack, TYPE_NUM_I32));
-                push(stack, TYPE_NUM_I32);
+                // valid with [at] -> [at]
+                __throwiferr(try_pop(stack, addrtype(mem)));
+                push(stack, addrtype(mem));
                 break;
             }
 
@@ -790,13 +830,14 @@ error_t validate_instr(context_t *C, instr_t *ip, type_stack *stack) {
                     
                     // memory.init
                     case 0x08: {
-                        memtype_t *mem = VECTOR_ELEM(&C->mems, 0);
+                        memtype_t *mem = VECTOR_ELEM(&C->mems, ip->y);
                         __throwif(ERR_UNKNOWN_MEMORY, !mem);
                         ok_t *data = VECTOR_ELEM(&C->datas, ip->x);
                         __throwif(ERR_UNKNOWN_DATA_SEGMENT, !data);
+                        // valid with [at i32 i32] -> []
                         __throwiferr(try_pop(stack, TYPE_NUM_I32));
                         __throwiferr(try_pop(stack, TYPE_NUM_I32));
-                        __throwiferr(try_pop(stack, TYPE_NUM_I32));
+                        __throwiferr(try_pop(stack, addrtype(mem)));
                         break;
                     }
 
@@ -808,14 +849,27 @@ error_t validate_instr(context_t *C, instr_t *ip, type_stack *stack) {
                     }
 
                     // memory.copy
-                    case 0x0A:
+                    case 0x0A: {
+                        memtype_t *m1 = VECTOR_ELEM(&C->mems, ip->x);
+                        __throwif(ERR_UNKNOWN_MEMORY, !m1);
+                        memtype_t *m2 = VECTOR_ELEM(&C->mems, ip->y);
+                        __throwif(ERR_UNKNOWN_MEMORY, !m2);
+                        // valid with [at1 at2 at] -> [] (at: i32 unless both are i64)
+                        valtype_t at = m1->is64 && m2->is64 ? TYPE_NUM_I64 : TYPE_NUM_I32;
+                        __throwiferr(try_pop(stack, at));
+                        __throwiferr(try_pop(stack, addrtype(m2)));
+                        __throwiferr(try_pop(stack, addrtype(m1)));
+                        break;
+                    }
+
                     // memory.fill
                     case 0x0B: {
-                        memtype_t *mem = VECTOR_ELEM(&C->mems, 0);
+                        memtype_t *mem = VECTOR_ELEM(&C->mems, ip->x);
                         __throwif(ERR_UNKNOWN_MEMORY, !mem);
+                        // valid with [at i32 at] -> []
+                        __throwiferr(try_pop(stack, addrtype(mem)));
                         __throwiferr(try_pop(stack, TYPE_NUM_I32));
-                        __throwiferr(try_pop(stack, TYPE_NUM_I32));
-                        __throwiferr(try_pop(stack, TYPE_NUM_I32));
+                        __throwiferr(try_pop(stack, addrtype(mem)));
                         break;
                     }
 
@@ -908,6 +962,7 @@ error_t validate_instrs(context_t *C, instr_t *start, resulttype_t *rt1, resultt
         instr_t *ip = start;
         while(ip) {
             __throwiferr(validate_instr(C, ip, &stack));
+            update_max_height(C, &stack);
             ip = ip->next;
         }
 
@@ -930,6 +985,7 @@ error_t validate_expr(context_t *C, expr_t *expr, resulttype_t *rt2) {
         instr_t *ip = *expr;
         while(ip) {
             __throwiferr(validate_instr(C, ip, &stack));
+            update_max_height(C, &stack);
             ip = ip->next;
         }
         // compare witch expected type
@@ -951,12 +1007,20 @@ error_t validate_func(context_t *C, func_t *func) {
         // create context C'
         VECTOR_CONCAT(&C->locals, &expect->rt1, &func->locals);
 
-        labeltype_t l ={.ty = expect->rt2};
+        labeltype_t l ={.ty = expect->rt2, .height = 0};
         list_push_back(&C->labels, &l.link);
         C->ret = &expect->rt2;
 
+        __throwiferr(VECTOR_NEW(&func->sidetable, 0, 16));
+        C->sidetable = &func->sidetable;
+        C->max_height = 0;
+
         // validate expr
         __throwiferr(validate_expr(C, &func->body, &expect->rt2));
+        func->max_height = C->max_height;
+
+        // cleanup
+        list_pop_tail(&C->labels);
     }
     __catch:
         return err;
@@ -981,7 +1045,8 @@ error_t validate_table(table_t *table) {
 
 error_t validate_memtype(memtype_t *memtype) {
     __try {
-        uint32_t k = 1<<16;
+        // a 64-bit memory may have up to 2^48 pages (2^64 bytes)
+        uint64_t k = memtype->is64 ? 1ULL<<48 : 1<<16;
         __throwif(ERR_MEMORY_SIZE_MUST_BE_AT_MOST_65536_PAGES, memtype->min > k);
         if(memtype->has_max) {
             __throwif(ERR_MEMORY_SIZE_MUST_BE_AT_MOST_65536_PAGES, memtype->max > k);
@@ -1159,9 +1224,9 @@ error_t validate_data(context_t *C, data_t *data) {
                 // expr must be constant
                 __throwif(ERR_CONSTANT_EXPRESSION_REQUIRED, !is_constant_expr(C, &data->mode.offset));
 
-                // expr must be valid with result type [i32]
-                valtype_t type_i32 = TYPE_NUM_I32;
-                resulttype_t rt2 = {.len = 1, .elem = &type_i32};
+                // expr must be valid with result type [at]
+                valtype_t at = addrtype(m);
+                resulttype_t rt2 = {.len = 1, .elem = &at};
                 __throwiferr(validate_expr(C, &data->mode.offset, &rt2));
 
                 
@@ -1174,6 +1239,62 @@ error_t validate_data(context_t *C, data_t *data) {
         return err;
 }
 
+// parallel validation of function bodies
+// Each worker validates under its own copy of the context, which shares the
+// read-only parts (types, funcs, tables, ...) and has its own locals, labels
+// and side table, and moves side tables into an arena of its own.
+typedef struct {
+    module_t    *mod;
+    context_t   *contexts;
+    arena_t     *arenas;
+    error_t     *errs;
+} funcs_t;
+
+static void validate_func_work(void *arg, uint32_t worker, uint32_t i) {
+    funcs_t *f = arg;
+    func_t *func = VECTOR_ELEM(&f->mod->funcs, i);
+
+    f->errs[i] = validate_func(&f->contexts[worker], func);
+    if(!IS_ERROR(f->errs[i]))
+        f->errs[i] = VECTOR_MOVE_IN(&f->arenas[worker], &func->sidetable);
+}
+
+// The error of the first function that fails is returned, as if they were
+// validated in order.
+static error_t validate_funcs(context_t *C, module_t *mod) {
+    uint32_t n = mod->funcs.len;
+    uint32_t num_threads = mod->num_threads < MAX_THREADS ? mod->num_threads : MAX_THREADS;
+    context_t contexts[MAX_THREADS];
+    arena_t arenas[MAX_THREADS];
+    error_t *errs = NULL;
+
+    __try {
+        if(n == 0)
+            __throw(ERR_SUCCESS);
+        errs = malloc(sizeof(error_t) * n);
+        __throwif(ERR_FAILED, !errs);
+
+        for(uint32_t w = 0; w < num_threads; w++) {
+            contexts[w] = *C;
+            VECTOR_INIT(&contexts[w].locals);
+            LIST_INIT(&contexts[w].labels);
+            arena_init(&arenas[w]);
+        }
+
+        funcs_t f = {.mod = mod, .contexts = contexts, .arenas = arenas, .errs = errs};
+        parallel_for(num_threads, n, validate_func_work, &f);
+
+        for(uint32_t w = 0; w < num_threads; w++)
+            arena_merge(&mod->arena, &arenas[w]);
+
+        for(uint32_t i = 0; i < n; i++)
+            __throwiferr(errs[i]);
+    }
+    __catch:
+        free(errs);
+        return err;
+}
+
 static void mark_funcidx_in_expr(context_t *C, expr_t *expr) {
     instr_t *ip = *expr;
     while(ip) {
@@ -1275,12 +1396,15 @@ error_t validate_module(module_t *mod) {
 
         // under the context C
         // validate funcs
-        VECTOR_FOR_EACH(func, &mod->funcs) {   
-            __throwiferr(validate_func(&C, func));
+        if(mod->num_threads > 1) {
+            __throwiferr(validate_funcs(&C, mod));
+        }
+        else {
+            VECTOR_FOR_EACH(func, &mod->funcs) {   
+                __throwiferr(validate_func(&C, func));
+                __throwiferr(VECTOR_MOVE_IN(&mod->arena, &func->sidetable));
+            }
         }
-
-        // C.mems must be larger than 1
-        __throwif(ERR_MULTIPLE_MEMORIES, C.mems.len > 1);
         
         // All export names export_{i}.name must be different
         // todo: fix this
@@ -1297,6 +1421,11 @@ error_t validate_module(module_t *mod) {
         VECTOR_FOR_EACH(export, &mod->exports) {
            __throwiferr(validate_export(&C, export));
         }
+
+        // lower the validated function bodies into flat code
+        VECTOR_FOR_EACH(func, &mod->funcs) {
+            __throwiferr(compile_func(mod, func));
+        }
     }
     __catch:
         return err;
@@ -13,6 +13,8 @@
 typedef struct {
     list_elem_t     link;
     resulttype_t    ty;
+    // operand stack height (relative to the function) where the label's values start
+    uint32_t        height;
 } labeltype_t;
 
 typedef uint8_t ok_t;
@@ -28,6 +30,10 @@ typedef struct {
     VECTOR(valtype_t)       locals;
     list_t                  labels;
     resulttype_t            *ret;
+    // side table of the function being validated
+    sidetable_t             *sidetable;
+    // highest operand stack height of the function being validated
+    uint32_t                max_height;
     VECTOR(bool)            refs;
 } context_t;
 
@@ -0,0 +1,229 @@
+// aottest builds a module with wasm2so, binds an instance to it with load_aot
+// and checks its results and traps against the interpreter, then checks that
+// load_aot rejects a shared object built from another module.
+//
+// usage: aottest <wasm2so> <work dir>
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <print.h>
+#include <decode.h>
+#include <validate.h>
+#include <exec.h>
+
+// (module
+//   (memory 1)
+//   (func (export "fib") (param i32) (result i32)
+//     (if (result i32) (i32.lt_u (local.get 0) (i32.const 2))
+//       (then (local.get 0))
+//       (else (i32.add (call 0 (i32.sub (local.get 0) (i32.const 1)))
+//                      (call 0 (i32.sub (local.get 0) (i32.const 2)))))))
+//   ;; stores i at 4 * i for i < n, then sums them back
+//   (func (export "sum") (param i32) (result i32) (local i32 i32)
+//     (loop
+//       (i32.store (i32.shl (local.get 1) (i32.const 2)) (local.get 1))
+//       (br_if 0 (i32.lt_u (local.tee 1 (i32.add (local.get 1) (i32.const 1))) (local.get 0))))
+//     (block (loop
+//       (br_if 1 (i32.eqz (local.get 1)))
+//       (local.set 2 (i32.add (local.get 2)
+//         (i32.load (i32.shl (local.tee 1 (i32.sub (local.get 1) (i32.const 1))) (i32.const 2)))))
+//       (br 0)))
+//     (local.get 2))
+//   (func (export "load") (param i32) (result i32) (i32.load offset=4 (local.get 0)))
+//   (func (export "div") (param i32 i32) (result i32) (i32.div_s (local.get 0) (local.get 1))))
+static uint8_t module[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00,
+    0x01, 0x0c, 0x02, 0x60, 0x01, 0x7f, 0x01, 0x7f, 0x60, 0x02, 0x7f, 0x7f, 0x01, 0x7f,
+    0x03, 0x05, 0x04, 0x00, 0x00, 0x00, 0x01,
+    0x05, 0x03, 0x01, 0x00, 0x01,
+    0x07, 0x1a, 0x04,
+        0x03, 'f', 'i', 'b', 0x00, 0x00,
+        0x03, 's', 'u', 'm', 0x00, 0x01,
+        0x04, 'l', 'o', 'a', 'd', 0x00, 0x02,
+        0x03, 'd', 'i', 'v', 0x00, 0x03,
+    0x0a, 0x6d, 0x04,
+        // fib
+        0x1c, 0x00,
+        0x20, 0x00, 0x41, 0x02, 0x49, 0x04, 0x7f, 0x20, 0x00, 0x05,
+        0x20, 0x00, 0x41, 0x01, 0x6b, 0x10, 0x00, 0x20, 0x00, 0x41, 0x02, 0x6b, 0x10, 0x00, 0x6a,
+        0x0b, 0x0b,
+        // sum
+        0x3e, 0x01, 0x02, 0x7f,
+        0x03, 0x40,
+        0x20, 0x01, 0x41, 0x02, 0x74, 0x20, 0x01, 0x36, 0x02, 0x00,
+        0x20, 0x01, 0x41, 0x01, 0x6a, 0x22, 0x01, 0x20, 0x00, 0x49, 0x0d, 0x00,
+        0x0b,
+        0x02, 0x40, 0x03, 0x40,
+        0x20, 0x01, 0x45, 0x0d, 0x01,
+        0x20, 0x02, 0x20, 0x01, 0x41, 0x01, 0x6b, 0x22, 0x01, 0x41, 0x02, 0x74, 0x28, 0x02, 0x00,
+        0x6a, 0x21, 0x02, 0x0c, 0x00,
+        0x0b, 0x0b,
+        0x20, 0x02, 0x0b,
+        // load
+        0x07, 0x00, 0x20, 0x00, 0x28, 0x02, 0x04, 0x0b,
+        // div
+        0x07, 0x00, 0x20, 0x00, 0x20, 0x01, 0x6d, 0x0b,
+};
+
+// the byte of (i32.const 2) in the condition of fib: changing it gives
+// another module with the same functions
+#define FIB_CONST       0x46
+
+typedef struct {
+    const char  *name;
+    int32_t     args[2];
+} call_t;
+
+static call_t calls[] = {
+    {"fib", {0}}, {"fib", {1}}, {"fib", {10}}, {"fib", {20}},
+    {"sum", {0}}, {"sum", {1}}, {"sum", {100}}, {"sum", {16384}},
+    // the last store is one past the memory
+    {"sum", {16385}},
+    {"load", {0}}, {"load", {65528}}, {"load", {65529}}, {"load", {65536}},
+    // the offset carries the address past 4 GiB
+    {"load", {-1}},
+    {"div", {7, 2}}, {"div", {-7, 2}}, {"div", {1, 0}}, {"div", {INT32_MIN, -1}},
+};
+
+static int failures = 0;
+
+#define CHECK(cond)                                                 \
+    do {                                                            \
+        if(!(cond)) {                                               \
+            ERROR("%s:%d: %s", __FILE__, __LINE__, #cond);          \
+            failures++;                                             \
+        }                                                           \
+    } while(0)
+
+static externval_t export(moduleinst_t *inst, const char *name) {
+    VECTOR_FOR_EACH(exportinst, &inst->exports) {
+        if(strcmp((char *)exportinst->name, name) == 0)
+            return exportinst->value;
+    }
+    PANIC("no export %s", name);
+}
+
+static module_t *load(uint8_t *bytes, size_t size) {
+    module_t *mod;
+    if(IS_ERROR(decode_module(&mod, bytes, size)) || IS_ERROR(validate_module(mod)))
+        PANIC("invalid module");
+    return mod;
+}
+
+static moduleinst_t *new_instance(store_t *S, module_t *mod) {
+    externvals_t externvals;
+    VECTOR_INIT(&externvals);
+
+    moduleinst_t *inst;
+    if(IS_ERROR(instantiate(S, mod, &externvals, &inst)))
+        PANIC("instantiation failed");
+    return inst;
+}
+
+// write bytes to <dir>/<name>.wasm and build <dir>/<name>.so from it
+static void build(const char *wasm2so, const char *dir, const char *name, uint8_t *bytes, size_t size) {
+    char wasm[4096], so[4096], cmd[16384];
+    snprintf(wasm, sizeof(wasm), "%s/%s.wasm", dir, name);
+    snprintf(so, sizeof(so), "%s/%s.so", dir, name);
+
+    FILE *fp = fopen(wasm, "wb");
+    if(!fp || fwrite(bytes, 1, size, fp) != size)
+        PANIC("cannot write %s", wasm);
+    fclose(fp);
+
+    snprintf(cmd, sizeof(cmd), "'%s' '%s' '%s'", wasm2so, wasm, so);
+    if(system(cmd) != 0)
+        PANIC("wasm2so failed on %s", wasm);
+}
+
+static bool is_native(store_t *S, moduleinst_t *inst, const char *name) {
+    return VECTOR_ELEM(&S->funcs, export(inst, name).func)->native != NULL;
+}
+
+static error_t call(store_t *S, moduleinst_t *inst, call_t *c, int32_t *result) {
+    functype_t *ft = VECTOR_ELEM(&S->funcs, export(inst, c->name).func)->type;
+    uint32_t n = ft->rt1.len;
+
+    args_t args;
+    VECTOR_NEW(&args, n, n);
+    for(uint32_t i = 0; i < n; i++)
+        args.elem[i] = (arg_t){.type = TYPE_NUM_I32, .val.num.i32 = c->args[i]};
+    error_t err = invoke(S, export(inst, c->name).func, &args);
+    if(!IS_ERROR(err))
+        *result = args.elem[0].val.num.i32;
+    free(args.elem);
+    return err;
+}
+
+// the native code gives the results and traps of the interpreter
+static void test_aot(module_t *mod, const char *so) {
+    store_t *S = new_store();
+    moduleinst_t *inst = new_instance(S, mod);
+    store_t *A = new_store();
+    moduleinst_t *aot = new_instance(A, mod);
+
+    CHECK(!IS_ERROR(load_aot(A, aot, so)));
+    for(size_t i = 0; i < sizeof(calls) / sizeof(calls[0]); i++)
+        CHECK(is_native(A, aot, calls[i].name));
+
+    for(size_t i = 0; i < sizeof(calls) / sizeof(calls[0]); i++) {
+        call_t *c = &calls[i];
+        int32_t want = 0, got = 0;
+        error_t want_err = call(S, inst, c, &want);
+        error_t got_err = call(A, aot, c, &got);
+        if(want_err != got_err || want != got) {
+            ERROR(
+                "%s(%d, %d): %d (%d) instead of %d (%d)",
+                c->name, c->args[0], c->args[1], got, got_err, want, want_err
+            );
+            failures++;
+        }
+    }
+
+    release_instance(S, inst);
+    release_instance(A, aot);
+}
+
+// a shared object from another module is refused and binds nothing
+static void test_mismatch(module_t *mod, const char *so) {
+    store_t *S = new_store();
+    moduleinst_t *inst = new_instance(S, mod);
+
+    CHECK(IS_ERROR(load_aot(S, inst, so)));
+    CHECK(!is_native(S, inst, "fib"));
+
+    int32_t result = 0;
+    CHECK(!IS_ERROR(call(S, inst, &calls[3], &result)) && result == 6765);
+    release_instance(S, inst);
+}
+
+int main(int argc, char *argv[]) {
+    if(argc != 3) {
+        fprintf(stderr, "usage: %s <wasm2so> <work dir>\n", argv[0]);
+        return 1;
+    }
+
+    uint8_t other[sizeof(module)];
+    memcpy(other, module, sizeof(module));
+    other[FIB_CONST] = 0x03;
+
+    build(argv[1], argv[2], "aottest", module, sizeof(module));
+    build(argv[1], argv[2], "aottest_other", other, sizeof(other));
+
+    char so[4096], other_so[4096];
+    snprintf(so, sizeof(so), "%s/aottest.so", argv[2]);
+    snprintf(other_so, sizeof(other_so), "%s/aottest_other.so", argv[2]);
+
+    module_t *mod = load(module, sizeof(module));
+    test_aot(mod, so);
+    test_mismatch(mod, other_so);
+    free_module(mod);
+
+    if(failures)
+        ERROR("aottest: %d checks failed", failures);
+    else
+        INFO("aottest: passed");
+    return failures != 0;
+}
@@ -0,0 +1,358 @@
+// memtest checks linear memories from the host side, without the testsuite:
+// reservations recycled between instances and unmapped past the pool, the
+// bounds checks of the mem_* API, memory images built by racing
+// instantiations and the sizing of 64-bit memories.
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <print.h>
+#include <decode.h>
+#include <validate.h>
+#include <exec.h>
+
+// (module
+//   (memory (export "memory") 64 192)
+//   (func (export "grow") (param i32) (result i32) (memory.grow (local.get 0)))
+//   (data (i32.const 16) "image!"))
+static uint8_t image[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00,
+    0x01, 0x06, 0x01, 0x60, 0x01, 0x7f, 0x01, 0x7f,
+    0x03, 0x02, 0x01, 0x00,
+    0x05, 0x05, 0x01, 0x01, 0x40, 0xc0, 0x01,
+    0x07, 0x11, 0x02,
+        0x06, 'm', 'e', 'm', 'o', 'r', 'y', 0x02, 0x00,
+        0x04, 'g', 'r', 'o', 'w', 0x00, 0x00,
+    0x0a, 0x08, 0x01, 0x06, 0x00, 0x20, 0x00, 0x40, 0x00, 0x0b,
+    0x0b, 0x0c, 0x01, 0x00, 0x41, 0x10, 0x0b, 0x06, 'i', 'm', 'a', 'g', 'e', '!',
+};
+
+// (memory i64 1048577), past MEM64_RESERVE_PAGES
+static uint8_t mem64_min[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00,
+    0x05, 0x05, 0x01, 0x04, 0x81, 0x80, 0x40,
+};
+
+// (memory i64 2000000 2000000)
+static uint8_t mem64_max[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00,
+    0x05, 0x08, 0x01, 0x05, 0x80, 0x89, 0x7a, 0x80, 0x89, 0x7a,
+};
+
+// (memory i64 0x80000001), past MEM64_MAX_RESERVE_PAGES
+static uint8_t mem64_huge[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00,
+    0x05, 0x07, 0x01, 0x04, 0x81, 0x80, 0x80, 0x80, 0x08,
+};
+
+// 4 MiB, so that whole huge pages back the initial and the grown pages
+#define MIN_PAGES       64
+#define GROW_PAGES      64
+
+#define IMAGE_OFFSET    16
+#define IMAGE_DATA      "image!"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                 \
+    do {                                                            \
+        if(!(cond)) {                                               \
+            ERROR("%s:%d: %s", __FILE__, __LINE__, #cond);          \
+            failures++;                                             \
+        }                                                           \
+    } while(0)
+
+static externval_t export(moduleinst_t *inst, const char *name) {
+    VECTOR_FOR_EACH(exportinst, &inst->exports) {
+        if(strcmp((char *)exportinst->name, name) == 0)
+            return exportinst->value;
+    }
+    PANIC("no export %s", name);
+}
+
+static module_t *load(uint8_t *bytes, size_t size) {
+    module_t *mod;
+    if(IS_ERROR(decode_module(&mod, bytes, size)) || IS_ERROR(validate_module(mod)))
+        PANIC("invalid module");
+    return mod;
+}
+
+static moduleinst_t *new_instance(store_t *S, module_t *mod) {
+    externvals_t externvals;
+    VECTOR_INIT(&externvals);
+
+    moduleinst_t *inst;
+    if(IS_ERROR(instantiate(S, mod, &externvals, &inst)))
+        PANIC("instantiation failed");
+    return inst;
+}
+
+// memory.grow through the guest, returns the old size in pages
+static int32_t grow(store_t *S, moduleinst_t *inst, int32_t n) {
+    args_t args;
+    VECTOR_NEW(&args, 1, 1);
+    args.elem[0] = (arg_t){.type = TYPE_NUM_I32, .val.num.i32 = n};
+    if(IS_ERROR(invoke(S, export(inst, "grow").func, &args)))
+        PANIC("grow trapped");
+    int32_t ret = args.elem[0].val.num.i32;
+    free(args.elem);
+    return ret;
+}
+
+// every byte of [a, a + n) is zero
+static bool is_zero(uint8_t *p, uint64_t a, uint64_t n) {
+    for(uint64_t i = a; i < a + n; i++) {
+        if(p[i])
+            return false;
+    }
+    return true;
+}
+
+// only the memory image in the first size bytes
+static bool is_fresh(uint8_t *p, uint64_t size) {
+    uint64_t end = IMAGE_OFFSET + strlen(IMAGE_DATA);
+    return memcmp(p + IMAGE_OFFSET, IMAGE_DATA, strlen(IMAGE_DATA)) == 0 &&
+           is_zero(p, 0, IMAGE_OFFSET) && is_zero(p, end, size - end);
+}
+
+static void test_recycle(module_t *mod, uint32_t backing) {
+    store_t *S = new_store();
+    S->mem_backing = backing;
+
+    moduleinst_t *inst = new_instance(S, mod);
+    memaddr_t memaddr = export(inst, "memory").mem;
+    uint64_t size;
+    uint8_t *data = mem_data(S, memaddr, &size);
+    CHECK(data && size == MIN_PAGES * WASM_PAGE_SIZE);
+    CHECK(is_fresh(data, size));
+
+    // dirty the image, the initial pages and pages grown later
+    CHECK(grow(S, inst, GROW_PAGES) == MIN_PAGES);
+    data = mem_data(S, memaddr, &size);
+    CHECK(size == (MIN_PAGES + GROW_PAGES) * WASM_PAGE_SIZE);
+    memset(data, 0xa5, size);
+    release_instance(S, inst);
+
+    inst = new_instance(S, mod);
+    memaddr = export(inst, "memory").mem;
+    uint8_t *recycled = mem_data(S, memaddr, &size);
+    CHECK(recycled == data);
+    CHECK(size == MIN_PAGES * WASM_PAGE_SIZE);
+    CHECK(is_fresh(recycled, size));
+
+    // pages grown again are zero too
+    CHECK(grow(S, inst, GROW_PAGES) == MIN_PAGES);
+    recycled = mem_data(S, memaddr, &size);
+    CHECK(is_zero(recycled, MIN_PAGES * WASM_PAGE_SIZE, GROW_PAGES * WASM_PAGE_SIZE));
+    release_instance(S, inst);
+}
+
+// mem_read, mem_write and mem_copy check bounds like the guest would
+static void test_mem_api(module_t *mod) {
+    store_t *S = new_store();
+    moduleinst_t *inst_a = new_instance(S, mod), *inst_b = new_instance(S, mod);
+    memaddr_t a = export(inst_a, "memory").mem, b = export(inst_b, "memory").mem;
+    uint64_t size;
+    mem_data(S, a, &size);
+    uint8_t buf[8];
+
+    CHECK(mem_read(S, a, IMAGE_OFFSET, buf, strlen(IMAGE_DATA)) == ERR_SUCCESS);
+    CHECK(memcmp(buf, IMAGE_DATA, strlen(IMAGE_DATA)) == 0);
+
+    // the last bytes, and nothing at the end
+    CHECK(mem_write(S, a, size - 4, "abcd", 4) == ERR_SUCCESS);
+    CHECK(mem_read(S, a, size - 4, buf, 4) == ERR_SUCCESS && memcmp(buf, "abcd", 4) == 0);
+    CHECK(mem_read(S, a, size, buf, 0) == ERR_SUCCESS);
+    CHECK(mem_write(S, a, size, buf, 0) == ERR_SUCCESS);
+    CHECK(mem_copy(S, b, size, a, size, 0) == ERR_SUCCESS);
+
+    // one byte past the end
+    CHECK(mem_read(S, a, size, buf, 1) == ERR_TRAP_OUT_OF_BOUNDS_MEMORY_ACCESS);
+    CHECK(mem_write(S, a, size - 3, "abcd", 4) == ERR_TRAP_OUT_OF_BOUNDS_MEMORY_ACCESS);
+    CHECK(mem_read(S, a, size + 1, buf, 0) == ERR_TRAP_OUT_OF_BOUNDS_MEMORY_ACCESS);
+
+    // a + n wraps around
+    CHECK(mem_read(S, a, UINT64_MAX, buf, 2) == ERR_TRAP_OUT_OF_BOUNDS_MEMORY_ACCESS);
+    CHECK(mem_write(S, a, 1, buf, UINT64_MAX) == ERR_TRAP_OUT_OF_BOUNDS_MEMORY_ACCESS);
+    CHECK(mem_copy(S, b, 0, a, UINT64_MAX - 1, 4) == ERR_TRAP_OUT_OF_BOUNDS_MEMORY_ACCESS);
+    CHECK(mem_copy(S, b, UINT64_MAX - 1, a, 0, 4) == ERR_TRAP_OUT_OF_BOUNDS_MEMORY_ACCESS);
+
+    // across memories, the source left as it is
+    CHECK(mem_write(S, a, 100, "hello", 5) == ERR_SUCCESS);
+    CHECK(mem_copy(S, b, 200, a, 100, 5) == ERR_SUCCESS);
+    CHECK(mem_read(S, b, 200, buf, 5) == ERR_SUCCESS && memcmp(buf, "hello", 5) == 0);
+    CHECK(mem_read(S, b, 100, buf, 5) == ERR_SUCCESS && is_zero(buf, 0, 5));
+    CHECK(mem_read(S, a, 200, buf, 5) == ERR_SUCCESS && is_zero(buf, 0, 5));
+    CHECK(mem_read(S, a, 100, buf, 5) == ERR_SUCCESS && memcmp(buf, "hello", 5) == 0);
+
+    // out of bounds in either memory copies nothing
+    CHECK(mem_copy(S, b, size - 2, a, 100, 5) == ERR_TRAP_OUT_OF_BOUNDS_MEMORY_ACCESS);
+    CHECK(mem_read(S, b, size - 2, buf, 2) == ERR_SUCCESS && is_zero(buf, 0, 2));
+    CHECK(mem_copy(S, b, 0, a, size - 2, 5) == ERR_TRAP_OUT_OF_BOUNDS_MEMORY_ACCESS);
+    CHECK(mem_read(S, b, 0, buf, 5) == ERR_SUCCESS && is_zero(buf, 0, 5));
+
+    // overlapping, within one memory
+    CHECK(mem_copy(S, a, 101, a, 100, 5) == ERR_SUCCESS);
+    CHECK(mem_read(S, a, 100, buf, 6) == ERR_SUCCESS && memcmp(buf, "hhello", 6) == 0);
+
+    // the bounds follow memory.grow
+    CHECK(grow(S, inst_a, 1) == MIN_PAGES);
+    CHECK(mem_write(S, a, size, "x", 1) == ERR_SUCCESS);
+    CHECK(mem_write(S, b, size, "x", 1) == ERR_TRAP_OUT_OF_BOUNDS_MEMORY_ACCESS);
+
+    // no memory at the address
+    CHECK(mem_read(S, S->mems.len, 0, buf, 1) == ERR_FAILED);
+    release_instance(S, inst_b);
+    CHECK(mem_data(S, b, &size) == NULL);
+    CHECK(mem_write(S, b, 0, "x", 1) == ERR_FAILED);
+    CHECK(mem_copy(S, a, 0, b, 0, 1) == ERR_FAILED);
+    release_instance(S, inst_a);
+}
+
+// the address space of the process in bytes
+static uint64_t vm_size(void) {
+    FILE *f = fopen("/proc/self/status", "r");
+    char line[128];
+    uint64_t kb = 0;
+    while(f && fgets(line, sizeof(line), f)) {
+        if(sscanf(line, "VmSize: %lu kB", &kb) == 1)
+            break;
+    }
+    if(f)
+        fclose(f);
+    return kb * 1024;
+}
+
+// reservations the pool has no room for are unmapped, not leaked
+static void test_pool_overflow(module_t *mod) {
+    store_t *S = new_store();
+    moduleinst_t *insts[MEM_POOL_SIZE + 16];
+    size_t n = sizeof(insts) / sizeof(insts[0]);
+    uint64_t before = vm_size();
+
+    for(int round = 0; round < 2; round++) {
+        for(size_t i = 0; i < n; i++)
+            insts[i] = new_instance(S, mod);
+        for(size_t i = 0; i < n; i++)
+            release_instance(S, insts[i]);
+
+        // at most a full pool is left behind, give or take the heap
+        CHECK(vm_size() <= before + MEM_POOL_SIZE * MEM_RESERVE_SIZE + (1 << 30));
+    }
+}
+
+// open file descriptors of the process
+static int num_fds(void) {
+    DIR *d = opendir("/proc/self/fd");
+    int n = 0;
+    while(d && readdir(d))
+        n++;
+    if(d)
+        closedir(d);
+    return n;
+}
+
+#define NUM_THREADS     8
+
+typedef struct {
+    module_t            *mod;
+    pthread_barrier_t   *start;
+    bool                fresh;
+} instantiator_t;
+
+static void *instantiate_fresh(void *arg) {
+    instantiator_t *t = arg;
+    store_t *S = new_store();
+
+    pthread_barrier_wait(t->start);
+    moduleinst_t *inst = new_instance(S, t->mod);
+    uint64_t size;
+    uint8_t *data = mem_data(S, export(inst, "memory").mem, &size);
+    t->fresh = data && is_fresh(data, size);
+    release_instance(S, inst);
+    return NULL;
+}
+
+// the first instantiations of a module race to build its memory image:
+// one memfd is made, and every instance sees the data
+static void test_image_race(void) {
+    int fds = num_fds();
+
+    for(int round = 0; round < 20; round++) {
+        module_t *mod = load(image, sizeof(image));
+        pthread_barrier_t start;
+        pthread_barrier_init(&start, NULL, NUM_THREADS);
+
+        pthread_t threads[NUM_THREADS];
+        instantiator_t args[NUM_THREADS];
+        for(int i = 0; i < NUM_THREADS; i++) {
+            args[i] = (instantiator_t){.mod = mod, .start = &start};
+            pthread_create(&threads[i], NULL, instantiate_fresh, &args[i]);
+        }
+        for(int i = 0; i < NUM_THREADS; i++) {
+            pthread_join(threads[i], NULL);
+            CHECK(args[i].fresh);
+        }
+
+        pthread_barrier_destroy(&start);
+        free_module(mod);
+        CHECK(num_fds() == fds);
+    }
+}
+
+// a 64-bit memory gets at least its minimum, or instantiation fails
+static void test_mem64(void) {
+    store_t *S = new_store();
+    struct {
+        uint8_t     *bytes;
+        size_t      size;
+        uint64_t    min;
+    } mems[] = {
+        {mem64_min, sizeof(mem64_min), 1048577},
+        {mem64_max, sizeof(mem64_max), 2000000},
+    };
+
+    for(size_t i = 0; i < sizeof(mems) / sizeof(mems[0]); i++) {
+        module_t *mod = load(mems[i].bytes, mems[i].size);
+        moduleinst_t *inst = new_instance(S, mod);
+        uint64_t size;
+        uint8_t *data = mem_data(S, inst->memaddrs[0], &size);
+        CHECK(data && size == mems[i].min * WASM_PAGE_SIZE);
+
+        uint8_t b = 1;
+        CHECK(mem_write(S, inst->memaddrs[0], size - 1, &b, 1) == ERR_SUCCESS);
+        CHECK(data[size - 1] == 1);
+        release_instance(S, inst);
+        free_module(mod);
+    }
+
+    module_t *mod = load(mem64_huge, sizeof(mem64_huge));
+    externvals_t externvals;
+    VECTOR_INIT(&externvals);
+    moduleinst_t *inst;
+    CHECK(instantiate(S, mod, &externvals, &inst) == ERR_OUT_OF_MEMORY);
+    free_module(mod);
+}
+
+int main(int argc, char *argv[]) {
+    module_t *mod = load(image, sizeof(image));
+
+    // hugetlb falls back to base pages once the pool runs out
+    test_recycle(mod, MEM_BACKING_PAGES);
+    test_recycle(mod, MEM_BACKING_THP);
+    test_recycle(mod, MEM_BACKING_HUGETLB);
+    test_mem_api(mod);
+    test_pool_overflow(mod);
+    test_image_race();
+    test_mem64();
+
+    free_module(mod);
+    if(failures)
+        ERROR("memtest: %d checks failed", failures);
+    else
+        INFO("memtest: passed");
+    return failures != 0;
+}
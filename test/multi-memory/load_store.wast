@@ -0,0 +1,67 @@
+;; loads and stores address the memory named by their memarg
+
+(module
+  (memory $mem0 1)
+  (memory $mem1 1)
+  (memory $mem2 2)
+
+  (data (memory $mem0) (i32.const 0) "\00\01\02\03")
+  (data (memory $mem1) (i32.const 0) "\10\11\12\13")
+  (data (memory $mem2) (i32.const 65536) "\20\21\22\23")
+
+  (func (export "load0") (param i32) (result i32)
+    (i32.load8_u $mem0 (local.get 0)))
+  (func (export "load1") (param i32) (result i32)
+    (i32.load8_u $mem1 (local.get 0)))
+  (func (export "load2") (param i32) (result i32)
+    (i32.load8_u $mem2 (local.get 0)))
+  (func (export "load2_offset") (param i32) (result i32)
+    (i32.load $mem2 offset=65536 (local.get 0)))
+  (func (export "load2_i64") (param i32) (result i64)
+    (i64.load 2 (local.get 0)))
+
+  (func (export "store0") (param i32 i32)
+    (i32.store8 $mem0 (local.get 0) (local.get 1)))
+  (func (export "store1") (param i32 i32)
+    (i32.store8 $mem1 (local.get 0) (local.get 1)))
+  (func (export "store2_i64") (param i32 i64)
+    (i64.store 2 (local.get 0) (local.get 1)))
+)
+
+(assert_return (invoke "load0" (i32.const 1)) (i32.const 0x01))
+(assert_return (invoke "load1" (i32.const 1)) (i32.const 0x11))
+(assert_return (invoke "load2" (i32.const 1)) (i32.const 0))
+(assert_return (invoke "load2" (i32.const 65537)) (i32.const 0x21))
+(assert_return (invoke "load2_offset" (i32.const 0)) (i32.const 0x23222120))
+
+(assert_return (invoke "store1" (i32.const 1) (i32.const 0xff)))
+(assert_return (invoke "load1" (i32.const 1)) (i32.const 0xff))
+(assert_return (invoke "load0" (i32.const 1)) (i32.const 0x01))
+(assert_return (invoke "load2" (i32.const 1)) (i32.const 0))
+
+(assert_return (invoke "store2_i64" (i32.const 131064) (i64.const 0x0807060504030201)))
+(assert_return (invoke "load2_i64" (i32.const 131064)) (i64.const 0x0807060504030201))
+(assert_return (invoke "load2" (i32.const 131071)) (i32.const 0x08))
+
+;; each memory is bounds checked against its own size
+(assert_trap (invoke "load0" (i32.const 65536)) "out of bounds memory access")
+(assert_trap (invoke "load1" (i32.const 65536)) "out of bounds memory access")
+(assert_trap (invoke "store0" (i32.const 65536) (i32.const 0)) "out of bounds memory access")
+(assert_trap (invoke "store1" (i32.const 65536) (i32.const 0)) "out of bounds memory access")
+(assert_trap (invoke "load2" (i32.const 131072)) "out of bounds memory access")
+(assert_trap (invoke "load2_offset" (i32.const 65533)) "out of bounds memory access")
+(assert_trap (invoke "load2_i64" (i32.const 131065)) "out of bounds memory access")
+(assert_trap (invoke "store2_i64" (i32.const 131065) (i64.const 0)) "out of bounds memory access")
+
+(assert_invalid
+  (module (memory 1) (func (drop (i32.load 1 (i32.const 0)))))
+  "unknown memory"
+)
+(assert_invalid
+  (module (memory 1) (memory 1) (func (i32.store8 2 (i32.const 0) (i32.const 0))))
+  "unknown memory"
+)
+(assert_invalid
+  (module (memory 1) (data (memory 1) (i32.const 0) ""))
+  "unknown memory"
+)
@@ -0,0 +1,77 @@
+;; memory.copy, memory.fill and memory.init across memories
+
+(module
+  (memory $m0 1)
+  (memory $m1 1)
+  (data $d "\aa\bb\cc\dd")
+  (data (memory $m1) (i32.const 8) "\01\02\03\04")
+
+  (func (export "copy_1_to_0") (param i32 i32 i32)
+    (memory.copy $m0 $m1 (local.get 0) (local.get 1) (local.get 2)))
+  (func (export "copy_0_to_1") (param i32 i32 i32)
+    (memory.copy $m1 $m0 (local.get 0) (local.get 1) (local.get 2)))
+  (func (export "copy_1_to_1") (param i32 i32 i32)
+    (memory.copy $m1 $m1 (local.get 0) (local.get 1) (local.get 2)))
+  (func (export "fill1") (param i32 i32 i32)
+    (memory.fill $m1 (local.get 0) (local.get 1) (local.get 2)))
+  (func (export "init1") (param i32 i32 i32)
+    (memory.init $m1 $d (local.get 0) (local.get 1) (local.get 2)))
+  (func (export "drop") (data.drop $d))
+
+  (func (export "load0") (param i32) (result i32) (i32.load8_u $m0 (local.get 0)))
+  (func (export "load1") (param i32) (result i32) (i32.load8_u $m1 (local.get 0)))
+)
+
+(assert_return (invoke "copy_1_to_0" (i32.const 0) (i32.const 8) (i32.const 4)))
+(assert_return (invoke "load0" (i32.const 0)) (i32.const 0x01))
+(assert_return (invoke "load0" (i32.const 3)) (i32.const 0x04))
+(assert_return (invoke "load1" (i32.const 0)) (i32.const 0))
+(assert_return (invoke "load1" (i32.const 8)) (i32.const 0x01))
+
+(assert_return (invoke "copy_0_to_1" (i32.const 65532) (i32.const 0) (i32.const 4)))
+(assert_return (invoke "load1" (i32.const 65535)) (i32.const 0x04))
+(assert_return (invoke "load0" (i32.const 65535)) (i32.const 0))
+
+;; overlapping copy within one memory
+(assert_return (invoke "copy_1_to_1" (i32.const 9) (i32.const 8) (i32.const 4)))
+(assert_return (invoke "load1" (i32.const 8)) (i32.const 0x01))
+(assert_return (invoke "load1" (i32.const 9)) (i32.const 0x01))
+(assert_return (invoke "load1" (i32.const 12)) (i32.const 0x04))
+
+(assert_return (invoke "fill1" (i32.const 100) (i32.const 0x55) (i32.const 3)))
+(assert_return (invoke "load1" (i32.const 102)) (i32.const 0x55))
+(assert_return (invoke "load1" (i32.const 103)) (i32.const 0))
+(assert_return (invoke "load0" (i32.const 100)) (i32.const 0))
+
+(assert_return (invoke "init1" (i32.const 200) (i32.const 1) (i32.const 2)))
+(assert_return (invoke "load1" (i32.const 200)) (i32.const 0xbb))
+(assert_return (invoke "load1" (i32.const 201)) (i32.const 0xcc))
+(assert_return (invoke "load0" (i32.const 200)) (i32.const 0))
+
+;; the source and the destination are checked against their own memories
+(assert_trap (invoke "copy_0_to_1" (i32.const 65535) (i32.const 0) (i32.const 2)) "out of bounds memory access")
+(assert_trap (invoke "copy_1_to_0" (i32.const 0) (i32.const 65535) (i32.const 2)) "out of bounds memory access")
+(assert_return (invoke "copy_1_to_0" (i32.const 65536) (i32.const 0) (i32.const 0)))
+(assert_trap (invoke "copy_1_to_0" (i32.const 65537) (i32.const 0) (i32.const 0)) "out of bounds memory access")
+(assert_trap (invoke "fill1" (i32.const 65535) (i32.const 0) (i32.const 2)) "out of bounds memory access")
+(assert_trap (invoke "init1" (i32.const 65535) (i32.const 0) (i32.const 2)) "out of bounds memory access")
+
+(assert_return (invoke "drop"))
+(assert_trap (invoke "init1" (i32.const 0) (i32.const 0) (i32.const 1)) "out of bounds memory access")
+(assert_return (invoke "init1" (i32.const 0) (i32.const 0) (i32.const 0)))
+
+(assert_invalid
+  (module (memory 1)
+    (func (memory.copy 0 1 (i32.const 0) (i32.const 0) (i32.const 0))))
+  "unknown memory"
+)
+(assert_invalid
+  (module (memory 1)
+    (func (memory.fill 1 (i32.const 0) (i32.const 0) (i32.const 0))))
+  "unknown memory"
+)
+(assert_invalid
+  (module (memory 1) (data "")
+    (func (memory.init 1 0 (i32.const 0) (i32.const 0) (i32.const 0))))
+  "unknown memory"
+)
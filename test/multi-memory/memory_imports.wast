@@ -0,0 +1,44 @@
+;; imported and defined memories share one index space
+
+(module $M
+  (memory (export "mem0") 1)
+  (memory (export "mem1") 1 2)
+  (data (memory 1) (i32.const 0) "\2a")
+  (func (export "load1") (param i32) (result i32) (i32.load8_u 1 (local.get 0)))
+)
+(register "M" $M)
+
+(module $N
+  (import "spectest" "memory" (memory 1 2))
+  (import "M" "mem1" (memory $m1 1))
+  (memory $own 1)
+  (data (memory $own) (i32.const 0) "\07")
+
+  (func (export "load_m1") (param i32) (result i32) (i32.load8_u $m1 (local.get 0)))
+  (func (export "store_m1") (param i32 i32) (i32.store8 $m1 (local.get 0) (local.get 1)))
+  (func (export "grow_m1") (param i32) (result i32) (memory.grow $m1 (local.get 0)))
+  (func (export "load_own") (param i32) (result i32) (i32.load8_u $own (local.get 0)))
+  (func (export "size_0") (result i32) (memory.size 0))
+  (func (export "size_own") (result i32) (memory.size $own))
+)
+
+(assert_return (invoke $N "load_m1" (i32.const 0)) (i32.const 42))
+(assert_return (invoke $N "load_own" (i32.const 0)) (i32.const 7))
+(assert_return (invoke $N "store_m1" (i32.const 1) (i32.const 9)))
+(assert_return (invoke $M "load1" (i32.const 1)) (i32.const 9))
+
+;; growth through an import is seen by the exporting module
+(assert_return (invoke $N "grow_m1" (i32.const 1)) (i32.const 1))
+(assert_return (invoke $M "load1" (i32.const 65536)) (i32.const 0))
+(assert_return (invoke $N "grow_m1" (i32.const 1)) (i32.const -1))
+(assert_return (invoke $N "size_0") (i32.const 1))
+(assert_return (invoke $N "size_own") (i32.const 1))
+
+(assert_unlinkable
+  (module (import "M" "mem1" (memory 1 1)))
+  "incompatible import type"
+)
+(assert_unlinkable
+  (module (import "M" "mem0" (memory 1)) (import "M" "mem2" (memory 1)))
+  "unknown import"
+)
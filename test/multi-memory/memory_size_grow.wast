@@ -0,0 +1,48 @@
+;; memory.size and memory.grow act on the memory named by their immediate
+
+(module
+  (memory $a 0)
+  (memory $b 1 2)
+  (memory $c 0 0)
+
+  (func (export "size_a") (result i32) (memory.size $a))
+  (func (export "size_b") (result i32) (memory.size $b))
+  (func (export "size_c") (result i32) (memory.size $c))
+  (func (export "grow_a") (param i32) (result i32) (memory.grow $a (local.get 0)))
+  (func (export "grow_b") (param i32) (result i32) (memory.grow $b (local.get 0)))
+  (func (export "grow_c") (param i32) (result i32) (memory.grow $c (local.get 0)))
+  (func (export "load_a") (param i32) (result i32) (i32.load8_u $a (local.get 0)))
+  (func (export "load_b") (param i32) (result i32) (i32.load8_u $b (local.get 0)))
+  (func (export "store_b") (param i32 i32) (i32.store8 $b (local.get 0) (local.get 1)))
+)
+
+(assert_return (invoke "size_a") (i32.const 0))
+(assert_return (invoke "size_b") (i32.const 1))
+(assert_return (invoke "size_c") (i32.const 0))
+
+(assert_return (invoke "grow_b" (i32.const 1)) (i32.const 1))
+(assert_return (invoke "size_b") (i32.const 2))
+(assert_return (invoke "size_a") (i32.const 0))
+(assert_return (invoke "grow_b" (i32.const 1)) (i32.const -1))
+(assert_return (invoke "store_b" (i32.const 131071) (i32.const 7)))
+(assert_return (invoke "load_b" (i32.const 131071)) (i32.const 7))
+(assert_trap (invoke "load_b" (i32.const 131072)) "out of bounds memory access")
+
+(assert_trap (invoke "load_a" (i32.const 0)) "out of bounds memory access")
+(assert_return (invoke "grow_a" (i32.const 3)) (i32.const 0))
+(assert_return (invoke "size_a") (i32.const 3))
+(assert_return (invoke "load_a" (i32.const 196607)) (i32.const 0))
+(assert_return (invoke "size_b") (i32.const 2))
+
+(assert_return (invoke "grow_c" (i32.const 0)) (i32.const 0))
+(assert_return (invoke "grow_c" (i32.const 1)) (i32.const -1))
+(assert_return (invoke "size_c") (i32.const 0))
+
+(assert_invalid
+  (module (memory 1) (func (drop (memory.size 1))))
+  "unknown memory"
+)
+(assert_invalid
+  (module (memory 1) (func (drop (memory.grow 1 (i32.const 0)))))
+  "unknown memory"
+)
@@ -3,7 +3,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <inttypes.h>
-#include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -24,6 +23,8 @@ typedef struct {
 } test_module_t;
 
 static test_module_t *current_test_module = NULL;
+// threads decoding and validating function bodies (see decoder_set_threads)
+static uint32_t decode_threads = 1;
 
 static store_t *S = NULL;
 
@@ -84,9 +85,26 @@ static const char *error_msg[] = {
     [-ERR_TRAP_OUT_OF_BOUNDS_TABLE_ACCESS]                      = "out of bounds table access",
     [-ERR_TRAP_CALL_STACK_EXHAUSTED]                            = "call stack exhausted",
     [-ERR_INCOMPATIBLE_IMPORT_TYPE]                             = "incompatible import type",
+    [-ERR_OUT_OF_MEMORY]                                        = "out of memory",
+};
+
+// Assertions of the 2.0 testsuite on restrictions lifted by multi-memory:
+// a second memory, and a memory index in place of the reserved zero byte.
+// These modules are valid now and the assertions are skipped (see test/multi-memory).
+static const char *superseded_by_multi_memory[] = {
+    "multiple memories",
+    "zero byte expected",
 };
 
 // helpers
+static bool is_superseded(const char *text) {
+    for(size_t i = 0; i < sizeof(superseded_by_multi_memory) / sizeof(superseded_by_multi_memory[0]); i++) {
+        if(strstr(text, superseded_by_multi_memory[i]))
+            return true;
+    }
+    return false;
+}
+
 static test_module_t *new_test_module(const char *name, const char *export_name, moduleinst_t *moduleinst) {
     test_module_t *test_module = malloc(sizeof(test_module_t));
     list_elem_init(&test_module->link);
@@ -127,30 +145,30 @@ static error_t find_export(test_module_t *from, const char *name, externval_t *e
     __catch:
         return err;
 }
+// modules are streamed through decoder_feed a chunk at a time, as from a pipe
 error_t decode_module_from_fpath(const char *fpath, module_t **mod) {
     __try {
         int fd = open(fpath, O_RDONLY);
         __throwif(ERR_FAILED, fd == -1);
 
-        struct stat s;
-        __throwif(ERR_FAILED, fstat(fd, &s) == -1);
-
-        size_t size = s.st_size;
+        decoder_t *d;
+        __throwiferr(new_decoder(&d));
+        decoder_set_threads(d, decode_threads);
 
-        uint8_t *image = NULL;
-        if(size != 0) {
-            image =  mmap(
-                NULL,
-                size,
-                PROT_READ,
-                MAP_PRIVATE,
-                fd, 
-                0
-            );
-            __throwif(ERR_FAILED, image == MAP_FAILED);
+        uint8_t chunk[4096];
+        ssize_t n;
+        while((n = read(fd, chunk, sizeof(chunk))) > 0) {
+            if(IS_ERROR(decoder_feed(d, chunk, n)))
+                break;
         }
-        error_t ret = decode_module(mod, image, size);
+        close(fd);
+
+        error_t ret = decoder_finish(d, mod);
         __throwiferr(ret);
+        if(n < 0) {
+            free_module(*mod);
+            __throw(ERR_FAILED);
+        }
     }
     __catch:
         return err;
@@ -314,6 +332,10 @@ static bool match_tabletype(tabletype_t *tt1, tabletype_t *tt2) {
 }
 
 static bool match_memtype(memtype_t *mt1, memtype_t *mt2) {
+    // a 32-bit memory never matches a 64-bit one
+    if(mt1->is64 != mt2->is64)
+        return false;
+
     return match_limits(mt1, mt2);
 }
 
@@ -490,6 +512,7 @@ static error_t run_command(JSON_Object *command) {
 
                     // empty stack if assert_{exhaustion, trap}
                     S->stack->idx = -1;
+                    S->stack->frame_idx = -1;
                 }
             }
             else if(strcmp(action_type, "get") == 0) {
@@ -529,6 +552,11 @@ static error_t run_command(JSON_Object *command) {
 
             // validate
             error_t ret = validate_module(module);
+            free_module(module);
+            if(!IS_ERROR(ret) && is_superseded(json_object_get_string(command, "text"))) {
+                WARN("Skip: type: %s, line: %0.f (superseded by multi-memory)", type, line);
+                __throw(ERR_SUCCESS);
+            }
             __throwif(ERR_FAILED, !IS_ERROR(ret));
 
             // check that error messagees match
@@ -548,6 +576,11 @@ static error_t run_command(JSON_Object *command) {
 
                 // check that decode fails
                 error_t ret = decode_module_from_fpath(fpath, &module);
+                if(!IS_ERROR(ret) && is_superseded(json_object_get_string(command, "text"))) {
+                    free_module(module);
+                    WARN("Skip: type: %s, line: %0.f (superseded by multi-memory)", type, line);
+                    __throw(ERR_SUCCESS);
+                }
                 __throwif(ERR_FAILED, !IS_ERROR(ret));
                 
                 // check that error messagees match
@@ -589,6 +622,7 @@ static error_t run_command(JSON_Object *command) {
 
             // empty the stack
             S->stack->idx = -1;
+            S->stack->frame_idx = -1;
         }
         else if(strcmp(type, "assert_unlinkable") == 0) {
             module_t *module;
@@ -616,6 +650,7 @@ static error_t run_command(JSON_Object *command) {
 
             // empty the stack
             S->stack->idx = -1;
+            S->stack->frame_idx = -1;
         }
         else if(strcmp(type, "register") == 0) {
             const char *as = json_object_get_string(command, "as");
@@ -638,19 +673,59 @@ static error_t run_command(JSON_Object *command) {
         return err;
 }
 
+static const char *tier_names[] = {
+    [TIER_STACK]    = "stack",
+    [TIER_REGISTER] = "register",
+    [TIER_JIT]      = "jit",
+    [TIER_TIERED]   = "tiered",
+};
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-t stack|register|jit|tiered] [-T hot_threshold] [-j threads] <testsuite.json>\n", prog);
+    exit(1);
+}
+
 int main(int argc, char *argv[]) {
     JSON_Value *root;
+    uint32_t tier = TIER_STACK;
+    uint32_t hot_threshold = HOT_THRESHOLD;
+
+    int opt;
+    while((opt = getopt(argc, argv, "t:T:j:")) != -1) {
+        switch(opt) {
+            case 't':
+                for(tier = 0; tier < sizeof(tier_names) / sizeof(tier_names[0]); tier++) {
+                    if(strcmp(optarg, tier_names[tier]) == 0)
+                        break;
+                }
+                if(tier == sizeof(tier_names) / sizeof(tier_names[0]))
+                    usage(argv[0]);
+                break;
+            case 'T':
+                hot_threshold = strtoul(optarg, NULL, 0);
+                break;
+            case 'j':
+                decode_threads = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if(optind != argc - 1)
+        usage(argv[0]);
 
     __try {
-        INFO("testsuite: %s", argv[1]);
+        INFO("testsuite: %s (tier: %s, decode threads: %u)", argv[optind], tier_names[tier], decode_threads);
         
         // allocate store
         S = new_store();
+        S->tier = tier;
+        S->hot_threshold = hot_threshold;
 
         // link spectest.wasm
         __throwiferr(link_spec_test(S));
 
-        root = json_parse_file(argv[1]);
+        root = json_parse_file(argv[optind]);
         __throwif(ERR_FAILED, !root);
 
         JSON_Object *obj = json_value_get_object(root);
@@ -0,0 +1,261 @@
+// membench stresses loads and stores that straddle host pages.
+// It builds a module whose functions walk a memory one 4 KiB page at a time,
+// with i64 and i32 accesses either aligned or crossing into the next page,
+// and times them in every tier. The results are checked against the same
+// accesses done in C.
+//
+// usage: membench [iterations]
+
+#include "decode.h"
+#include "validate.h"
+#include "exec.h"
+#include "print.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define NUM_PAGES   17
+
+typedef struct {
+    uint8_t     b[1024];
+    size_t      n;
+} buf_t;
+
+static void put(buf_t *buf, uint8_t byte) {
+    if(buf->n == sizeof(buf->b))
+        PANIC("membench: module too large");
+    buf->b[buf->n++] = byte;
+}
+
+static void put_u(buf_t *buf, uint64_t v) {
+    do {
+        uint8_t byte = v & 0x7f;
+        v >>= 7;
+        put(buf, byte | (v ? 0x80 : 0));
+    } while(v);
+}
+
+static void put_s(buf_t *buf, int64_t v) {
+    for(;;) {
+        uint8_t byte = v & 0x7f;
+        v >>= 7;
+        if((v == 0 && !(byte & 0x40)) || (v == -1 && (byte & 0x40))) {
+            put(buf, byte);
+            return;
+        }
+        put(buf, byte | 0x80);
+    }
+}
+
+static void put_buf(buf_t *buf, buf_t *src) {
+    put_u(buf, src->n);
+    for(size_t i = 0; i < src->n; i++)
+        put(buf, src->b[i]);
+}
+
+static void put_name(buf_t *buf, const char *name) {
+    put_u(buf, strlen(name));
+    for(const char *p = name; *p; p++)
+        put(buf, *p);
+}
+
+static void put_memarg(buf_t *buf, uint8_t op, uint32_t offset) {
+    put(buf, op);
+    put_u(buf, 0);
+    put_u(buf, offset);
+}
+
+// the page and the offset in it of iteration j (local 1)
+static void put_addr(buf_t *buf, bool crossing) {
+    put(buf, OP_LOCAL_GET); put_u(buf, 1);
+    put(buf, OP_I32_CONST); put_s(buf, 12);
+    put(buf, OP_I32_SHL);
+    put(buf, OP_I32_CONST); put_s(buf, 0xff000);
+    put(buf, OP_I32_AND);
+    if(crossing) {
+        put(buf, OP_I32_CONST); put_s(buf, 4089);
+        put(buf, OP_I32_ADD);
+    }
+    put(buf, OP_LOCAL_GET); put_u(buf, 1);
+    put(buf, OP_I32_CONST); put_s(buf, 7);
+    put(buf, OP_I32_AND);
+    if(!crossing) {
+        put(buf, OP_I32_CONST); put_s(buf, 3);
+        put(buf, OP_I32_SHL);
+    }
+    put(buf, OP_I32_ADD);
+}
+
+// (func (param $n i32) (result i64) (local $j i32) (local $a i32) (local $sum i64)
+//   for $j in [0, $n):
+//     $a = address of iteration $j
+//     i64.store $a (i64.load $a + $j)
+//     $sum += i64.load $a + i64.load32_u offset=k $a)
+static void put_func(buf_t *code, bool crossing) {
+    buf_t f = {.n = 0};
+    put_u(&f, 2);
+    put_u(&f, 2); put(&f, TYPE_NUM_I32);
+    put_u(&f, 1); put(&f, TYPE_NUM_I64);
+
+    put(&f, OP_BLOCK); put(&f, 0x40);
+    put(&f, OP_LOOP); put(&f, 0x40);
+    put(&f, OP_LOCAL_GET); put_u(&f, 1);
+    put(&f, OP_LOCAL_GET); put_u(&f, 0);
+    put(&f, OP_I32_GE_U);
+    put(&f, OP_BR_IF); put_u(&f, 1);
+
+    put_addr(&f, crossing);
+    put(&f, OP_LOCAL_SET); put_u(&f, 2);
+
+    put(&f, OP_LOCAL_GET); put_u(&f, 2);
+    put(&f, OP_LOCAL_GET); put_u(&f, 2);
+    put_memarg(&f, OP_I64_LOAD, 0);
+    put(&f, OP_LOCAL_GET); put_u(&f, 1);
+    put(&f, OP_I64_EXTEND_I32_U);
+    put(&f, OP_I64_ADD);
+    put_memarg(&f, OP_I64_STORE, 0);
+
+    put(&f, OP_LOCAL_GET); put_u(&f, 3);
+    put(&f, OP_LOCAL_GET); put_u(&f, 2);
+    put_memarg(&f, OP_I64_LOAD, 0);
+    put(&f, OP_I64_ADD);
+    put(&f, OP_LOCAL_GET); put_u(&f, 2);
+    put_memarg(&f, OP_I64_LOAD32_U, crossing ? 2 : 4);
+    put(&f, OP_I64_ADD);
+    put(&f, OP_LOCAL_SET); put_u(&f, 3);
+
+    put(&f, OP_LOCAL_GET); put_u(&f, 1);
+    put(&f, OP_I32_CONST); put_s(&f, 1);
+    put(&f, OP_I32_ADD);
+    put(&f, OP_LOCAL_SET); put_u(&f, 1);
+    put(&f, OP_BR); put_u(&f, 0);
+    put(&f, OP_END);
+    put(&f, OP_END);
+    put(&f, OP_LOCAL_GET); put_u(&f, 3);
+    put(&f, OP_END);
+
+    put_buf(code, &f);
+}
+
+static void put_section(buf_t *buf, uint8_t id, buf_t *sec) {
+    put(buf, id);
+    put_buf(buf, sec);
+}
+
+static void build_module(buf_t *m) {
+    static const uint8_t header[] = {0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00};
+    for(size_t i = 0; i < sizeof(header); i++)
+        put(m, header[i]);
+
+    buf_t sec = {.n = 0};
+    put_u(&sec, 1);
+    put(&sec, 0x60);
+    put_u(&sec, 1); put(&sec, TYPE_NUM_I32);
+    put_u(&sec, 1); put(&sec, TYPE_NUM_I64);
+    put_section(m, 1, &sec);
+
+    sec.n = 0;
+    put_u(&sec, 2); put_u(&sec, 0); put_u(&sec, 0);
+    put_section(m, 3, &sec);
+
+    sec.n = 0;
+    put_u(&sec, 1); put(&sec, 0x00); put_u(&sec, NUM_PAGES);
+    put_section(m, 5, &sec);
+
+    sec.n = 0;
+    put_u(&sec, 2);
+    put_name(&sec, "aligned"); put(&sec, 0x00); put_u(&sec, 0);
+    put_name(&sec, "crossing"); put(&sec, 0x00); put_u(&sec, 1);
+    put_section(m, 7, &sec);
+
+    sec.n = 0;
+    put_u(&sec, 2);
+    put_func(&sec, false);
+    put_func(&sec, true);
+    put_section(m, 10, &sec);
+}
+
+// the same accesses in C
+static int64_t expect(bool crossing, uint32_t n) {
+    static uint8_t mem[NUM_PAGES * WASM_PAGE_SIZE];
+    memset(mem, 0, sizeof(mem));
+
+    int64_t sum = 0;
+    for(uint32_t j = 0; j < n; j++) {
+        uint32_t a = ((j << 12) & 0xff000) + (crossing ? 4089 + (j & 7) : (j & 7) << 3);
+        int64_t v;
+        uint32_t w;
+        memcpy(&v, mem + a, 8);
+        v += j;
+        memcpy(mem + a, &v, 8);
+        memcpy(&w, mem + a + (crossing ? 2 : 4), 4);
+        sum += v + w;
+    }
+    return sum;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// run an exported function of a fresh instance in tier, returns ns per iteration
+static double run(module_t *mod, uint32_t tier, uint32_t funcidx, uint32_t n, int64_t *sum) {
+    store_t *S = new_store();
+    S->tier = tier;
+
+    externvals_t externvals;
+    VECTOR_INIT(&externvals);
+    moduleinst_t *inst;
+    if(IS_ERROR(instantiate(S, mod, &externvals, &inst)))
+        PANIC("membench: instantiation failed");
+
+    args_t args;
+    VECTOR_NEW(&args, 1, 1);
+    args.elem[0] = (arg_t){.type = TYPE_NUM_I32, .val.num.i32 = n};
+
+    uint64_t t0 = now_ns();
+    if(IS_ERROR(invoke(S, inst->funcaddrs[funcidx], &args)))
+        PANIC("membench: trapped");
+    uint64_t t1 = now_ns();
+
+    *sum = args.elem[0].val.num.i64;
+    release_instance(S, inst);
+    return (double)(t1 - t0) / n;
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t n = argc > 1 ? strtoul(argv[1], NULL, 0) : 10000000;
+
+    buf_t image = {.n = 0};
+    build_module(&image);
+
+    module_t *mod;
+    if(IS_ERROR(decode_module(&mod, image.b, image.n)) || IS_ERROR(validate_module(mod))) {
+        fprintf(stderr, "membench: invalid module\n");
+        return 1;
+    }
+
+    static const char *tiers[] = {"stack", "register", "jit"};
+    int64_t want[2] = {expect(false, n), expect(true, n)};
+    int failed = 0;
+
+    printf("%-10s %12s %12s   (ns per iteration, %u iterations)\n", "tier", "aligned", "crossing", n);
+    for(uint32_t tier = TIER_STACK; tier <= TIER_JIT; tier++) {
+        double ns[2];
+        for(uint32_t f = 0; f < 2; f++) {
+            int64_t sum;
+            ns[f] = run(mod, tier, f, n, &sum);
+            if(sum != want[f]) {
+                fprintf(stderr, "membench: %s %s: got %ld, want %ld\n", tiers[tier], f ? "crossing" : "aligned", sum, want[f]);
+                failed = 1;
+            }
+        }
+        printf("%-10s %12.2f %12.2f\n", tiers[tier], ns[0], ns[1]);
+    }
+    free_module(mod);
+    return failed;
+}
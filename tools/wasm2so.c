@@ -0,0 +1,628 @@
+// wasm2so compiles a module ahead of time into a shared object.
+// Every function is translated into a C function with the signature of
+// jitcode_t (see jit.h), and the C code is built with the system compiler.
+// load_aot binds the functions of a module instance to the shared object,
+// which records the hash of the module bytes (module_t.hash) to check against.
+//
+// usage: wasm2so [-I <include dir>] <module.wasm> <module.so>
+//
+// The generated C code is kept next to the shared object (module.so.c).
+// It includes the runtime headers, found in the directory given by -I, else
+// by the environment variable WASM2SO_INCLUDE, else in WASM2SO_INCLUDE_DIR
+// (set when wasm2so is built). The compiler is taken from CC (cc by default).
+//
+// Operands and locals become C variables (s0, s1, ... and l0, l1, ...), so
+// the C compiler can keep them in registers. Blocks become labels, and a
+// branch assigns the values it keeps to the variables at the label's height
+// before jumping. Loads and stores address memory 0 from its base, loaded
+// once per call, without bounds checks: out-of-bounds accesses fault in the
+// reservation of the memory and trap (see trap.h). Functions using table or
+// bulk memory instructions, or accessing other memories than a 32-bit
+// memory 0, are not translated and run as flat code instead.
+
+#include "decode.h"
+#include "validate.h"
+#include "compile.h"
+#include "exec.h"
+#include "numeric.h"
+#include "exception.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#ifndef WASM2SO_INCLUDE_DIR
+#define WASM2SO_INCLUDE_DIR "."
+#endif
+
+// numeric instructions, see numeric.h
+typedef struct {
+    const char  *t;
+    const char  *r;
+    const char  *expr;
+} numop_t;
+
+#define NUMOP(op, T, R, expr)   [op] = {#T, #R, #expr},
+static const numop_t unops[NUM_OPS]  = { FOREACH_UNOP(NUMOP) };
+static const numop_t binops[NUM_OPS] = { FOREACH_BINOP(NUMOP) };
+
+// whether a numeric expression uses a helper of numeric.h that traps
+static bool traps(const char *expr) {
+    static const char *helpers[] = {"DIV_S(", "DIV_U(", "REM_S(", "REM_U(", "TRUNC_F"};
+    for(size_t i = 0; i < sizeof(helpers) / sizeof(helpers[0]); i++) {
+        if(strstr(expr, helpers[i]))
+            return true;
+    }
+    return false;
+}
+
+// loads and stores: the value type and the type in memory, like LOAD and STORE in exec.c
+typedef struct {
+    const char  *t;
+    const char  *ct;
+} memop_t;
+
+static const memop_t memops[] = {
+    [OP_I32_LOAD     - OP_I32_LOAD] = {"I32", "int32_t"},
+    [OP_I64_LOAD     - OP_I32_LOAD] = {"I64", "int64_t"},
+    [OP_F32_LOAD     - OP_I32_LOAD] = {"I32", "int32_t"},
+    [OP_F64_LOAD     - OP_I32_LOAD] = {"I64", "int64_t"},
+    [OP_I32_LOAD8_S  - OP_I32_LOAD] = {"I32", "int8_t"},
+    [OP_I32_LOAD8_U  - OP_I32_LOAD] = {"I32", "uint8_t"},
+    [OP_I32_LOAD16_S - OP_I32_LOAD] = {"I32", "int16_t"},
+    [OP_I32_LOAD16_U - OP_I32_LOAD] = {"I32", "uint16_t"},
+    [OP_I64_LOAD8_S  - OP_I32_LOAD] = {"I64", "int8_t"},
+    [OP_I64_LOAD8_U  - OP_I32_LOAD] = {"I64", "uint8_t"},
+    [OP_I64_LOAD16_S - OP_I32_LOAD] = {"I64", "int16_t"},
+    [OP_I64_LOAD16_U - OP_I32_LOAD] = {"I64", "uint16_t"},
+    [OP_I64_LOAD32_S - OP_I32_LOAD] = {"I64", "int32_t"},
+    [OP_I64_LOAD32_U - OP_I32_LOAD] = {"I64", "uint32_t"},
+    [OP_I32_STORE    - OP_I32_LOAD] = {"I32", "int32_t"},
+    [OP_I64_STORE    - OP_I32_LOAD] = {"I64", "int64_t"},
+    [OP_F32_STORE    - OP_I32_LOAD] = {"I32", "int32_t"},
+    [OP_F64_STORE    - OP_I32_LOAD] = {"I64", "int64_t"},
+    [OP_I32_STORE8   - OP_I32_LOAD] = {"I32", "uint8_t"},
+    [OP_I32_STORE16  - OP_I32_LOAD] = {"I32", "uint16_t"},
+    [OP_I64_STORE8   - OP_I32_LOAD] = {"I64", "uint8_t"},
+    [OP_I64_STORE16  - OP_I32_LOAD] = {"I64", "uint16_t"},
+    [OP_I64_STORE32  - OP_I32_LOAD] = {"I64", "uint32_t"},
+};
+
+// label of an enclosing block
+typedef struct {
+    list_elem_t     link;
+    char            name[16];
+    // a branch keeps arity values at height
+    uint32_t        height;
+    uint32_t        arity;
+    // a branch jumps to it
+    bool            used;
+} label_t;
+
+typedef struct {
+    module_t        *mod;
+    FILE            *out;
+    list_t          labels;
+    uint32_t        num_labels;
+    uint32_t        height;
+    uint32_t        max_height;
+    // the rest of the instruction sequence is unreachable
+    bool            unreachable;
+    // the function may trap, so it needs __catch
+    bool            throws;
+    // the function loads or stores, so it needs the base of memory 0
+    bool            uses_mem;
+} emitter_t;
+
+// "I32" -> "i32"
+static const char *member(const char *t) {
+    static char buf[4][4];
+    static int n;
+    char *m = buf[n++ & 3];
+    for(int i = 0; i < 3; i++)
+        m[i] = tolower(t[i]);
+    m[3] = 0;
+    return m;
+}
+
+static const char *ctype(const char *t) {
+    switch(t[1]) {
+        case '3': return t[0] == 'I' ? "int32_t" : "float";
+        default:  return t[0] == 'I' ? "int64_t" : "double";
+    }
+}
+
+static void push(emitter_t *e, uint32_t n) {
+    e->height += n;
+    if(e->height > e->max_height)
+        e->max_height = e->height;
+}
+
+static void push_label(emitter_t *e, label_t *l, char kind, uint32_t height, uint32_t arity) {
+    snprintf(l->name, sizeof(l->name), "%c%u", kind, e->num_labels++);
+    l->height = height;
+    l->arity = arity;
+    l->used = false;
+    list_push_back(&e->labels, &l->link);
+}
+
+// keep the top arity operands at the label's height, then jump to it
+static error_t emit_br(emitter_t *e, labelidx_t labelidx) {
+    __try {
+        label_t *l = LIST_GET_ELEM(&e->labels, label_t, link, labelidx);
+        __throwif(ERR_FAILED, !l);
+
+        uint32_t from = e->height - l->arity;
+        for(uint32_t i = 0; i < l->arity; i++) {
+            if(l->height + i != from + i)
+                fprintf(e->out, "    s%u = s%u;\n", l->height + i, from + i);
+        }
+        fprintf(e->out, "    goto %s;\n", l->name);
+        l->used = true;
+    }
+    __catch:
+        return err;
+}
+
+static error_t emit_instrs(emitter_t *e, instr_t *ip);
+
+static error_t emit_block(emitter_t *e, instr_t *ip) {
+    __try {
+        uint32_t nparams, arity;
+        expand_blocktype(e->mod, ip->bt, &nparams, &arity);
+
+        label_t l;
+        if(ip->op1 == OP_IF) {
+            e->height--;
+            push_label(e, &l, 'B', e->height - nparams, arity);
+            fprintf(e->out, "    if(s%u.num.i32) {\n", e->height);
+            uint32_t height = e->height;
+            __throwiferr(emit_instrs(e, ip->in1));
+            fprintf(e->out, "    } else {\n");
+            e->height = height;
+            e->unreachable = false;
+            if(ip->in2)
+                __throwiferr(emit_instrs(e, ip->in2));
+            fprintf(e->out, "    }\n");
+        }
+        else if(ip->op1 == OP_LOOP) {
+            push_label(e, &l, 'L', e->height - nparams, nparams);
+            fprintf(e->out, "%s:;\n", l.name);
+            __throwiferr(emit_instrs(e, ip->in1));
+            // the label comes before the body, so it is known to be unused only now
+            if(!l.used)
+                fprintf(e->out, "    (void)&&%s;\n", l.name);
+        }
+        else {
+            push_label(e, &l, 'B', e->height - nparams, arity);
+            __throwiferr(emit_instrs(e, ip->in1));
+        }
+
+        if(l.name[0] == 'B' && l.used)
+            fprintf(e->out, "%s:;\n", l.name);
+        list_pop_tail(&e->labels);
+
+        // the results are at the height of the block
+        e->height = l.height;
+        push(e, arity);
+        e->unreachable = false;
+    }
+    __catch:
+        return err;
+}
+
+static void emit_call(emitter_t *e, functype_t *ft, const char *call) {
+    uint32_t nparams = ft->rt1.len, nresults = ft->rt2.len;
+
+    e->height -= nparams;
+    fprintf(e->out, "    {\n        val_t *p = *sp;\n");
+    for(uint32_t i = 0; i < nparams; i++)
+        fprintf(e->out, "        p[%u] = s%u;\n", i, e->height + i);
+    fprintf(e->out, "        p += %u;\n", nparams);
+    fprintf(e->out, "        __throwiferr(%s);\n", call);
+    for(uint32_t i = 0; i < nresults; i++)
+        fprintf(e->out, "        s%u = p[%d];\n", e->height + i, (int)i - (int)nresults);
+    fprintf(e->out, "    }\n");
+    push(e, nresults);
+    e->throws = true;
+}
+
+static error_t emit_instr(emitter_t *e, instr_t *ip) {
+    __try {
+        FILE *out = e->out;
+        uint32_t h = e->height;
+        uint32_t op = ip->op1 == OP_0XFC ? OP_FC(ip->op2) : ip->op1;
+        char call[128];
+
+        // only memory 0 with 32-bit addresses is addressed from its base, as in the JIT
+        if(OP_I32_LOAD <= op && op <= OP_MEMORY_GROW) {
+            memidx_t x = op <= OP_I64_STORE32 ? ip->m.memidx : ip->x;
+            __throwif(ERR_FAILED, x != 0 || mem_type(e->mod, 0)->is64);
+        }
+
+        switch(op) {
+            case OP_BLOCK:
+            case OP_LOOP:
+            case OP_IF:
+                __throwiferr(emit_block(e, ip));
+                break;
+
+            // end of a block, handled by emit_block
+            case OP_ELSE:
+            case OP_END:
+            case OP_NOP:
+                break;
+
+            case OP_UNREACHABLE:
+                fprintf(out, "    __throw(ERR_TRAP_UNREACHABLE);\n");
+                e->unreachable = true;
+                e->throws = true;
+                break;
+
+            case OP_BR:
+                __throwiferr(emit_br(e, ip->labelidx));
+                e->unreachable = true;
+                break;
+
+            case OP_BR_IF:
+                e->height--;
+                fprintf(out, "    if(s%u.num.i32) {\n", e->height);
+                __throwiferr(emit_br(e, ip->labelidx));
+                fprintf(out, "    }\n");
+                break;
+
+            case OP_BR_TABLE:
+                e->height--;
+                fprintf(out, "    switch((uint32_t)s%u.num.i32) {\n", e->height);
+                for(uint32_t i = 0; i < ip->labels.len; i++) {
+                    fprintf(out, "    case %u:\n", i);
+                    __throwiferr(emit_br(e, *VECTOR_ELEM(&ip->labels, i)));
+                }
+                fprintf(out, "    default:\n");
+                __throwiferr(emit_br(e, ip->default_label));
+                fprintf(out, "    }\n");
+                e->unreachable = true;
+                break;
+
+            case OP_RETURN: {
+                // the label of the function is the outermost one
+                uint32_t depth = 0;
+                LIST_FOR_EACH(l, &e->labels, label_t, link) {
+                    depth++;
+                }
+                __throwiferr(emit_br(e, depth - 1));
+                e->unreachable = true;
+                break;
+            }
+
+            case OP_CALL:
+                snprintf(call, sizeof(call), "jit_call(S, module, &p, %u)", ip->funcidx);
+                emit_call(e, func_type(e->mod, ip->funcidx), call);
+                break;
+
+            case OP_CALL_INDIRECT:
+                e->height--;
+                snprintf(
+                    call, sizeof(call), "jit_call_indirect(S, module, &p, %u, %u, s%u.num.i32)",
+                    ip->y, ip->x, e->height
+                );
+                emit_call(e, VECTOR_ELEM(&e->mod->types, ip->y), call);
+                break;
+
+            case OP_DROP:
+                e->height--;
+                break;
+
+            case OP_SELECT:
+            case OP_SELECT_T:
+                fprintf(out, "    s%u = s%u.num.i32 ? s%u : s%u;\n", h - 3, h - 1, h - 3, h - 2);
+                e->height -= 2;
+                break;
+
+            case OP_LOCAL_GET:
+                fprintf(out, "    s%u = l%u;\n", h, ip->localidx);
+                push(e, 1);
+                break;
+
+            case OP_LOCAL_SET:
+                fprintf(out, "    l%u = s%u;\n", ip->localidx, h - 1);
+                e->height--;
+                break;
+
+            case OP_LOCAL_TEE:
+                fprintf(out, "    l%u = s%u;\n", ip->localidx, h - 1);
+                break;
+
+            case OP_GLOBAL_GET:
+                fprintf(out, "    s%u = *jit_global(S, module, %u);\n", h, ip->globalidx);
+                push(e, 1);
+                break;
+
+            case OP_GLOBAL_SET:
+                fprintf(out, "    *jit_global(S, module, %u) = s%u;\n", ip->globalidx, h - 1);
+                e->height--;
+                break;
+
+            case OP_I32_LOAD ... OP_I64_LOAD32_U: {
+                const memop_t *m = &memops[op - OP_I32_LOAD];
+                fprintf(
+                    out,
+                    "    {\n"
+                    "        %s v;\n"
+                    "        memcpy(&v, mem0 + (uint64_t)(uint32_t)s%u.num.i32 + %uu, sizeof(v));\n"
+                    "        s%u.num.%s = v;\n"
+                    "    }\n",
+                    m->ct, h - 1, (uint32_t)ip->m.offset, h - 1, member(m->t)
+                );
+                e->uses_mem = true;
+                break;
+            }
+
+            case OP_I32_STORE ... OP_I64_STORE32: {
+                const memop_t *m = &memops[op - OP_I32_LOAD];
+                fprintf(
+                    out,
+                    "    {\n"
+                    "        %s v = s%u.num.%s;\n"
+                    "        memcpy(mem0 + (uint64_t)(uint32_t)s%u.num.i32 + %uu, &v, sizeof(v));\n"
+                    "    }\n",
+                    m->ct, h - 1, member(m->t), h - 2, (uint32_t)ip->m.offset
+                );
+                e->height -= 2;
+                e->uses_mem = true;
+                break;
+            }
+
+            case OP_MEMORY_SIZE:
+                fprintf(out, "    s%u.num.i32 = jit_memory_size(S, module);\n", h);
+                push(e, 1);
+                break;
+
+            case OP_MEMORY_GROW:
+                fprintf(out, "    s%u.num.i32 = jit_memory_grow(S, module, s%u.num.i32);\n", h - 1, h - 1);
+                break;
+
+            // constants are copied as bits
+            case OP_I32_CONST:
+            case OP_F32_CONST:
+                fprintf(out, "    s%u.num.i32 = (int32_t)0x%xu;\n", h, (uint32_t)ip->c.i32);
+                push(e, 1);
+                break;
+
+            case OP_I64_CONST:
+            case OP_F64_CONST:
+                fprintf(out, "    s%u.num.i64 = (int64_t)0x%llxull;\n", h, (unsigned long long)ip->c.i64);
+                push(e, 1);
+                break;
+
+            case OP_REF_NULL:
+                fprintf(out, "    s%u.ref = REF_NULL;\n", h);
+                push(e, 1);
+                break;
+
+            case OP_REF_IS_NULL:
+                fprintf(out, "    s%u.num.i32 = s%u.ref == REF_NULL;\n", h - 1, h - 1);
+                break;
+
+            default:
+                if(unops[op].expr) {
+                    const numop_t *n = &unops[op];
+                    fprintf(
+                        out, "    { %s lhs = s%u.num.%s; s%u.num.%s = (%s); }\n",
+                        ctype(n->t), h - 1, member(n->t), h - 1, member(n->r), n->expr
+                    );
+                    e->throws |= traps(n->expr);
+                }
+                else if(binops[op].expr) {
+                    const numop_t *n = &binops[op];
+                    fprintf(
+                        out, "    { %s lhs = s%u.num.%s, rhs = s%u.num.%s; s%u.num.%s = (%s); }\n",
+                        ctype(n->t), h - 2, member(n->t), h - 1, member(n->t), h - 2, member(n->r), n->expr
+                    );
+                    e->throws |= traps(n->expr);
+                    e->height--;
+                }
+                else {
+                    // tables, references to functions and bulk memory
+                    __throw(ERR_FAILED);
+                }
+                break;
+        }
+    }
+    __catch:
+        return err;
+}
+
+static error_t emit_instrs(emitter_t *e, instr_t *ip) {
+    __try {
+        // the rest of a sequence after a branch is never executed
+        for(; ip && !e->unreachable; ip = ip->next) {
+            __throwiferr(emit_instr(e, ip));
+        }
+    }
+    __catch:
+        return err;
+}
+
+// emits the C function wasm2so_func_<idx>, or nothing if the function cannot be translated
+static error_t emit_func(module_t *mod, FILE *out, uint32_t idx) {
+    func_t *func = VECTOR_ELEM(&mod->funcs, idx);
+    functype_t *ft = VECTOR_ELEM(&mod->types, func->type);
+    uint32_t nparams = ft->rt1.len, nresults = ft->rt2.len;
+
+    // the body is written to a buffer first, to declare the operands it uses
+    char *body = NULL;
+    size_t size = 0;
+    emitter_t e = {.mod = mod, .out = open_memstream(&body, &size)};
+    LIST_INIT(&e.labels);
+
+    __try {
+        __throwif(ERR_FAILED, !e.out);
+
+        label_t ret;
+        push_label(&e, &ret, 'R', 0, nresults);
+        __throwiferr(emit_instrs(&e, func->body));
+        if(ret.used)
+            fprintf(e.out, "%s:;\n", ret.name);
+        fclose(e.out);
+        e.out = NULL;
+
+        fprintf(out, "static error_t wasm2so_func_%u(store_t *S, moduleinst_t *module, val_t *locals, val_t **sp) {\n", idx);
+        fprintf(out, "    __try {\n");
+        // the C compiler drops the variables a function does not need, without warnings
+        fprintf(out, "    (void)S, (void)module, (void)locals;\n");
+        // memory 0 stays put as it grows, so its base is loaded once
+        if(e.uses_mem)
+            fprintf(out, "    uint8_t *mem0 = S->mems.elem[module->memaddrs[0]].data;\n");
+        for(uint32_t i = 0; i < nparams; i++)
+            fprintf(out, "    val_t l%u __attribute__((unused)) = locals[%u];\n", i, i);
+        for(uint32_t i = 0; i < func->locals.len; i++)
+            fprintf(out, "    val_t l%u __attribute__((unused)) = {0};\n", nparams + i);
+        for(uint32_t i = 0; i < e.max_height; i++)
+            fprintf(out, "    val_t s%u __attribute__((unused));\n", i);
+        fputs(body, out);
+        for(uint32_t i = 0; i < nresults; i++)
+            fprintf(out, "    (*sp)[%u] = s%u;\n", i, i);
+        fprintf(out, "    *sp += %u;\n", nresults);
+        if(e.throws)
+            fprintf(out, "    }\n    __catch:\n        return err;\n}\n\n");
+        else
+            fprintf(out, "    }\n    return err;\n}\n\n");
+    }
+    __catch:
+        if(e.out)
+            fclose(e.out);
+        free(body);
+        return err;
+}
+
+static void emit_module(module_t *mod, FILE *out) {
+    uint32_t n = mod->funcs.len;
+    bool *done = calloc(n + 1, sizeof(bool));
+
+    fprintf(out, "// generated by wasm2so\n");
+    fprintf(out, "#include \"exec.h\"\n#include \"jit.h\"\n#include \"numeric.h\"\n#include \"exception.h\"\n");
+    fprintf(out, "#include <math.h>\n#include <string.h>\n\n");
+
+    for(uint32_t i = 0; i < n; i++)
+        done[i] = !IS_ERROR(emit_func(mod, out, i));
+
+    fprintf(out, "const uint64_t wasm2so_module_hash = 0x%016lxull;\n", mod->hash);
+    fprintf(out, "const uint32_t wasm2so_num_funcs = %u;\n\n", n);
+    fprintf(out, "void *const wasm2so_funcs[] = {\n");
+    for(uint32_t i = 0; i < n; i++) {
+        if(done[i])
+            fprintf(out, "    wasm2so_func_%u,\n", i);
+        else
+            fprintf(out, "    NULL,\n");
+    }
+    fprintf(out, "    NULL,\n};\n");
+    free(done);
+}
+
+// append s to cmd in single quotes for the shell of system(), false if cmd is full
+static bool append_quoted(char *cmd, size_t size, const char *s) {
+    size_t n = strlen(cmd);
+    if(n + 4 > size)
+        return false;
+    for(cmd[n++] = '\''; *s; s++) {
+        const char *q = *s == '\'' ? "'\\''" : (char[]){*s, '\0'};
+        size_t len = strlen(q);
+        if(n + len + 3 > size)
+            return false;
+        memcpy(&cmd[n], q, len);
+        n += len;
+    }
+    cmd[n++] = '\'';
+    cmd[n++] = ' ';
+    cmd[n] = '\0';
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    const char *inc = getenv("WASM2SO_INCLUDE");
+    int opt;
+    while((opt = getopt(argc, argv, "I:")) != -1) {
+        switch(opt) {
+            case 'I':
+                inc = optarg;
+                break;
+            default:
+                goto usage;
+        }
+    }
+    if(argc - optind != 2)
+        goto usage;
+    // argv[1] and argv[2] are the module and the shared object from here on
+    argv += optind - 1;
+    if(!inc)
+        inc = WASM2SO_INCLUDE_DIR;
+
+    // fail here rather than with the errors of the compiler
+    char hdr[4096];
+    snprintf(hdr, sizeof(hdr), "%s/exec.h", inc);
+    if(access(hdr, R_OK) != 0) {
+        fprintf(stderr, "%s: no runtime headers, give their directory with -I or WASM2SO_INCLUDE\n", hdr);
+        return 1;
+    }
+
+    FILE *fp = fopen(argv[1], "rb");
+    if(!fp) {
+        perror(argv[1]);
+        return 1;
+    }
+    fseek(fp, 0, SEEK_END);
+    size_t size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    uint8_t *image = malloc(size);
+    if(fread(image, 1, size, fp) != size) {
+        fprintf(stderr, "%s: read error\n", argv[1]);
+        return 1;
+    }
+    fclose(fp);
+
+    module_t *mod;
+    error_t err = decode_module(&mod, image, size);
+    if(IS_ERROR(err)) {
+        fprintf(stderr, "%s: decode error (%d)\n", argv[1], err);
+        return 1;
+    }
+    err = validate_module(mod);
+    if(IS_ERROR(err)) {
+        fprintf(stderr, "%s: validation error (%d)\n", argv[1], err);
+        return 1;
+    }
+
+    char src[4096];
+    snprintf(src, sizeof(src), "%s.c", argv[2]);
+    FILE *out = fopen(src, "w");
+    if(!out) {
+        perror(src);
+        return 1;
+    }
+    emit_module(mod, out);
+    fclose(out);
+
+    const char *cc = getenv("CC");
+    // CC may carry its own arguments, the paths are quoted
+    char cmd[16384];
+    snprintf(cmd, sizeof(cmd), "%s -O2 -shared -fPIC -I", cc ? cc : "cc");
+    bool ok = append_quoted(cmd, sizeof(cmd), inc);
+    ok = ok && strlen(cmd) + 4 < sizeof(cmd);
+    if(ok)
+        strcat(cmd, "-o ");
+    ok = ok && append_quoted(cmd, sizeof(cmd), argv[2]);
+    ok = ok && append_quoted(cmd, sizeof(cmd), src);
+    if(!ok) {
+        fprintf(stderr, "%s: path too long\n", argv[2]);
+        return 1;
+    }
+
+    return system(cmd) == 0 ? 0 : 1;
+
+usage:
+    fprintf(stderr, "usage: %s [-I <include dir>] <module.wasm> <module.so>\n", argv[0]);
+    return 1;
+}